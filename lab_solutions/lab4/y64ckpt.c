@@ -0,0 +1,244 @@
+/* Checkpoints of a Y64 image, for going back to any earlier step */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "y64sim.h"
+
+/* The image as it was after 'step' instructions */
+typedef struct ckpt {
+    long_t step;
+    long_t pc;
+    cc_t cc;
+    long_t reg[REG_NONE];
+    mem_t *m;       /* dup_mem() of the memory: shares every unchanged page */
+} ckpt_t;
+
+typedef struct history {
+    ckpt_t *ck;     /* by increasing step; ck[0] is the initial image */
+    int n, max;
+    long_t interval;
+    long_t step;    /* instructions the image has executed */
+    stat_t stat;    /* status of the last one */
+    engine_t engine;
+} history_t;
+
+static void take_ckpt(y64sim_t *sim, history_t *h)
+{
+    ckpt_t *c;
+    int id;
+
+    if (h->n == h->max) {
+        h->max *= 2;
+        h->ck = (ckpt_t *)realloc(h->ck, h->max * sizeof(ckpt_t));
+    }
+    c = &h->ck[h->n++];
+    c->step = h->step;
+    c->pc = sim->pc;
+    c->cc = sim->cc;
+    for (id = 0; id < REG_NONE; id++)
+        c->reg[id] = get_reg_val(sim->r, id);
+    c->m = dup_mem(sim->m);
+}
+
+/*
+ * new_history: start recording checkpoints of 'sim', beginning with its
+ *     current state as step 0
+ * args
+ *     sim: the y64 image
+ *     interval: steps between checkpoints
+ *     engine: how to execute the steps in between
+ */
+history_t *new_history(y64sim_t *sim, long_t interval, engine_t engine)
+{
+    history_t *h = (history_t *)calloc(1, sizeof(history_t));
+
+    h->max = 16;
+    h->ck = (ckpt_t *)malloc(h->max * sizeof(ckpt_t));
+    h->interval = interval > 0 ? interval : 1;
+    h->stat = STAT_AOK;
+    h->engine = engine;
+    take_ckpt(sim, h);
+    return h;
+}
+
+void free_history(history_t *h)
+{
+    int i;
+
+    for (i = 0; i < h->n; i++)
+        free_mem(h->ck[i].m);
+    free((void *) h->ck);
+    free((void *) h);
+}
+
+/*
+ * hist_run: execute up to 'nsteps' more instructions, checkpointing
+ *     every 'interval' steps on the way
+ * return
+ *     the status of the last instruction executed
+ */
+stat_t hist_run(y64sim_t *sim, history_t *h, long_t nsteps)
+{
+    while (nsteps > 0 && h->stat == STAT_AOK) {
+        long_t next = (h->step / h->interval + 1) * h->interval;
+        long_t left = next - h->step < nsteps ? next - h->step : nsteps;
+        /* the engines count in ints: go to 'next' a piece at a time */
+        int chunk = left > INT_MAX ? INT_MAX : left;
+        int done = 0;
+
+        if (h->engine == ENG_JIT)
+            h->stat = run_jit(sim, chunk, &done);
+        else if (h->engine == ENG_THREADED)
+            h->stat = run_threaded(sim, chunk, &done);
+        else
+            for (done = 0; done < chunk && h->stat == STAT_AOK; done++)
+                h->stat = nexti(sim);
+        h->step += done;
+        nsteps -= done;
+
+        /* steps replayed after a restore already have their checkpoint */
+        if (h->stat == STAT_AOK && h->step == next &&
+            h->ck[h->n-1].step < h->step)
+            take_ckpt(sim, h);
+    }
+    return h->stat;
+}
+
+/* put the image back the way checkpoint 'c' found it */
+static void restore_ckpt(y64sim_t *sim, history_t *h, ckpt_t *c)
+{
+    mem_t *m = dup_mem(c->m);
+    int id;
+
+    m->icache = sim->m->icache;
+    sim->m->icache = NULL;
+    free_mem(sim->m);
+    sim->m = m;
+    icache_flush(m->icache);
+
+    sim->pc = c->pc;
+    sim->cc = c->cc;
+    for (id = 0; id < REG_NONE; id++)
+        set_reg_val(sim->r, id, c->reg[id]);
+    h->step = c->step;
+    h->stat = STAT_AOK;
+}
+
+/*
+ * hist_goto: bring the image to the state it had after 'step'
+ *     instructions, by restoring the closest checkpoint at or before it
+ *     and replaying at most 'interval' steps from there
+ * return
+ *     the status of instruction 'step', STAT_AOK for step 0
+ */
+stat_t hist_goto(y64sim_t *sim, history_t *h, long_t step)
+{
+    int lo = 0, hi = h->n - 1;
+
+    if (step < 0)
+        step = 0;
+    if (step >= h->step && h->stat == STAT_AOK)
+        return hist_run(sim, h, step - h->step);
+
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (h->ck[mid].step <= step)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    restore_ckpt(sim, h, &h->ck[lo]);
+    return hist_run(sim, h, step - h->step);
+}
+
+/* registers and memory that differ from step 0 */
+static void print_changes(y64sim_t *sim, history_t *h, FILE *out)
+{
+    ckpt_t *c = &h->ck[0];
+    int id;
+
+    fprintf(out, "Changes to registers:\n");
+    for (id = 0; id < REG_NONE; id++) {
+        long_t val = get_reg_val(sim->r, id);
+        if (val != c->reg[id])
+            fprintf(out, "%s:\t0x%.16lx\t0x%.16lx\n", reg_table[id].name,
+                    c->reg[id], val);
+    }
+    fprintf(out, "\nChanges to memory:\n");
+    diff_mem(c->m, sim->m, out);
+}
+
+static void print_where(y64sim_t *sim, history_t *h, FILE *out)
+{
+    fprintf(out, "Step %ld: PC = 0x%lx.  Status '%s', CC %s\n",
+            h->step, sim->pc, stat_name(h->stat), cc_name(sim->cc));
+}
+
+static void print_help(FILE *out)
+{
+    fprintf(out, "Commands:\n"
+            "  step [n]   execute n instructions (default 1)\n"
+            "  back [n]   go back n instructions (default 1)\n"
+            "  goto n     go to the state after n instructions\n"
+            "  run        execute until halt, fault or max_steps\n"
+            "  state      print the registers and memory changed since step 0\n"
+            "  ckpt       list the checkpoints taken\n"
+            "  quit       leave\n");
+}
+
+/*
+ * debug_binfile: load a binary and execute it under commands read from
+ *     'in', checkpointing every cfg->ckpt_interval steps so that going
+ *     back costs at most one interval of replay
+ * return
+ *     0 when the commands run out, -1 if the binary could not be loaded
+ */
+int debug_binfile(const char *binname, y64cfg_t *cfg, FILE *in, FILE *out)
+{
+    y64sim_t *sim;
+    history_t *h;
+    char line[256], cmd[256];
+    long_t n;
+
+    sim = open_binfile(binname, cfg, out);
+    if (!sim)
+        return -1;
+    h = new_history(sim, cfg->ckpt_interval, cfg->engine);
+
+    print_where(sim, h, out);
+    while (fgets(line, sizeof(line), in)) {
+        int args = sscanf(line, "%255s %ld", cmd, &n);
+
+        if (args < 1)
+            continue;
+        if (!strcmp(cmd, "step") || !strcmp(cmd, "s")) {
+            hist_run(sim, h, args > 1 ? n : 1);
+        } else if (!strcmp(cmd, "back") || !strcmp(cmd, "b")) {
+            hist_goto(sim, h, h->step - (args > 1 ? n : 1));
+        } else if ((!strcmp(cmd, "goto") || !strcmp(cmd, "g")) && args > 1) {
+            hist_goto(sim, h, n);
+        } else if (!strcmp(cmd, "run") || !strcmp(cmd, "r")) {
+            hist_run(sim, h, cfg->max_steps - h->step);
+        } else if (!strcmp(cmd, "state")) {
+            print_changes(sim, h, out);
+            continue;
+        } else if (!strcmp(cmd, "ckpt")) {
+            int i;
+            for (i = 0; i < h->n; i++)
+                fprintf(out, "  step %ld, PC = 0x%lx\n", h->ck[i].step, h->ck[i].pc);
+            continue;
+        } else if (!strcmp(cmd, "quit") || !strcmp(cmd, "q")) {
+            break;
+        } else {
+            print_help(out);
+            continue;
+        }
+        print_where(sim, h, out);
+    }
+
+    free_history(h);
+    free_y64sim(sim);
+    return 0;
+}
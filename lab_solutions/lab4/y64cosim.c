@@ -0,0 +1,169 @@
+/*
+ * Lockstep co-simulation: run y64sim's nexti() and the lab6 ISA model's
+ * step_state() side by side on one binary, and stop at the first
+ * instruction after which they disagree
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "y64sim.h"
+#include "y64isa.h"
+
+void usage(char *pname)
+{
+    printf("Usage: %s file.bin [max_steps]\n", pname);
+    exit(0);
+}
+
+/* the word at 'addr' in each model; TRUE if they agree */
+static bool_t same_word(y64sim_t *sim, isa_sim_t *isa, long_t addr,
+                        long_t *ours, long_t *theirs)
+{
+    bool_t ok1, ok2;
+
+    *ours = *theirs = 0;
+    ok1 = get_long_val(sim->m, addr, ours);
+    ok2 = isa_word(isa, addr, theirs);
+    return ok1 == ok2 && *ours == *theirs;
+}
+
+/*
+ * diff_stores: compare the words either model stored to in the last step:
+ *     those in isa->stores, and those y64sim's write log gained past 'nlog'
+ * return
+ *     the first word that differs, or -1
+ */
+static long_t diff_stores(y64sim_t *sim, isa_sim_t *isa, int nlog)
+{
+    long_t ours, theirs;
+    int i;
+
+    for (i = 0; i < isa->nstores; i++) {
+        long_t addr = isa->stores[i] & ~7L;
+        if (!same_word(sim, isa, addr, &ours, &theirs))
+            return addr;
+        if ((isa->stores[i] & 7) && !same_word(sim, isa, addr + 8, &ours, &theirs))
+            return addr + 8;
+    }
+    for (i = nlog; i < sim->m->nlog; i++)
+        if (!same_word(sim, isa, sim->m->log[i].addr, &ours, &theirs))
+            return sim->m->log[i].addr;
+    return -1;
+}
+
+/* print only what differs, y64sim's value first */
+static void print_diverged(y64sim_t *sim, stat_t e, isa_sim_t *isa, int ie,
+                           long_t addr, FILE *out)
+{
+    long_t reg[ISA_NREG], ours, theirs;
+    int id;
+
+    fprintf(out, "  %-8s %-20s %s\n", "", "y64sim", "isa");
+    if (e != ie)
+        fprintf(out, "  %-8s %-20s %s\n", "Status", stat_name(e), stat_name(ie));
+    if (sim->pc != isa_pc(isa))
+        fprintf(out, "  %-8s 0x%-18lx 0x%lx\n", "PC", sim->pc, isa_pc(isa));
+    if (sim->cc != isa_cc(isa))
+        fprintf(out, "  %-8s %-20s %s\n", "CC", cc_name(sim->cc),
+                cc_name(isa_cc(isa)));
+    isa_regs(isa, reg);
+    for (id = 0; id < REG_NONE; id++)
+        if (get_reg_val(sim->r, id) != reg[id])
+            fprintf(out, "  %-8s 0x%.16lx   0x%.16lx\n", reg_table[id].name,
+                    get_reg_val(sim->r, id), reg[id]);
+    if (addr != -1) {
+        same_word(sim, isa, addr, &ours, &theirs);
+        fprintf(out, "  0x%.4lx   0x%.16lx   0x%.16lx\n", addr, ours, theirs);
+    }
+}
+
+/*
+ * cosim: step both models until they disagree, fault or halt, or run
+ *     'max_steps' instructions
+ * return
+ *     0 if they agreed all the way, 1 if not
+ */
+static int cosim(y64sim_t *sim, isa_sim_t *isa, int max_steps, FILE *out)
+{
+    long_t ours[REG_NONE], theirs[ISA_NREG];
+    stat_t e = STAT_AOK;
+    int ie = STAT_AOK;
+    int step, i;
+
+    for (step = 0; step < max_steps && e == STAT_AOK; step++) {
+        long_t pc = sim->pc;
+        int nlog = sim->m->nlog;
+        long_t addr;
+        bool_t same;
+
+        e = nexti(sim);
+        ie = isa_step(isa);
+
+        get_reg_file(sim->r, ours);
+        isa_regs(isa, theirs);
+        same = e == ie && sim->pc == isa_pc(isa) && sim->cc == isa_cc(isa) &&
+            !memcmp(ours, theirs, sizeof(ours));
+        addr = diff_stores(sim, isa, nlog);
+
+        if (!same || addr != -1) {
+            fprintf(out, "Diverged at step %d, PC = 0x%lx\n", step + 1, pc);
+            print_diverged(sim, e, isa, ie, addr, out);
+            return 1;
+        }
+    }
+
+    /*
+     * A store y64sim makes to a word it already changed is not logged
+     * again, so sweep every word it changed once more at the end
+     */
+    for (i = 0; i < sim->m->nlog; i++) {
+        long_t ours, theirs;
+        if (!same_word(sim, isa, sim->m->log[i].addr, &ours, &theirs)) {
+            fprintf(out, "Diverged by step %d\n", step);
+            print_diverged(sim, e, isa, ie, sim->m->log[i].addr, out);
+            return 1;
+        }
+    }
+
+    fprintf(out, "Agreed for %d steps: PC = 0x%lx.  Status '%s', CC %s\n",
+            step, sim->pc, stat_name(e), cc_name(sim->cc));
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    y64cfg_t cfg = { MAX_STEP, MEM_SIZE, ENG_STEP, FALSE };
+    y64sim_t *sim;
+    isa_sim_t *isa;
+    char *binname;
+    int diverged;
+
+    if (argc < 2 || argc > 3)
+        usage(argv[0]);
+    binname = argv[1];
+
+    /* set max steps */
+    if (argc > 2)
+        cfg.max_steps = atoi(argv[2]);
+
+    /* only support *.bin file */
+    if (strlen(binname) < 4 || strcmp(binname+(strlen(binname)-4), ".bin"))
+        usage(argv[0]);
+
+    sim = open_binfile(binname, &cfg, stdout);
+    if (!sim)
+        exit(1);
+    isa = isa_open(binname, cfg.mem_size, stdout);
+    if (!isa) {
+        free_y64sim(sim);
+        exit(1);
+    }
+    track_mem(sim->m);
+
+    diverged = cosim(sim, isa, cfg.max_steps, stdout);
+
+    isa_close(isa);
+    free_y64sim(sim);
+    return diverged;
+}
@@ -0,0 +1,124 @@
+/* The lab6 ISA model built into y64cosim, behind the interface of y64isa.h */
+
+/* names y64sim also defines */
+#define init_mem isa_init_mem
+#define free_mem isa_free_mem
+#define diff_mem isa_diff_mem
+#define init_reg isa_init_reg
+#define free_reg isa_free_reg
+#define diff_reg isa_diff_reg
+#define get_byte_val isa_get_byte_val
+#define set_byte_val isa_set_byte_val
+#define get_reg_val isa_get_reg_val
+#define set_reg_val isa_set_reg_val
+#define compute_alu isa_compute_alu
+#define compute_cc isa_compute_cc
+#define cc_name isa_cc_name
+#define cc_names isa_cc_names
+#define stat_name isa_stat_name
+#define stat_names isa_stat_names
+#define reg_table isa_reg_table
+
+#include "isa.c"
+#include "y64isa.h"
+
+/* isa.c is also linked into the lab6 GUI simulators; this one has no GUI */
+int gui_mode = 0;
+
+/* the model being stepped, for store_hook */
+static isa_sim_t *stepping;
+
+static void log_store(mem_t m, word_t pos)
+{
+    state_ptr s = (state_ptr) stepping->s;
+
+    if (m == s->m && stepping->nstores < ISA_MAX_STORES)
+        stepping->stores[stepping->nstores++] = pos;
+}
+
+/*
+ * isa_open: load a binary into a fresh lab6 ISA state, the way y64sim
+ *     loads it: the raw bytes at address 0, the rest of memory zero
+ * args
+ *     binname: the binary file
+ *     len: bytes of memory
+ *     out: where errors go
+ *
+ * return
+ *     the model, or NULL if the binary could not be loaded
+ */
+isa_sim_t *isa_open(const char *binname, long len, FILE *out)
+{
+    FILE *binfile;
+    state_ptr s;
+    isa_sim_t *isa;
+    size_t n;
+
+    binfile = fopen(binname, "rb");
+    if (!binfile) {
+        fprintf(out, "Can't open binary file '%s'\n", binname);
+        return NULL;
+    }
+    s = new_state(len);
+    n = fread(s->m->contents, 1, s->m->len, binfile);
+    if (ferror(binfile) || (n == s->m->len && fgetc(binfile) != EOF)) {
+        fprintf(out, "Failed to load binary file '%s'\n", binname);
+        fclose(binfile);
+        free_state(s);
+        return NULL;
+    }
+    fclose(binfile);
+
+    isa = (isa_sim_t *)calloc(1, sizeof(isa_sim_t));
+    isa->s = s;
+    store_hook = log_store;
+    return isa;
+}
+
+void isa_close(isa_sim_t *isa)
+{
+    free_state((state_ptr) isa->s);
+    free((void *) isa);
+}
+
+/*
+ * isa_step: execute one instruction with step_state(), noting the
+ *     addresses it stores to in isa->stores
+ * return
+ *     the status, numbered as y64sim numbers it (STAT_AOK is 0)
+ */
+int isa_step(isa_sim_t *isa)
+{
+    stat_t e;
+
+    stepping = isa;
+    isa->nstores = 0;
+    e = step_state((state_ptr) isa->s, NULL);
+    return e - STAT_AOK;
+}
+
+long isa_pc(isa_sim_t *isa)
+{
+    return ((state_ptr) isa->s)->pc;
+}
+
+int isa_cc(isa_sim_t *isa)
+{
+    return ((state_ptr) isa->s)->cc;
+}
+
+/* all of %rax .. %r14, straight out of the register file */
+void isa_regs(isa_sim_t *isa, long *reg)
+{
+    memcpy(reg, ((state_ptr) isa->s)->r->contents, ISA_NREG * sizeof(long));
+}
+
+int isa_word(isa_sim_t *isa, long addr, long *val)
+{
+    word_t w;
+
+    if (!get_word_val(((state_ptr) isa->s)->m, addr, &w))
+        return 0;
+    *val = w;
+    return 1;
+}
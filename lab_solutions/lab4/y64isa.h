@@ -0,0 +1,29 @@
+/*
+ * The lab6 ISA model (step_state() in lab6/sim/misc/isa.c), as y64cosim
+ * drives it.  Its types and names clash with y64sim.h, so only plain C
+ * types cross this interface.
+ */
+
+#ifndef Y64ISA_H
+#define Y64ISA_H
+
+#include <stdio.h>
+
+#define ISA_NREG 15         /* %rax .. %r14 */
+#define ISA_MAX_STORES 4    /* memory words one step can store */
+
+typedef struct isa_sim {
+    void *s;                /* the lab6 state_ptr */
+    long stores[ISA_MAX_STORES]; /* addresses stored to by the last step */
+    int nstores;
+} isa_sim_t;
+
+isa_sim_t *isa_open(const char *binname, long len, FILE *out);
+void isa_close(isa_sim_t *isa);
+int isa_step(isa_sim_t *isa);
+long isa_pc(isa_sim_t *isa);
+int isa_cc(isa_sim_t *isa);
+void isa_regs(isa_sim_t *isa, long *reg);
+int isa_word(isa_sim_t *isa, long addr, long *val);
+
+#endif
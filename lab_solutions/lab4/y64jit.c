@@ -0,0 +1,807 @@
+/* Dynamic binary translator for Y64: hot basic blocks to native x86-64 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "y64sim.h"
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+
+#define JIT_CODE_SIZE (4<<20)
+#define JIT_CODE_SLACK (64<<10) /* room needed to translate one block */
+#define JIT_BLOCKS 4096         /* must be a power of 2 */
+#define JIT_SITES 65536
+#define JIT_HOST_REGS 4         /* Y64 registers cached in %r12-%r15 */
+#ifndef JIT_HOT
+#define JIT_HOT 8               /* entries before a block gets translated */
+#endif
+
+/*
+ * State shared by translated code and the dispatcher. Inside a block
+ * %rbx points here, %rbp holds the packed condition codes and %r12-%r15
+ * hold the block's most used Y64 registers; everything else lives in reg[].
+ */
+typedef struct jit_ctx {
+    long_t reg[REG_NONE];
+    long_t cc;
+    long_t pc;      /* where to continue after leaving translated code */
+    long_t budget;  /* steps left; every block charges its length on entry */
+    long_t gen;     /* icache generation the dispatcher entered with */
+    int reason;     /* exit_t */
+    int site;       /* chainable exit that was taken, or -1 */
+    mem_t *m;
+} jit_ctx_t;
+
+/* Why translated code returned to the dispatcher */
+typedef enum {
+    EXIT_NEXT,      /* continue at pc */
+    EXIT_STEP,      /* let nexti() execute (and report) the instruction at pc */
+    EXIT_BUDGET,    /* the block at pc is longer than the steps left */
+    EXIT_HALT       /* halt at pc, already counted */
+} exit_t;
+
+typedef struct jblock {
+    long_t pc;
+    byte_t *code;
+} jblock_t;
+
+/* a 'jmp rel32' to the exit stub that can be patched to a block */
+typedef struct jsite {
+    byte_t *rel;
+    long_t target;
+} jsite_t;
+
+typedef struct jit {
+    byte_t *buf;    /* mmap'd, executable */
+    byte_t *base;   /* first byte after the entry and exit stubs */
+    byte_t *cur;
+    byte_t *exit;
+    void (*enter)(jit_ctx_t *ctx, byte_t *code);
+    jblock_t blk[JIT_BLOCKS];
+    int nblk;
+    long_t heat_pc[JIT_BLOCKS];
+    int heat[JIT_BLOCKS];
+    jsite_t site[JIT_SITES];
+    int nsite;
+    long_t gen;
+    jit_ctx_t ctx;
+    long_t translated, flushes, chained;
+} jit_t;
+
+/* x86-64 general purpose registers */
+enum { H_RAX, H_RCX, H_RDX, H_RBX, H_RSP, H_RBP, H_RSI, H_RDI,
+    H_R8, H_R9, H_R10, H_R11, H_R12, H_R13, H_R14, H_R15 };
+
+#define CTX(_field) ((int32_t)offsetof(jit_ctx_t, _field))
+#define REG_OFF(_id) (CTX(reg) + 8*(_id))
+#define FITS32(_v) ((_v) == (long_t)(int32_t)(_v))
+
+static void emit1(jit_t *j, int b)
+{
+    *j->cur++ = (byte_t)b;
+}
+
+static void emit4(jit_t *j, int32_t v)
+{
+    memcpy(j->cur, &v, 4);
+    j->cur += 4;
+}
+
+static void emit8(jit_t *j, int64_t v)
+{
+    memcpy(j->cur, &v, 8);
+    j->cur += 8;
+}
+
+#define REX_W(_r, _b) emit1(j, 0x48 | (((_r) >> 3) << 2) | ((_b) >> 3))
+
+/* mov dst, src */
+static void mov_rr(jit_t *j, int dst, int src)
+{
+    REX_W(src, dst);
+    emit1(j, 0x89);
+    emit1(j, 0xC0 | (src & 7) << 3 | (dst & 7));
+}
+
+/* mov dst, imm */
+static void mov_ri(jit_t *j, int dst, long_t imm)
+{
+    REX_W(0, dst);
+    if (FITS32(imm)) {
+        emit1(j, 0xC7);
+        emit1(j, 0xC0 | (dst & 7));
+        emit4(j, (int32_t)imm);
+    } else {
+        emit1(j, 0xB8 | (dst & 7));
+        emit8(j, imm);
+    }
+}
+
+/* mov dst, [%rbx+disp] */
+static void load(jit_t *j, int dst, int32_t disp)
+{
+    REX_W(dst, 0);
+    emit1(j, 0x8B);
+    emit1(j, 0x80 | (dst & 7) << 3 | H_RBX);
+    emit4(j, disp);
+}
+
+/* mov [%rbx+disp], src */
+static void store(jit_t *j, int32_t disp, int src)
+{
+    REX_W(src, 0);
+    emit1(j, 0x89);
+    emit1(j, 0x80 | (src & 7) << 3 | H_RBX);
+    emit4(j, disp);
+}
+
+/* /ext group-1 operation of a 32-bit immediate on a register (0: add, 5: sub) */
+static void alu_ri(jit_t *j, int ext, int dst, int32_t imm)
+{
+    REX_W(0, dst);
+    emit1(j, 0x81);
+    emit1(j, 0xC0 | ext << 3 | (dst & 7));
+    emit4(j, imm);
+}
+
+/* /ext group-1 operation of a 32-bit immediate on qword [%rbx+disp] */
+static void alu_mi(jit_t *j, int ext, int32_t disp, int32_t imm)
+{
+    emit1(j, 0x48);
+    emit1(j, 0x81);
+    emit1(j, 0x80 | ext << 3 | H_RBX);
+    emit4(j, disp);
+    emit4(j, imm);
+}
+
+/* mov qword [%rbx+disp], imm */
+static void store_imm(jit_t *j, int32_t disp, long_t imm)
+{
+    if (FITS32(imm)) {
+        emit1(j, 0x48);
+        emit1(j, 0xC7);
+        emit1(j, 0x80 | H_RBX);
+        emit4(j, disp);
+        emit4(j, (int32_t)imm);
+    } else {
+        mov_ri(j, H_RAX, imm);
+        store(j, disp, H_RAX);
+    }
+}
+
+/* mov dword [%rbx+disp], imm */
+static void store_imm32(jit_t *j, int32_t disp, int32_t imm)
+{
+    emit1(j, 0xC7);
+    emit1(j, 0x80 | H_RBX);
+    emit4(j, disp);
+    emit4(j, imm);
+}
+
+/* jcc/jmp rel32 with the target left open; returns where rel32 goes */
+static byte_t *jump(jit_t *j, int cc)
+{
+    byte_t *rel;
+    if (cc < 0) {
+        emit1(j, 0xE9);
+    } else {
+        emit1(j, 0x0F);
+        emit1(j, 0x80 | cc);
+    }
+    rel = j->cur;
+    emit4(j, 0);
+    return rel;
+}
+
+static void patch(byte_t *rel, byte_t *target)
+{
+    int32_t v = (int32_t)(target - (rel + 4));
+    memcpy(rel, &v, 4);
+}
+
+#define CC_Z 0x4
+#define CC_NC 0x3
+#define CC_L 0xC
+#define JMP (-1)
+
+/* call a C helper, arguments already in %rsi/%rdx */
+static void call(jit_t *j, void *fn)
+{
+    mov_rr(j, H_RDI, H_RBX);
+    emit1(j, 0x48); emit1(j, 0xB8); emit8(j, (int64_t)(intptr_t)fn); /* mov rax, fn */
+    emit1(j, 0xFF); emit1(j, 0xD0);                                   /* call *%rax */
+}
+
+/* cf <- condition 'mask' holds for the condition codes in %ebp */
+static void test_cond(jit_t *j, byte_t mask)
+{
+    emit1(j, 0xB8); emit4(j, mask);             /* mov eax, mask */
+    emit1(j, 0x0F); emit1(j, 0xA3); emit1(j, 0xE8); /* bt eax, ebp */
+}
+
+/* Y64 register 'y' into host register 'h' */
+static void get_y(jit_t *j, const int *host, int h, int y)
+{
+    if (y >= REG_NONE)
+        mov_ri(j, h, 0);
+    else if (host[y] >= 0)
+        mov_rr(j, h, host[y]);
+    else
+        load(j, h, REG_OFF(y));
+}
+
+/* host register 'h' into Y64 register 'y' */
+static void put_y(jit_t *j, const int *host, int y, int h)
+{
+    if (y >= REG_NONE)
+        return;
+    if (host[y] >= 0)
+        mov_rr(j, host[y], h);
+    else
+        store(j, REG_OFF(y), h);
+}
+
+/* add 'imm' to Y64 register 'y' */
+static void add_y(jit_t *j, const int *host, int y, int32_t imm)
+{
+    if (host[y] >= 0)
+        alu_ri(j, 0, host[y], imm);
+    else
+        alu_mi(j, 0, REG_OFF(y), imm);
+}
+
+/* %rsi <- Y64 register 'y' plus 'disp' */
+static void address(jit_t *j, const int *host, int y, long_t disp)
+{
+    get_y(j, host, H_RSI, y);
+    if (FITS32(disp)) {
+        if (disp)
+            alu_ri(j, 0, H_RSI, (int32_t)disp);
+    } else {
+        mov_ri(j, H_RAX, disp);
+        REX_W(H_RAX, H_RSI); emit1(j, 0x01); emit1(j, 0xC0 | H_RAX << 3 | (H_RSI & 7));
+    }
+}
+
+/*
+ * emit_exit: write the cached registers back and leave translated code
+ * args
+ *     host: Y64 register to host register map of the block
+ *     pc_reg: host register holding the next PC, or -1 to use 'pc'
+ *     refund: steps charged on entry that weren't executed
+ *     chain: whether the exit may later be patched to jump to 'pc' directly
+ */
+static void emit_exit(jit_t *j, const int *host, int pc_reg, long_t pc,
+                      exit_t reason, int refund, bool_t chain)
+{
+    int y;
+
+    for (y = 0; y < REG_NONE; y++)
+        if (host[y] >= 0)
+            store(j, REG_OFF(y), host[y]);
+    if (refund)
+        alu_mi(j, 0, CTX(budget), refund);
+    if (pc_reg >= 0)
+        store(j, CTX(pc), pc_reg);
+    else
+        store_imm(j, CTX(pc), pc);
+    store_imm32(j, CTX(reason), reason);
+
+    if (chain && j->nsite < JIT_SITES) {
+        jsite_t *s = &j->site[j->nsite];
+        store_imm32(j, CTX(site), j->nsite++);
+        s->rel = jump(j, JMP);
+        s->target = pc;
+        patch(s->rel, j->exit);
+    } else {
+        store_imm32(j, CTX(site), -1);
+        patch(jump(j, JMP), j->exit);
+    }
+}
+
+/* C helpers called from translated code */
+typedef struct { long_t val; long_t ok; } jit_val_t; /* returned in %rax:%rdx */
+
+static jit_val_t jit_load(jit_ctx_t *c, long_t addr)
+{
+    jit_val_t r;
+    r.ok = get_long_val(c->m, addr, &r.val);
+    return r;
+}
+
+/* 0: out of memory, 1: stored, 2: stored over translated code */
+static long_t jit_store(jit_ctx_t *c, long_t addr, long_t val)
+{
+    if (!set_long_val(c->m, addr, val))
+        return 0;
+    return c->m->icache->gen == c->gen ? 1 : 2;
+}
+
+/* out-of-line exit from the middle of a block */
+typedef struct stub {
+    byte_t *rel;
+    int k;          /* index of the instruction taking the exit */
+    bool_t smc;     /* FALSE: fault before k, TRUE: code changed by k */
+    long_t pc;
+} stub_t;
+
+/* can the block be translated past this instruction? */
+static bool_t translatable(icache_ent_t *d)
+{
+    if (d->icode == I_ALU)
+        return d->ifun <= A_XOR;
+    return d->icode <= I_POPQ;
+}
+
+/*
+ * translate: emit native code for the basic block starting at 'pc'
+ *
+ * return
+ *     the entry point of the block
+ */
+static byte_t *translate(jit_t *j, y64sim_t *sim, long_t pc)
+{
+    icache_ent_t d[MAX_BLOCK_INSNS];
+    stub_t stub[2*MAX_BLOCK_INSNS];
+    int host[REG_NONE];
+    int use[REG_NONE];
+    int n = 0, nstub = 0, k, y, h;
+    bool_t last = FALSE;
+    byte_t *entry, *nobudget;
+    long_t next = pc;
+
+    /* decode: same block boundaries as the threaded engine */
+    while (!last && n < MAX_BLOCK_INSNS) {
+        icache_ent_t *e = fetch(sim->m, next);
+        if (!e || !translatable(e))
+            break;
+        d[n] = *e;
+        last = e->icode == I_HALT || e->icode == I_JMP ||
+            e->icode == I_CALL || e->icode == I_RET;
+        next = e->valP;
+        n++;
+    }
+
+    /* keep the most used registers in %r12-%r15 */
+    memset(use, 0, sizeof(use));
+    for (k = 0; k < n; k++) {
+        if (d[k].regA < REG_NONE)
+            use[d[k].regA]++;
+        if (d[k].regB < REG_NONE)
+            use[d[k].regB]++;
+        if (d[k].icode == I_CALL || d[k].icode == I_RET ||
+            d[k].icode == I_PUSHQ || d[k].icode == I_POPQ)
+            use[REG_RSP] += 2;
+    }
+    for (y = 0; y < REG_NONE; y++)
+        host[y] = -1;
+    for (h = H_R12; h <= H_R15; h++) {
+        int best = -1;
+        for (y = 0; y < REG_NONE; y++)
+            if (host[y] < 0 && use[y] && (best < 0 || use[y] > use[best]))
+                best = y;
+        if (best < 0)
+            break;
+        host[best] = h;
+    }
+
+    entry = j->cur;
+    nobudget = NULL;
+    if (n) {
+        alu_mi(j, 5, CTX(budget), n);
+        nobudget = jump(j, CC_L);
+    }
+    for (y = 0; y < REG_NONE; y++)
+        if (host[y] >= 0)
+            load(j, host[y], REG_OFF(y));
+
+    for (k = 0; k < n; k++) {
+        icache_ent_t *i = &d[k];
+        switch (i->icode) {
+          case I_HALT:
+            emit_exit(j, host, -1, i->pc, EXIT_HALT, 0, FALSE);
+            break;
+          case I_NOP:
+            break;
+          case I_RRMOVQ:
+          {
+            byte_t mask = cond_mask(i->ifun);
+            if (i->regB >= REG_NONE || !mask)
+                break;
+            get_y(j, host, H_RCX, i->regA);
+            if (mask != 0xFF) {
+                get_y(j, host, H_RAX, i->regB);
+                emit1(j, 0xBA); emit4(j, mask);                 /* mov edx, mask */
+                emit1(j, 0x0F); emit1(j, 0xA3); emit1(j, 0xEA); /* bt edx, ebp */
+                emit1(j, 0x48); emit1(j, 0x0F); emit1(j, 0x42); emit1(j, 0xC1); /* cmovc rax, rcx */
+                put_y(j, host, i->regB, H_RAX);
+            } else {
+                put_y(j, host, i->regB, H_RCX);
+            }
+            break;
+          }
+          case I_IRMOVQ:
+            if (i->regB >= REG_NONE)
+                break;
+            if (host[i->regB] >= 0)
+                mov_ri(j, host[i->regB], i->valC);
+            else
+                store_imm(j, REG_OFF(i->regB), i->valC);
+            break;
+          case I_RMMOVQ:
+            address(j, host, i->regB, i->valC);
+            get_y(j, host, H_RDX, i->regA);
+            call(j, jit_store);
+            emit1(j, 0x83); emit1(j, 0xF8); emit1(j, 0x02); /* cmp eax, 2 */
+            stub[nstub].rel = jump(j, CC_Z);
+            stub[nstub].k = k;
+            stub[nstub].smc = TRUE;
+            stub[nstub++].pc = i->valP;
+            break;
+          case I_MRMOVQ:
+            address(j, host, i->regB, i->valC);
+            call(j, jit_load);
+            emit1(j, 0x85); emit1(j, 0xD2);                 /* test edx, edx */
+            stub[nstub].rel = jump(j, CC_Z);
+            stub[nstub].k = k;
+            stub[nstub].smc = FALSE;
+            stub[nstub++].pc = i->pc;
+            put_y(j, host, i->regA, H_RAX);
+            break;
+          case I_ALU:
+          {
+            static const byte_t opc[] = { 0x01, 0x29, 0x21, 0x31 };
+            get_y(j, host, H_RAX, i->regB);
+            get_y(j, host, H_RCX, i->regA);
+            emit1(j, 0x48); emit1(j, opc[i->ifun]); emit1(j, 0xC8); /* op rax, rcx */
+            put_y(j, host, i->regB, H_RAX);
+            /* as compute_cc(): ZF from the result, SF from its low 32 bits, no OF */
+            emit1(j, 0x31); emit1(j, 0xC9);                 /* xor ecx, ecx */
+            emit1(j, 0x31); emit1(j, 0xD2);                 /* xor edx, edx */
+            emit1(j, 0x48); emit1(j, 0x85); emit1(j, 0xC0); /* test rax, rax */
+            emit1(j, 0x0F); emit1(j, 0x94); emit1(j, 0xC1); /* sete cl */
+            emit1(j, 0x85); emit1(j, 0xC0);                 /* test eax, eax */
+            emit1(j, 0x0F); emit1(j, 0x98); emit1(j, 0xC2); /* sets dl */
+            emit1(j, 0xC1); emit1(j, 0xE1); emit1(j, 0x02); /* shl ecx, 2 */
+            emit1(j, 0x8D); emit1(j, 0x2C); emit1(j, 0x51); /* lea ebp, [rcx+rdx*2] */
+            break;
+          }
+          case I_JMP:
+          {
+            byte_t mask = cond_mask(i->ifun);
+            if (mask == 0xFF) {
+                emit_exit(j, host, -1, i->valC, EXIT_NEXT, 0, TRUE);
+            } else if (!mask) {
+                emit_exit(j, host, -1, i->valP, EXIT_NEXT, 0, TRUE);
+            } else {
+                byte_t *nottaken;
+                test_cond(j, mask);
+                nottaken = jump(j, CC_NC);
+                emit_exit(j, host, -1, i->valC, EXIT_NEXT, 0, TRUE);
+                patch(nottaken, j->cur);
+                emit_exit(j, host, -1, i->valP, EXIT_NEXT, 0, TRUE);
+            }
+            break;
+          }
+          case I_CALL:
+            address(j, host, REG_RSP, -8);
+            mov_ri(j, H_RDX, i->valP);
+            call(j, jit_store);
+            emit1(j, 0x85); emit1(j, 0xC0);                 /* test eax, eax */
+            stub[nstub].rel = jump(j, CC_Z);
+            stub[nstub].k = k;
+            stub[nstub].smc = FALSE;
+            stub[nstub++].pc = i->pc;
+            add_y(j, host, REG_RSP, -8);
+            emit1(j, 0x83); emit1(j, 0xF8); emit1(j, 0x02); /* cmp eax, 2 */
+            stub[nstub].rel = jump(j, CC_Z);
+            stub[nstub].k = k;
+            stub[nstub].smc = TRUE;
+            stub[nstub++].pc = i->valC;
+            emit_exit(j, host, -1, i->valC, EXIT_NEXT, 0, TRUE);
+            break;
+          case I_RET:
+            address(j, host, REG_RSP, 0);
+            call(j, jit_load);
+            emit1(j, 0x85); emit1(j, 0xD2);                 /* test edx, edx */
+            stub[nstub].rel = jump(j, CC_Z);
+            stub[nstub].k = k;
+            stub[nstub].smc = FALSE;
+            stub[nstub++].pc = i->pc;
+            add_y(j, host, REG_RSP, 8);
+            emit_exit(j, host, H_RAX, 0, EXIT_NEXT, 0, FALSE);
+            break;
+          case I_PUSHQ:
+            address(j, host, REG_RSP, -8);
+            get_y(j, host, H_RDX, i->regA);
+            call(j, jit_store);
+            emit1(j, 0x85); emit1(j, 0xC0);                 /* test eax, eax */
+            stub[nstub].rel = jump(j, CC_Z);
+            stub[nstub].k = k;
+            stub[nstub].smc = FALSE;
+            stub[nstub++].pc = i->pc;
+            add_y(j, host, REG_RSP, -8);
+            emit1(j, 0x83); emit1(j, 0xF8); emit1(j, 0x02); /* cmp eax, 2 */
+            stub[nstub].rel = jump(j, CC_Z);
+            stub[nstub].k = k;
+            stub[nstub].smc = TRUE;
+            stub[nstub++].pc = i->valP;
+            break;
+          case I_POPQ:
+            address(j, host, REG_RSP, 0);
+            call(j, jit_load);
+            emit1(j, 0x85); emit1(j, 0xD2);                 /* test edx, edx */
+            stub[nstub].rel = jump(j, CC_Z);
+            stub[nstub].k = k;
+            stub[nstub].smc = FALSE;
+            stub[nstub++].pc = i->pc;
+            add_y(j, host, REG_RSP, 8);
+            put_y(j, host, i->regA, H_RAX);
+            break;
+          default:
+            break;
+        }
+    }
+
+    /* fell off the block: decode failure, untranslatable or too long */
+    if (!last) {
+        if (next != pc && n == MAX_BLOCK_INSNS)
+            emit_exit(j, host, -1, next, EXIT_NEXT, 0, TRUE);
+        else
+            emit_exit(j, host, -1, next, EXIT_STEP, 0, FALSE);
+    }
+
+    for (k = 0; k < nstub; k++) {
+        stub_t *s = &stub[k];
+        patch(s->rel, j->cur);
+        if (s->smc)
+            emit_exit(j, host, -1, s->pc, EXIT_NEXT, n - s->k - 1, FALSE);
+        else
+            emit_exit(j, host, -1, s->pc, EXIT_STEP, n - s->k, FALSE);
+    }
+
+    if (nobudget) {
+        int none[REG_NONE];
+        for (y = 0; y < REG_NONE; y++)
+            none[y] = -1;
+        patch(nobudget, j->cur);
+        emit_exit(j, none, -1, pc, EXIT_BUDGET, n, FALSE);
+    }
+
+    j->translated++;
+    return entry;
+}
+
+/* forget every translation, keeping the entry and exit stubs */
+static void flush(jit_t *j)
+{
+    memset(j->blk, 0, sizeof(j->blk));
+    memset(j->heat, 0, sizeof(j->heat));
+    j->nblk = 0;
+    j->nsite = 0;
+    j->cur = j->base;
+    j->flushes++;
+}
+
+static jblock_t *lookup(jit_t *j, long_t pc)
+{
+    unsigned long i = (unsigned long)pc;
+    for (;; i++) {
+        jblock_t *b = &j->blk[i & (JIT_BLOCKS-1)];
+        if (!b->code || b->pc == pc)
+            return b;
+    }
+}
+
+static jit_t *new_jit(void)
+{
+    jit_t *j = (jit_t *)calloc(1, sizeof(jit_t));
+    static const byte_t pro[] = {
+        0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57, /* push rbx..r15 */
+        0x48, 0x83, 0xEC, 0x08,                                     /* sub rsp, 8 */
+        0x48, 0x89, 0xFB                                            /* mov rbx, rdi */
+    };
+    static const byte_t epi[] = {
+        0x48, 0x83, 0xC4, 0x08,                                     /* add rsp, 8 */
+        0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, /* pop r15..rbx */
+        0xC3                                                        /* ret */
+    };
+
+    if (!j)
+        return NULL;
+    j->buf = mmap(NULL, JIT_CODE_SIZE, PROT_READ|PROT_WRITE|PROT_EXEC,
+                  MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (j->buf == MAP_FAILED) {
+        free(j);
+        return NULL;
+    }
+
+    /* enter(ctx, code): save callee-saved registers, load cc, jump to code */
+    j->cur = j->buf;
+    j->enter = (void (*)(jit_ctx_t *, byte_t *))(void *)j->cur;
+    memcpy(j->cur, pro, sizeof(pro));
+    j->cur += sizeof(pro);
+    load(j, H_RBP, CTX(cc));
+    emit1(j, 0xFF); emit1(j, 0xE6);                             /* jmp rsi */
+
+    /* exit stub: store cc and return to the dispatcher */
+    j->exit = j->cur;
+    store(j, CTX(cc), H_RBP);
+    memcpy(j->cur, epi, sizeof(epi));
+    j->cur += sizeof(epi);
+
+    j->base = j->cur;
+    return j;
+}
+
+void free_jit(jit_t *j)
+{
+    munmap(j->buf, JIT_CODE_SIZE);
+    free(j);
+}
+
+void print_jit_stats(jit_t *j, FILE *out)
+{
+    fprintf(out, "JIT: %ld blocks translated, %ld exits chained, %ld flushes\n",
+            j->translated, j->chained, j->flushes);
+}
+
+/* move the register file between y64sim_t and the translated code */
+static void sync_in(jit_ctx_t *c, y64sim_t *sim)
+{
+    int id;
+    for (id = 0; id < REG_NONE; id++)
+        c->reg[id] = get_reg_val(sim->r, id);
+    c->cc = sim->cc;
+}
+
+static void sync_out(jit_ctx_t *c, y64sim_t *sim)
+{
+    int id;
+    for (id = 0; id < REG_NONE; id++)
+        if (get_reg_val(sim->r, id) != c->reg[id])
+            set_reg_val(sim->r, id, c->reg[id]);
+    sim->cc = c->cc;
+}
+
+/*
+ * run_jit: execute up to 'max_steps' instructions, interpreting cold code
+ * with nexti() and running blocks entered JIT_HOT times as native code.
+ * Faults, instructions the translator doesn't handle, stores into
+ * translated code and the tail of the step budget all go back to nexti().
+ * args
+ *     sim: the y64 image with PC, register and memory
+ *     max_steps: the most instructions to execute
+ *     steps: store the number of instructions executed
+ *
+ * return
+ *     the status of the last instruction, as nexti() returns it
+ */
+stat_t run_jit(y64sim_t *sim, int max_steps, int *steps)
+{
+    jit_t *j = sim->jit;
+    jit_ctx_t *c;
+    icache_t *ic = sim->m->icache;
+    stat_t e = STAT_AOK;
+    bool_t native = FALSE; /* registers live in the context, not in sim->r */
+    int site = -1;
+
+    if (!j)
+        j = sim->jit = new_jit();
+    if (!j)
+        return run_threaded(sim, max_steps, steps);
+
+    c = &j->ctx;
+    c->m = sim->m;
+    c->pc = sim->pc;
+    c->budget = max_steps;
+
+    while (c->budget > 0 && e == STAT_AOK) {
+        long_t pc = c->pc;
+        jblock_t *b;
+
+        if (j->gen != ic->gen || j->cur + JIT_CODE_SLACK > j->buf + JIT_CODE_SIZE ||
+            j->nblk >= JIT_BLOCKS/2) {
+            flush(j);
+            j->gen = ic->gen;
+            site = -1;
+        }
+
+        b = lookup(j, pc);
+        if (!b->code) {
+            int hi = pc & (JIT_BLOCKS-1);
+            if (j->heat_pc[hi] != pc) {
+                j->heat_pc[hi] = pc;
+                j->heat[hi] = 0;
+            }
+            if (++j->heat[hi] >= JIT_HOT) {
+                b->pc = pc;
+                b->code = translate(j, sim, pc);
+                j->nblk++;
+            }
+        }
+
+        if (!b->code) {
+            /* cold: interpret up to the next control transfer */
+            if (native) {
+                sync_out(c, sim);
+                native = FALSE;
+            }
+            sim->pc = pc;
+            do {
+                icache_ent_t *d = fetch(sim->m, sim->pc);
+                bool_t ctl = !d || d->icode == I_JMP || d->icode == I_CALL ||
+                    d->icode == I_RET;
+                e = nexti(sim);
+                c->budget--;
+                if (ctl)
+                    break;
+            } while (c->budget > 0 && e == STAT_AOK);
+            c->pc = sim->pc;
+            site = -1;
+            continue;
+        }
+
+        if (site >= 0 && j->site[site].target == pc) {
+            patch(j->site[site].rel, b->code);
+            j->chained++;
+        }
+        if (!native) {
+            sync_in(c, sim);
+            native = TRUE;
+        }
+        c->gen = ic->gen;
+        j->enter(c, b->code);
+        site = c->site;
+
+        switch (c->reason) {
+          case EXIT_NEXT:
+            break;
+          case EXIT_HALT:
+            e = STAT_HLT;
+            break;
+          case EXIT_STEP:
+          case EXIT_BUDGET:
+            sync_out(c, sim);
+            native = FALSE;
+            sim->pc = c->pc;
+            while (c->budget > 0 && e == STAT_AOK) {
+                e = nexti(sim);
+                c->budget--;
+                if (c->reason == EXIT_STEP)
+                    break;
+            }
+            c->pc = sim->pc;
+            site = -1;
+            break;
+        }
+    }
+
+    if (native)
+        sync_out(c, sim);
+    sim->pc = c->pc;
+    *steps = max_steps - c->budget;
+    return e;
+}
+
+#else /* !__x86_64__ */
+
+/* no translator for this host: fall back to the threaded engine */
+stat_t run_jit(y64sim_t *sim, int max_steps, int *steps)
+{
+    return run_threaded(sim, max_steps, steps);
+}
+
+void free_jit(struct jit *j)
+{
+}
+
+void print_jit_stats(struct jit *j, FILE *out)
+{
+}
+
+#endif
@@ -0,0 +1,172 @@
+/* Command-line front end of the Y64 instruction set simulator */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "y64sim.h"
+
+void usage(char *pname)
+{
+    printf("Usage: %s [-stjpMi] [-c interval] [-l inputs] [-n cores [-q quantum]]\n"
+           "       [-T trace [-z]] file.bin [max_steps]\n", pname);
+    printf("   -s print simulator statistics after the run\n");
+    printf("   -t run on the threaded engine, a basic block at a time\n");
+    printf("   -j translate hot basic blocks to native code\n");
+    printf("   -p profile the run; folded stacks go to file.folded, and the\n"
+           "      counts at each PC to file.pcprof (for y64asm -P)\n");
+    printf("   -M give the program all 2^64 bytes of memory, not just 0x%x\n", MEM_SIZE);
+    printf("   -i debug interactively: step, go back and inspect (type 'help')\n");
+    printf("   -c checkpoint every 'interval' steps while debugging (default %d)\n",
+           CKPT_INTERVAL);
+    printf("   -l run once per line of 'inputs' (e.g. \"%%rdi=0x100 0x100=5\"),\n"
+           "      all runs together, and report each one\n");
+    printf("   -n run 'cores' cores on one shared memory, each on a thread of its own;\n"
+           "      core i starts with %%rdi = i, %%rsi = cores, and may use xaddq and cmpxchgq\n");
+    printf("   -q run the cores in turn on one thread, 'quantum' steps at a time,\n"
+           "      so that the run is the same every time\n");
+    printf("   -T record every step in the file 'trace', for y64trace to read;\n"
+           "      runs on the step-by-step engine\n");
+    printf("   -z compress the trace\n");
+    exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    y64cfg_t cfg = { MAX_STEP, MEM_SIZE, ENG_STEP, FALSE };
+    bool_t debug = FALSE;
+    int nextarg = 1;
+    char *binname;
+
+    cfg.ckpt_interval = CKPT_INTERVAL;
+    while (nextarg < argc && argv[nextarg][0] == '-') {
+        char *flag = argv[nextarg] + 1;
+        if (!*flag)
+            usage(argv[0]);
+        for (; *flag; flag++) {
+            switch (*flag) {
+              case 's':
+                cfg.stats = TRUE;
+                break;
+              case 't':
+                if (cfg.engine != ENG_JIT)
+                    cfg.engine = ENG_THREADED;
+                break;
+              case 'j':
+                cfg.engine = ENG_JIT;
+                break;
+              case 'p':
+                cfg.profile = TRUE;
+                break;
+              case 'M':
+                cfg.mem_size = MEM_ALL;
+                break;
+              case 'i':
+                debug = TRUE;
+                break;
+              case 'c':
+                /* the interval is the rest of this argument, or the next one */
+                if (flag[1])
+                    cfg.ckpt_interval = atol(flag + 1);
+                else if (nextarg + 1 < argc)
+                    cfg.ckpt_interval = atol(argv[++nextarg]);
+                else
+                    usage(argv[0]);
+                if (cfg.ckpt_interval <= 0)
+                    usage(argv[0]);
+                flag += strlen(flag) - 1;  /* nothing else in this argument */
+                break;
+              case 'l':
+                /* the inputs file, likewise */
+                if (flag[1])
+                    cfg.lanes = flag + 1;
+                else if (nextarg + 1 < argc)
+                    cfg.lanes = argv[++nextarg];
+                else
+                    usage(argv[0]);
+                flag += strlen(flag) - 1;
+                break;
+              case 'n':
+                /* the number of cores, likewise */
+                if (flag[1])
+                    cfg.cores = atoi(flag + 1);
+                else if (nextarg + 1 < argc)
+                    cfg.cores = atoi(argv[++nextarg]);
+                else
+                    usage(argv[0]);
+                if (cfg.cores <= 0)
+                    usage(argv[0]);
+                flag += strlen(flag) - 1;
+                break;
+              case 'T':
+                /* the trace file, likewise */
+                if (flag[1])
+                    cfg.trace = flag + 1;
+                else if (nextarg + 1 < argc)
+                    cfg.trace = argv[++nextarg];
+                else
+                    usage(argv[0]);
+                flag += strlen(flag) - 1;
+                break;
+              case 'z':
+                cfg.pack_trace = TRUE;
+                break;
+              case 'q':
+                /* the quantum, likewise */
+                if (flag[1])
+                    cfg.quantum = atol(flag + 1);
+                else if (nextarg + 1 < argc)
+                    cfg.quantum = atol(argv[++nextarg]);
+                else
+                    usage(argv[0]);
+                if (cfg.quantum <= 0)
+                    usage(argv[0]);
+                flag += strlen(flag) - 1;
+                break;
+              default:
+                usage(argv[0]);
+            }
+        }
+        nextarg++;
+    }
+
+    if (argc - nextarg < 1 || argc - nextarg > 2)
+        usage(argv[0]);
+    if (cfg.quantum && !cfg.cores)
+        usage(argv[0]);
+    if ((cfg.pack_trace && !cfg.trace) || (cfg.trace && cfg.profile))
+        usage(argv[0]);
+    binname = argv[nextarg];
+
+    /* set max steps */
+    if (argc - nextarg > 1)
+        cfg.max_steps = atoi(argv[nextarg+1]);
+
+    /* only support *.bin file */
+    if (strcmp(binname+(strlen(binname)-4), ".bin"))
+        usage(argv[0]);
+
+    if (cfg.profile) {
+        size_t stem = strlen(binname) - 4;
+        cfg.folded = (char *)malloc(stem + sizeof(".folded"));
+        sprintf(cfg.folded, "%.*s.folded", (int)stem, binname);
+        cfg.pcprof = (char *)malloc(stem + sizeof(".pcprof"));
+        sprintf(cfg.pcprof, "%.*s.pcprof", (int)stem, binname);
+    }
+
+    if (cfg.cores) {
+        if (run_cores(binname, &cfg, stdout) < 0)
+            exit(1);
+    } else if (cfg.lanes) {
+        if (run_lanes(binname, &cfg, stdout) < 0)
+            exit(1);
+    } else if (debug) {
+        if (debug_binfile(binname, &cfg, stdin, stdout) < 0)
+            exit(1);
+    } else if (run_binfile(binname, &cfg, stdout) < 0) {
+        exit(1);
+    }
+
+    free(cfg.folded);
+    free(cfg.pcprof);
+    return 0;
+}
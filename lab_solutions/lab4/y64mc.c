@@ -0,0 +1,307 @@
+/*
+ * Multi-core machine: N Y64 cores, each with its own PC, registers and
+ * condition codes, sharing one memory.  Each core runs on its own host
+ * thread, or, for runs that must be reproducible, all of them take turns
+ * on one thread, a fixed number of steps at a time.
+ *
+ * Cores also run two atomic instructions, encoded like rmmovq (D:fn
+ * rA:rB D, 10 bytes) on an aligned word:
+ *     xaddq rA, D(rB)     rA <- M[D+rB], M[D+rB] <- M[D+rB] + rA
+ *     cmpxchgq rA, D(rB)  if M[D+rB] == %rax: M[D+rB] <- rA, Z=1
+ *                         otherwise %rax <- M[D+rB], Z=0 (S=O=0 both ways)
+ * Ordinary loads and stores are plain host accesses, as ordered as the
+ * host orders them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "y64sim.h"
+
+#define err_print(_f, _s, _a ...) \
+    fprintf(_f, _s"\n", _a);
+
+typedef struct core {
+    struct machine *M;
+    int id;
+    y64sim_t *sim;      /* sim->m is a share_mem() view of M->m */
+    stat_t stat;
+    long_t steps;
+    long_t gen;         /* M->code_gen when its icache was last flushed */
+    char *msg;          /* its fault message, written to sim->out */
+    size_t msglen;
+    pthread_t thread;
+} core_t;
+
+typedef struct machine {
+    mem_t *m;           /* the shared memory */
+    int n;
+    core_t *core;
+    long_t max_steps;
+    long_t code_lo, code_hi; /* covers every instruction any core decoded */
+    long_t code_gen;    /* bumped on every store into [code_lo, code_hi) */
+    pthread_mutex_t lock; /* held to widen [code_lo, code_hi) */
+} machine_t;
+
+/* note a newly decoded instruction [lo, hi) */
+static void widen_code(machine_t *M, long_t lo, long_t hi)
+{
+    pthread_mutex_lock(&M->lock);
+    if (M->code_lo == M->code_hi) {
+        __atomic_store_n(&M->code_lo, lo, __ATOMIC_RELAXED);
+        __atomic_store_n(&M->code_hi, hi, __ATOMIC_RELAXED);
+    } else {
+        if (lo < M->code_lo)
+            __atomic_store_n(&M->code_lo, lo, __ATOMIC_RELAXED);
+        if (hi > M->code_hi)
+            __atomic_store_n(&M->code_hi, hi, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&M->lock);
+}
+
+/*
+ * a core stored the word at addr; if some core may have decoded it, every
+ * core drops its decoded instructions before its next step
+ */
+static void stored(machine_t *M, long_t addr)
+{
+    if (addr < __atomic_load_n(&M->code_hi, __ATOMIC_RELAXED) &&
+        addr + 8 > __atomic_load_n(&M->code_lo, __ATOMIC_RELAXED))
+        __atomic_fetch_add(&M->code_gen, 1, __ATOMIC_RELEASE);
+}
+
+/* run the atomic instruction d, which nexti() knows nothing of */
+static stat_t atomic_step(core_t *c, icache_ent_t *d)
+{
+    y64sim_t *sim = c->sim;
+    byte_t regs;
+    long_t valC, addr, *p;
+    regid_t regA, regB;
+
+    if (d->ifun > AT_CMPXCHG) {
+        err_print(sim->out, "PC = 0x%lx, Invalid instruction %.2x", sim->pc,
+                  HPACK(d->icode, d->ifun));
+        return STAT_INS;
+    }
+    if (!get_byte_val(sim->m, sim->pc + 1, &regs) ||
+        !get_long_val(sim->m, sim->pc + 2, &valC)) {
+        err_print(sim->out, "PC = 0x%lx, Invalid instruction address", sim->pc);
+        return STAT_ADR;
+    }
+    regA = GET_REGA(regs);
+    regB = GET_REGB(regs);
+
+    addr = get_reg_val(sim->r, regB) + valC;
+    p = word_ptr(sim->m, addr);
+    if (!p) {
+        err_print(sim->out, "PC = 0x%lx, Invalid data address 0x%lx", sim->pc, addr);
+        return STAT_ADR;
+    }
+    if (d->ifun == AT_XADD) {
+        long_t old = __atomic_fetch_add(p, get_reg_val(sim->r, regA), __ATOMIC_SEQ_CST);
+        set_reg_val(sim->r, regA, old);
+    } else {
+        long_t expect = get_reg_val(sim->r, REG_RAX);
+        bool_t ok = __atomic_compare_exchange_n(p, &expect, get_reg_val(sim->r, regA),
+                                                0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+        if (!ok)
+            set_reg_val(sim->r, REG_RAX, expect);
+        sim->cc = PACK_CC(ok, 0, 0);
+    }
+    stored(c->M, addr);
+    sim->pc += 2 + 8;
+    return STAT_AOK;
+}
+
+/* one step of core c: nexti(), plus the atomics and code other cores wrote */
+static stat_t core_step(core_t *c)
+{
+    machine_t *M = c->M;
+    y64sim_t *sim = c->sim;
+    icache_t *ic = sim->m->icache;
+    long_t gen = __atomic_load_n(&M->code_gen, __ATOMIC_ACQUIRE);
+    long_t misses = ic->misses;
+    long_t addr;
+    icache_ent_t *d;
+    stat_t e;
+
+    if (gen != c->gen) {
+        icache_flush(ic);
+        c->gen = gen;
+    }
+    d = fetch(sim->m, sim->pc);
+    if (!d)
+        return nexti(sim);
+    if (ic->misses != misses)
+        widen_code(M, d->pc, d->icode == I_ATOMIC ? d->pc + 2 + 8 : d->valP);
+
+    switch (d->icode) {
+      case I_ATOMIC:
+        return atomic_step(c, d);
+      case I_RMMOVQ:
+        addr = get_reg_val(sim->r, d->regB) + d->valC;
+        break;
+      case I_CALL: case I_PUSHQ:
+        addr = get_reg_val(sim->r, REG_RSP) - 8;
+        break;
+      default:
+        return nexti(sim);
+    }
+    e = nexti(sim);
+    stored(M, addr);
+    return e;
+}
+
+/* run core c until it halts, faults or runs out of steps, or for n steps */
+static void run_core(core_t *c, long_t n)
+{
+    for (; n > 0 && c->stat == STAT_AOK && c->steps < c->M->max_steps; n--) {
+        c->stat = core_step(c);
+        c->steps++;
+    }
+}
+
+static void *core_thread(void *arg)
+{
+    core_t *c = (core_t *)arg;
+
+    run_core(c, c->M->max_steps);
+    return NULL;
+}
+
+/* cores take turns of 'quantum' steps, in order, until all have stopped */
+static void run_round_robin(machine_t *M, long_t quantum)
+{
+    bool_t running = TRUE;
+    int i;
+
+    while (running) {
+        running = FALSE;
+        for (i = 0; i < M->n; i++) {
+            core_t *c = &M->core[i];
+            run_core(c, quantum);
+            if (c->stat == STAT_AOK && c->steps < M->max_steps)
+                running = TRUE;
+        }
+    }
+}
+
+static void print_core(core_t *c, FILE *out)
+{
+    y64sim_t *sim = c->sim;
+
+    fprintf(out, "Core %d:\n", c->id);
+    fflush(sim->out);
+    if (c->msglen)
+        fputs(c->msg, out);
+    fprintf(out, "Stopped in %ld steps at PC = 0x%lx.  Status '%s', CC %s\n",
+            c->steps, sim->pc, stat_name(c->stat), cc_name(sim->cc));
+
+    fprintf(out, "Changes to registers:\n");
+    diff_reg_log(sim->r, out);
+    fprintf(out, "\n");
+}
+
+/*
+ * run_cores: load a binary into memory shared by cfg->cores cores, run
+ *     them all from PC 0, and print each core's report, then the changes
+ *     to memory
+ * args
+ *     binname: the binary file
+ *     cfg: step limit per core, number of cores, and the quantum for
+ *          running them round-robin (0: each core on its own thread)
+ *     out: where the reports and any errors go
+ *
+ * Core i starts with %rdi = i and %rsi = the number of cores, so that
+ * the program can tell the cores apart, e.g. to give each a stack of its
+ * own; its report shows its register changes from that state.
+ *
+ * return
+ *     0: the cores ran
+ *     -1: the binary could not be loaded
+ */
+int run_cores(const char *binname, y64cfg_t *cfg, FILE *out)
+{
+    machine_t M;
+    mem_t *init;
+    y64sim_t *sim;
+    struct timespec t0, t1;
+    double secs;
+    long_t total = 0;
+    int i;
+
+    if (cfg->mem_size == MEM_ALL) {
+        err_print(out, "%s", "Cores can't share all 2^64 bytes of memory (-M)");
+        return -1;
+    }
+    sim = open_binfile(binname, cfg, out);
+    if (!sim)
+        return -1;
+
+    memset(&M, 0, sizeof(M));
+    M.m = sim->m;
+    M.n = cfg->cores;
+    M.max_steps = cfg->max_steps;
+    pthread_mutex_init(&M.lock, NULL);
+    /* the memory as loaded, for the report; the cores' writes unshare M.m */
+    init = dup_mem(M.m);
+
+    M.core = (core_t *)calloc(M.n, sizeof(core_t));
+    for (i = 0; i < M.n; i++) {
+        core_t *c = &M.core[i];
+        c->M = &M;
+        c->id = i;
+        c->stat = STAT_AOK;
+        c->sim = (y64sim_t *)calloc(1, sizeof(y64sim_t));
+        c->sim->r = init_reg();
+        c->sim->m = share_mem(M.m);
+        c->sim->cc = DEFAULT_CC;
+        c->sim->out = open_memstream(&c->msg, &c->msglen);
+        set_reg_val(c->sim->r, REG_RDI, i);
+        set_reg_val(c->sim->r, REG_RSI, M.n);
+        track_reg(c->sim->r);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (cfg->quantum) {
+        run_round_robin(&M, cfg->quantum);
+    } else {
+        for (i = 0; i < M.n; i++)
+            pthread_create(&M.core[i].thread, NULL, core_thread, &M.core[i]);
+        for (i = 0; i < M.n; i++)
+            pthread_join(M.core[i].thread, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    for (i = 0; i < M.n; i++) {
+        print_core(&M.core[i], out);
+        total += M.core[i].steps;
+    }
+    fprintf(out, "Changes to memory:\n");
+    diff_mem(init, M.m, out);
+
+    fprintf(out, "\nCores: %d", M.n);
+    if (cfg->quantum)
+        fprintf(out, " round-robin, %ld steps a turn", cfg->quantum);
+    else
+        fprintf(out, " on their own threads");
+    fprintf(out, "; %ld steps in %.3f s (%.2f MIPS)\n", total, secs,
+            secs > 0 ? total / secs / 1e6 : 0.0);
+
+    for (i = 0; i < M.n; i++) {
+        core_t *c = &M.core[i];
+        fclose(c->sim->out);
+        free(c->msg);
+        unshare_mem(c->sim->m);
+        free_reg(c->sim->r);
+        free((void *) c->sim);
+    }
+    free((void *) M.core);
+    pthread_mutex_destroy(&M.lock);
+    free_mem(init);
+    free_y64sim(sim);
+    return 0;
+}
@@ -0,0 +1,348 @@
+/* Execution profiler for Y64: per-PC counts, instruction mix, call graph */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "y64sim.h"
+
+#define PROF_TOP 20         /* hottest instructions listed in the report */
+#define PROF_MIN_PCS 1024   /* initial size of the PC table, a power of 2 */
+#define PROF_MAX_DEPTH 512  /* deeper calls are charged to the caller */
+
+/* What happened at one PC */
+typedef struct prof_pc {
+    long_t pc;
+    long_t count;
+    long_t taken, not_taken; /* conditional jumps only */
+    itype_t icode;
+    byte_t ifun;
+    bool_t valid;   /* the instruction could be decoded */
+    bool_t used;    /* the slot is occupied */
+} prof_pc_t;
+
+/* Calling context tree: one node per distinct chain of calls */
+typedef struct prof_node {
+    long_t func;    /* entry PC of the function */
+    long_t self;    /* steps spent in it, not counting its callees */
+    long_t total;   /* including callees, filled in by the report */
+    struct prof_node *parent, *child, *sibling;
+} prof_node_t;
+
+typedef struct prof {
+    prof_pc_t *pcs;
+    long_t npcs, maxpcs;
+    long_t mix[16][16]; /* steps by icode, ifun */
+    long_t invalid;     /* steps that could not be decoded */
+    long_t steps;
+    prof_node_t root;
+    prof_node_t *cur;
+    int depth;          /* of cur below root */
+    long_t deep;        /* calls not entered for being past PROF_MAX_DEPTH */
+} prof_t;
+
+static char *rrmovq_names[] = { "rrmovq", "cmovle", "cmovl", "cmove",
+    "cmovne", "cmovge", "cmovg" };
+static char *alu_names[] = { "addq", "subq", "andq", "xorq" };
+static char *jmp_names[] = { "jmp", "jle", "jl", "je", "jne", "jge", "jg" };
+static char *other_names[] = { "halt", "nop", NULL, "irmovq", "rmmovq",
+    "mrmovq", NULL, NULL, "call", "ret", "pushq", "popq" };
+
+/* mnemonic of an icode/ifun pair, or NULL if there is none */
+static char *insn_name(itype_t icode, byte_t ifun)
+{
+    switch (icode) {
+      case I_RRMOVQ:
+        return ifun <= C_G ? rrmovq_names[ifun] : NULL;
+      case I_ALU:
+        return ifun < A_NONE ? alu_names[ifun] : NULL;
+      case I_JMP:
+        return ifun <= C_G ? jmp_names[ifun] : NULL;
+      default:
+        return icode < I_DIRECTIVE && ifun == F_NONE ? other_names[icode] : NULL;
+    }
+}
+
+prof_t *new_prof(void)
+{
+    prof_t *p = (prof_t *)calloc(1, sizeof(prof_t));
+    p->maxpcs = PROF_MIN_PCS;
+    p->pcs = (prof_pc_t *)calloc(p->maxpcs, sizeof(prof_pc_t));
+    p->cur = &p->root;
+    return p;
+}
+
+static void free_node(prof_node_t *n)
+{
+    while (n) {
+        prof_node_t *next = n->sibling;
+        free_node(n->child);
+        free((void *) n);
+        n = next;
+    }
+}
+
+void free_prof(prof_t *p)
+{
+    free_node(p->root.child);
+    free((void *) p->pcs);
+    free((void *) p);
+}
+
+/* the entry for pc, created if it is not there yet */
+static prof_pc_t *prof_lookup(prof_t *p, long_t pc)
+{
+    long_t i = ((unsigned long)pc * 0x9E3779B97F4A7C15UL) >> 40;
+
+    for (i &= p->maxpcs - 1; p->pcs[i].used; i = (i + 1) & (p->maxpcs - 1))
+        if (p->pcs[i].pc == pc)
+            return &p->pcs[i];
+
+    if (2 * (p->npcs + 1) > p->maxpcs) {
+        prof_pc_t *old = p->pcs;
+        long_t j, oldmax = p->maxpcs;
+
+        p->maxpcs *= 2;
+        p->pcs = (prof_pc_t *)calloc(p->maxpcs, sizeof(prof_pc_t));
+        p->npcs = 0;
+        for (j = 0; j < oldmax; j++)
+            if (old[j].used)
+                *prof_lookup(p, old[j].pc) = old[j];
+        free((void *) old);
+        return prof_lookup(p, pc);
+    }
+    p->npcs++;
+    p->pcs[i].used = TRUE;
+    p->pcs[i].pc = pc;
+    return &p->pcs[i];
+}
+
+/* enter function 'func' from the current context */
+static void prof_call(prof_t *p, long_t func)
+{
+    prof_node_t *n;
+
+    if (p->depth == PROF_MAX_DEPTH) {
+        p->deep++;
+        return;
+    }
+    for (n = p->cur->child; n; n = n->sibling)
+        if (n->func == func)
+            break;
+    if (!n) {
+        n = (prof_node_t *)calloc(1, sizeof(prof_node_t));
+        n->func = func;
+        n->parent = p->cur;
+        n->sibling = p->cur->child;
+        p->cur->child = n;
+    }
+    p->cur = n;
+    p->depth++;
+}
+
+/* return to the caller, if the call was seen */
+static void prof_ret(prof_t *p)
+{
+    if (p->deep) {
+        p->deep--;
+    } else if (p->cur->parent) {
+        p->cur = p->cur->parent;
+        p->depth--;
+    }
+}
+
+/*
+ * run_profiled: execute like the step-by-step engine, recording a profile
+ * args
+ *     sim: the y64 image
+ *     p: the profile to add to
+ *     max_steps: most instructions to execute
+ *     steps: (out) instructions executed, counting a faulting or halting one
+ *
+ * return
+ *     the status of the last instruction, as nexti() returns it
+ */
+stat_t run_profiled(y64sim_t *sim, prof_t *p, int max_steps, int *steps)
+{
+    stat_t e = STAT_AOK;
+    int step;
+
+    if (p->steps == 0)
+        p->root.func = sim->pc;
+
+    for (step = 0; step < max_steps && e == STAT_AOK; step++) {
+        long_t pc = sim->pc;
+        cc_t cc = sim->cc;
+        prof_pc_t *s = prof_lookup(p, pc);
+        icache_ent_t *d = fetch(sim->m, pc);
+        itype_t icode = I_NOP;
+        byte_t ifun = 0;
+
+        s->count++;
+        p->steps++;
+        p->cur->self++;
+        if (d) {
+            icode = d->icode;
+            ifun = d->ifun;
+            s->icode = icode;
+            s->ifun = ifun;
+            s->valid = TRUE;
+            p->mix[icode][ifun]++;
+        } else {
+            p->invalid++;
+        }
+
+        e = nexti(sim);
+        if (!d || e != STAT_AOK)
+            continue;
+
+        if (icode == I_JMP && ifun != C_YES) {
+            if (cond_mask(ifun) >> cc & 1)
+                s->taken++;
+            else
+                s->not_taken++;
+        } else if (icode == I_CALL) {
+            prof_call(p, sim->pc);
+        } else if (icode == I_RET) {
+            prof_ret(p);
+        }
+    }
+    *steps = step;
+    return e;
+}
+
+static int cmp_count(const void *a, const void *b)
+{
+    const prof_pc_t *x = *(const prof_pc_t **)a;
+    const prof_pc_t *y = *(const prof_pc_t **)b;
+
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    return (unsigned long)x->pc < (unsigned long)y->pc ? -1 : 1;
+}
+
+static long_t sum_totals(prof_node_t *n)
+{
+    prof_node_t *c;
+
+    n->total = n->self;
+    for (c = n->child; c; c = c->sibling)
+        n->total += sum_totals(c);
+    return n->total;
+}
+
+static void print_node(prof_node_t *n, int depth, long_t steps, FILE *out)
+{
+    prof_node_t *c;
+
+    fprintf(out, "  %*s0x%-8lx %10ld %6.2f%% %10ld %6.2f%%\n", 2*depth, "",
+            n->func, n->self, 100.0 * n->self / steps,
+            n->total, 100.0 * n->total / steps);
+    for (c = n->child; c; c = c->sibling)
+        print_node(c, depth + 1, steps, out);
+}
+
+/* human-readable report: instruction mix, hot spots, branches, call graph */
+void print_prof(prof_t *p, FILE *out)
+{
+    prof_pc_t **hot;
+    long_t i, n, steps = p->steps ? p->steps : 1;
+    int icode, ifun;
+
+    fprintf(out, "\nProfile: %ld steps, %ld distinct PCs\n", p->steps, p->npcs);
+
+    fprintf(out, "\nInstruction mix:\n");
+    for (icode = 0; icode < 16; icode++)
+        for (ifun = 0; ifun < 16; ifun++) {
+            char *name = insn_name(icode, ifun);
+            if (!p->mix[icode][ifun])
+                continue;
+            if (name)
+                fprintf(out, "  %-8s %10ld %6.2f%%\n", name,
+                        p->mix[icode][ifun], 100.0 * p->mix[icode][ifun] / steps);
+            else
+                fprintf(out, "  %.2x       %10ld %6.2f%%\n", HPACK(icode, ifun),
+                        p->mix[icode][ifun], 100.0 * p->mix[icode][ifun] / steps);
+        }
+    if (p->invalid)
+        fprintf(out, "  %-8s %10ld %6.2f%%\n", "invalid",
+                p->invalid, 100.0 * p->invalid / steps);
+
+    hot = (prof_pc_t **)malloc((p->npcs + 1) * sizeof(prof_pc_t *));
+    for (i = n = 0; i < p->maxpcs; i++)
+        if (p->pcs[i].used)
+            hot[n++] = &p->pcs[i];
+    qsort(hot, n, sizeof(prof_pc_t *), cmp_count);
+
+    fprintf(out, "\nHottest instructions:\n");
+    for (i = 0; i < n && i < PROF_TOP; i++) {
+        char *name = hot[i]->valid ? insn_name(hot[i]->icode, hot[i]->ifun) : NULL;
+        fprintf(out, "  0x%-8lx %10ld %6.2f%%  %s\n", hot[i]->pc, hot[i]->count,
+                100.0 * hot[i]->count / steps, name ? name : "invalid");
+    }
+
+    fprintf(out, "\nConditional branches:\n");
+    fprintf(out, "  %-10s %-8s %10s %10s\n", "PC", "", "taken", "not taken");
+    for (i = 0; i < n; i++)
+        if (hot[i]->taken || hot[i]->not_taken)
+            fprintf(out, "  0x%-8lx %-8s %10ld %10ld\n", hot[i]->pc,
+                    insn_name(hot[i]->icode, hot[i]->ifun),
+                    hot[i]->taken, hot[i]->not_taken);
+    free((void *) hot);
+
+    sum_totals(&p->root);
+    fprintf(out, "\nCall graph:\n");
+    fprintf(out, "  %-10s %18s %18s\n", "function", "self", "total");
+    print_node(&p->root, 0, steps, out);
+}
+
+static void print_stacks(prof_node_t *n, prof_node_t **path, int depth, FILE *out)
+{
+    prof_node_t *c;
+    int i;
+
+    path[depth] = n;
+    if (n->self) {
+        for (i = 0; i <= depth; i++)
+            fprintf(out, "%s0x%lx", i ? ";" : "", path[i]->func);
+        fprintf(out, " %ld\n", n->self);
+    }
+    for (c = n->child; c; c = c->sibling)
+        print_stacks(c, path, depth + 1, out);
+}
+
+static int cmp_pc(const void *a, const void *b)
+{
+    const prof_pc_t *x = *(const prof_pc_t **)a;
+    const prof_pc_t *y = *(const prof_pc_t **)b;
+
+    return (unsigned long)x->pc < (unsigned long)y->pc ? -1 : 1;
+}
+
+/*
+ * one "pc count taken not_taken" line per PC, in order of PC, for
+ * y64asm -P to lay the code out by
+ */
+void print_pcs(prof_t *p, FILE *out)
+{
+    prof_pc_t **pcs = (prof_pc_t **)malloc((p->npcs + 1) * sizeof(prof_pc_t *));
+    long_t i, n;
+
+    for (i = n = 0; i < p->maxpcs; i++)
+        if (p->pcs[i].used)
+            pcs[n++] = &p->pcs[i];
+    qsort(pcs, n, sizeof(prof_pc_t *), cmp_pc);
+
+    fprintf(out, "# pc count taken not_taken\n");
+    for (i = 0; i < n; i++)
+        fprintf(out, "0x%lx %ld %ld %ld\n", pcs[i]->pc, pcs[i]->count,
+                pcs[i]->taken, pcs[i]->not_taken);
+    free((void *) pcs);
+}
+
+/* one "caller;callee count" line per calling context, for flamegraph.pl */
+void print_folded(prof_t *p, FILE *out)
+{
+    prof_node_t *path[PROF_MAX_DEPTH+1];
+
+    print_stacks(&p->root, path, 0, out);
+}
@@ -0,0 +1,444 @@
+/*
+ * Execution trace recorder: every step's PC, register changes, store and
+ * condition codes, in the format of y64trace.h.  The simulator fills one
+ * block buffer while a writer thread packs and writes the other.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "y64sim.h"
+#include "y64trace.h"
+
+#define err_print(_f, _s, _a ...) \
+    fprintf(_f, _s"\n", _a);
+
+#define LZ_MIN 4            /* shortest match trace_pack() encodes */
+#define LZ_TAIL 5           /* last bytes of a block, always literals */
+#define LZ_HASH_BITS 13
+
+typedef struct tracer {
+    FILE *f;
+    char *name;
+    bool_t packed;
+    /* filled by the simulator */
+    byte_t *buf[2];
+    trace_blk_t blk[2];
+    int cur;            /* the buffer being filled */
+    byte_t *p, *end;    /* next record goes at p; the block is full past end */
+    long_t pc, addr, val; /* bases of the PC and store deltas */
+    long_t reg[REG_NONE];
+    cc_t cc;
+    long_t step;
+    /* shared with the writer */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int pending;        /* the buffer handed to the writer, or -1 */
+    bool_t done;
+    /* the writer's own */
+    byte_t *pack;
+    trace_idx_t *idx;
+    long_t nidx, maxidx;
+    long_t off;         /* file offset of the next block */
+    long_t raw;         /* bytes of records */
+    bool_t failed;
+} tracer_t;
+
+static inline uint32_t read32(const byte_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static byte_t *put_len(byte_t *op, int len)
+{
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = len;
+    return op;
+}
+
+/* one sequence: 'lit' literals from 'src', then a match, unless len is 0 */
+static byte_t *put_seq(byte_t *op, const byte_t *src, int lit, int off, int len)
+{
+    int ml = len ? len - LZ_MIN : 0;
+
+    *op++ = (lit < 15 ? lit : 15) << 4 | (ml < 15 ? ml : 15);
+    if (lit >= 15)
+        op = put_len(op, lit - 15);
+    memcpy(op, src, lit);
+    op += lit;
+    if (len) {
+        *op++ = off & 0xFF;
+        *op++ = off >> 8;
+        if (ml >= 15)
+            op = put_len(op, ml - 15);
+    }
+    return op;
+}
+
+/*
+ * trace_pack: compress n bytes from src into dst, LZ77 style: literal runs
+ *     and back references of up to 64KB, each sequence led by a token of
+ *     two 4-bit lengths
+ * return
+ *     the bytes written to dst, at most TRACE_PACK_MAX(n)
+ */
+int trace_pack(const byte_t *src, int n, byte_t *dst)
+{
+    int table[1 << LZ_HASH_BITS];
+    int i = 0, anchor = 0;
+    byte_t *op = dst;
+
+    memset(table, -1, sizeof(table));
+    while (i + LZ_MIN + LZ_TAIL <= n) {
+        uint32_t h = (read32(src + i) * 2654435761U) >> (32 - LZ_HASH_BITS);
+        int cand = table[h];
+        int len;
+
+        table[h] = i;
+        if (cand < 0 || i - cand > 0xFFFF || read32(src + cand) != read32(src + i)) {
+            i++;
+            continue;
+        }
+        for (len = LZ_MIN; i + len < n - LZ_TAIL && src[cand + len] == src[i + len]; len++)
+            ;
+        op = put_seq(op, src + anchor, i - anchor, i - cand, len);
+        i += len;
+        anchor = i;
+    }
+    op = put_seq(op, src + anchor, n - anchor, 0, 0);
+    return op - dst;
+}
+
+static const byte_t *get_len(const byte_t *ip, const byte_t *iend, int *len)
+{
+    byte_t b;
+
+    do {
+        if (ip >= iend)
+            return NULL;
+        b = *ip++;
+        *len += b;
+    } while (b == 255);
+    return ip;
+}
+
+/*
+ * trace_unpack: undo trace_pack()
+ * return
+ *     the bytes written to dst, or -1 if src is corrupt or would need more
+ *     than 'cap' bytes
+ */
+int trace_unpack(const byte_t *src, int n, byte_t *dst, int cap)
+{
+    const byte_t *ip = src, *iend = src + n;
+    byte_t *op = dst, *oend = dst + cap;
+
+    while (ip < iend) {
+        byte_t token = *ip++;
+        int lit = token >> 4, len = token & 15, off;
+
+        if (lit == 15 && !(ip = get_len(ip, iend, &lit)))
+            return -1;
+        if (lit > iend - ip || lit > oend - op)
+            return -1;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        off = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (len == 15 && !(ip = get_len(ip, iend, &len)))
+            return -1;
+        len += LZ_MIN;
+        if (off == 0 || off > op - dst || len > oend - op)
+            return -1;
+        for (; len > 0; len--, op++)
+            *op = op[-off];
+    }
+    return op - dst;
+}
+
+/* pack and write block i, and note it in the index */
+static void write_block(tracer_t *t, int i)
+{
+    trace_blk_t *b = &t->blk[i];
+    byte_t *data = t->buf[i];
+
+    b->len = b->raw_len;
+    if (t->packed) {
+        int len = trace_pack(data, b->raw_len, t->pack);
+        if (len < b->raw_len) {
+            b->len = len;
+            data = t->pack;
+        }
+    }
+
+    if (t->nidx == t->maxidx) {
+        t->maxidx = t->maxidx ? 2 * t->maxidx : 256;
+        t->idx = (trace_idx_t *)realloc(t->idx, t->maxidx * sizeof(trace_idx_t));
+    }
+    t->idx[t->nidx].step = b->step;
+    t->idx[t->nidx].off = t->off;
+    t->nidx++;
+
+    if (fwrite(b, sizeof(*b), 1, t->f) != 1 || fwrite(data, 1, b->len, t->f) != b->len)
+        t->failed = TRUE;
+    t->off += sizeof(*b) + b->len;
+    t->raw += b->raw_len;
+}
+
+static void *trace_writer(void *arg)
+{
+    tracer_t *t = (tracer_t *)arg;
+    int i;
+
+    for (;;) {
+        pthread_mutex_lock(&t->lock);
+        while (t->pending < 0 && !t->done)
+            pthread_cond_wait(&t->cond, &t->lock);
+        i = t->pending;
+        pthread_mutex_unlock(&t->lock);
+        if (i < 0)
+            return NULL;
+
+        write_block(t, i);
+
+        pthread_mutex_lock(&t->lock);
+        t->pending = -1;
+        pthread_cond_broadcast(&t->cond);
+        pthread_mutex_unlock(&t->lock);
+    }
+}
+
+/* give the writer the block being filled, once it is done with the other */
+static void hand_off(tracer_t *t)
+{
+    pthread_mutex_lock(&t->lock);
+    while (t->pending >= 0)
+        pthread_cond_wait(&t->cond, &t->lock);
+    t->blk[t->cur].raw_len = t->p - t->buf[t->cur];
+    t->pending = t->cur;
+    pthread_cond_broadcast(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+    t->cur ^= 1;
+}
+
+/* start a block at the current step, handing off the full one */
+static void next_block(tracer_t *t, y64sim_t *sim)
+{
+    trace_blk_t *b;
+
+    if (t->p)
+        hand_off(t);
+    b = &t->blk[t->cur];
+    b->step = t->step;
+    b->nsteps = 0;
+    get_reg_file(sim->r, t->reg);
+    memcpy(b->reg, t->reg, sizeof(b->reg));
+    t->cc = sim->cc;
+    b->cc = t->cc;
+    t->pc = t->addr = t->val = 0;
+    t->p = t->buf[t->cur];
+    t->end = t->p + TRACE_BLOCK - TRACE_MAX_REC;
+}
+
+/*
+ * new_trace: create a trace file and start its writer thread
+ * args
+ *     name: the file
+ *     packed: whether to pack blocks with trace_pack()
+ *     out: where errors go
+ *
+ * return
+ *     the tracer, or NULL if the file could not be created
+ */
+tracer_t *new_trace(const char *name, bool_t packed, FILE *out)
+{
+    tracer_t *t;
+    trace_hdr_t hdr;
+
+    t = (tracer_t *)calloc(1, sizeof(tracer_t));
+    t->f = fopen(name, "wb");
+    if (!t->f) {
+        err_print(out, "Can't write trace file '%s'", name);
+        free((void *) t);
+        return NULL;
+    }
+    t->name = strdup(name);
+    t->packed = packed;
+    t->buf[0] = (byte_t *)malloc(TRACE_BLOCK);
+    t->buf[1] = (byte_t *)malloc(TRACE_BLOCK);
+    if (packed)
+        t->pack = (byte_t *)malloc(TRACE_PACK_MAX(TRACE_BLOCK));
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = TRACE_VERSION;
+    hdr.flags = packed ? TRACE_PACKED : 0;
+    if (fwrite(&hdr, sizeof(hdr), 1, t->f) != 1)
+        t->failed = TRUE;
+    t->off = sizeof(hdr);
+
+    t->pending = -1;
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->cond, NULL);
+    pthread_create(&t->thread, NULL, trace_writer, t);
+    return t;
+}
+
+/*
+ * run_traced: execute like the step-by-step engine, recording every step
+ * args
+ *     sim: the y64 image
+ *     t: the trace to add to
+ *     max_steps: most instructions to execute
+ *     steps: (out) instructions executed, counting a faulting or halting one
+ *
+ * return
+ *     the status of the last instruction, as nexti() returns it
+ */
+stat_t run_traced(y64sim_t *sim, tracer_t *t, int max_steps, int *steps)
+{
+    stat_t e = STAT_AOK;
+    long_t reg[REG_NONE];
+    int step, i;
+
+    for (step = 0; step < max_steps && e == STAT_AOK; step++) {
+        long_t pc = sim->pc;
+        icache_ent_t *d = fetch(sim->m, pc);
+        regid_t dst[3] = { REG_NONE, REG_NONE, REG_NONE };
+        long_t addr = 0, val = 0;
+        bool_t store = FALSE;
+        byte_t *p, tag;
+
+        if (t->p >= t->end)
+            next_block(t, sim);
+
+        /* the registers the step can change, and the word it can store */
+        if (d) {
+            dst[0] = d->regA;
+            dst[1] = d->regB != d->regA ? d->regB : REG_NONE;
+            switch (d->icode) {
+              case I_RMMOVQ:
+                addr = (NORM_REG(d->regB) ? t->reg[d->regB] : 0) + d->valC;
+                val = NORM_REG(d->regA) ? t->reg[d->regA] : 0;
+                store = TRUE;
+                break;
+              case I_CALL: case I_PUSHQ:
+                addr = t->reg[REG_RSP] - 8;
+                val = d->icode == I_CALL ? d->valP :
+                    NORM_REG(d->regA) ? t->reg[d->regA] : 0;
+                store = TRUE;
+                /* fall through */
+              case I_RET: case I_POPQ:
+                if (dst[0] != REG_RSP && dst[1] != REG_RSP)
+                    dst[2] = REG_RSP;
+                break;
+              default:
+                break;
+            }
+        }
+
+        e = nexti(sim);
+
+        p = t->p + 1;
+        tag = e << 4;
+        p = put_varint(p, pc - t->pc);
+        t->pc = pc;
+        get_reg_file(sim->r, reg);
+        for (i = 0; i < 3; i++) {
+            regid_t id = dst[i];
+            if (NORM_REG(id) && reg[id] != t->reg[id]) {
+                *p++ = id;
+                p = put_varint(p, reg[id] - t->reg[id]);
+                t->reg[id] = reg[id];
+                tag++;
+            }
+        }
+        /* a store to a valid address happens, even if the step faults */
+        if (store && mem_valid(sim->m, addr, 8)) {
+            tag |= TR_STORE;
+            p = put_varint(p, addr - t->addr);
+            p = put_varint(p, val - t->val);
+            t->addr = addr;
+            t->val = val;
+        }
+        if (sim->cc != t->cc) {
+            tag |= TR_CC;
+            *p++ = sim->cc;
+            t->cc = sim->cc;
+        }
+        *t->p = tag;
+        t->p = p;
+        t->blk[t->cur].nsteps++;
+        t->step++;
+    }
+
+    *steps = step;
+    return e;
+}
+
+/*
+ * end_trace: write the last block, the index and the trailer, and close
+ *     the file
+ * return
+ *     0, or -1 if some of it could not be written (reported to 'out')
+ */
+int end_trace(tracer_t *t, FILE *out)
+{
+    trace_tail_t tail;
+
+    if (t->p && t->p > t->buf[t->cur])
+        hand_off(t);
+    pthread_mutex_lock(&t->lock);
+    t->done = TRUE;
+    pthread_cond_broadcast(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+    pthread_join(t->thread, NULL);
+
+    memset(&tail, 0, sizeof(tail));
+    tail.idx_off = t->off;
+    tail.nblocks = t->nidx;
+    tail.nsteps = t->step;
+    memcpy(tail.magic, TRACE_IDX_MAGIC, sizeof(TRACE_IDX_MAGIC));
+    if (fwrite(t->idx, sizeof(trace_idx_t), t->nidx, t->f) != t->nidx ||
+        fwrite(&tail, sizeof(tail), 1, t->f) != 1)
+        t->failed = TRUE;
+    t->off += t->nidx * sizeof(trace_idx_t) + sizeof(tail);
+    if (fclose(t->f))
+        t->failed = TRUE;
+    t->f = NULL;
+
+    if (t->failed) {
+        err_print(out, "Failed to write trace file '%s'", t->name);
+        return -1;
+    }
+    return 0;
+}
+
+void print_trace_stats(tracer_t *t, FILE *out)
+{
+    fprintf(out, "Trace: %ld steps in %ld blocks, %ld bytes of records, %ld written (%.2f bytes per step)\n",
+            t->step, t->nidx, t->raw, t->off, t->step ? (double)t->off / t->step : 0.0);
+}
+
+void free_trace(tracer_t *t)
+{
+    pthread_mutex_destroy(&t->lock);
+    pthread_cond_destroy(&t->cond);
+    free((void *) t->buf[0]);
+    free((void *) t->buf[1]);
+    free((void *) t->pack);
+    free((void *) t->idx);
+    free((void *) t->name);
+    free((void *) t);
+}
@@ -2,15 +2,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "y64sim.h"
 
-#define err_print(_s, _a ...) \
-    fprintf(stdout, _s"\n", _a);
+#define err_print(_f, _s, _a ...) \
+    fprintf(_f, _s"\n", _a);
 
 
-typedef enum {STAT_AOK, STAT_HLT, STAT_ADR, STAT_INS} stat_t;
-
 char *stat_names[] = { "AOK", "HLT", "ADR", "INS" };
 
 char *stat_name(stat_t e)
@@ -39,11 +40,212 @@ char *cc_name(cc_t c)
         return cc_names[c];
 }
 
+/* every absent page reads as this one */
+static page_t zero_page;
+
+#define VPN(addr) ((unsigned long)(addr) >> PAGE_BITS)
+#define PG_OFF(addr) ((unsigned long)(addr) & (PAGE_SIZE-1))
+
+/* the little-endian word at p, in one (possibly unaligned) load */
+static inline long_t load_word(const byte_t *p)
+{
+    long_t val;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(&val, p, 8);
+#else
+    int i;
+    for (val = 0, i = 0; i < 8; i++)
+        val = val | ((long_t)p[i])<<(8*i);
+#endif
+    return val;
+}
+
+static inline void store_word(byte_t *p, long_t val)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(p, &val, 8);
+#else
+    int i;
+    for (i = 0; i < 8; i++, val >>= 8)
+        p[i] = val & 0xFF;
+#endif
+}
+
+/* word at page offset off of page vpn, which is p, or absent if NULL */
+static long_t page_word(image_t *img, page_t *p, unsigned long vpn, int off)
+{
+    unsigned long pos = (vpn << PAGE_BITS) | off;
+
+    if (p)
+        return load_word(p->data + off);
+    if (!img || pos >= (unsigned long)img->len)
+        return 0;
+    if (pos + 8 <= (unsigned long)img->len)
+        return load_word(img->base + pos);
+    {
+        byte_t buf[8] = { 0 };
+        memcpy(buf, img->base + pos, img->len - pos);
+        return load_word(buf);
+    }
+}
+
+/* a new private page for vpn, holding the image's bytes if it has any */
+static page_t *new_page(image_t *img, unsigned long vpn)
+{
+    page_t *p = (page_t *)calloc(1, sizeof(page_t));
+    unsigned long pos = vpn << PAGE_BITS;
+
+    p->ref = 1;
+    if (img && pos < (unsigned long)img->len)
+        memcpy(p->data, img->base + pos,
+               img->len - pos < PAGE_SIZE ? img->len - pos : PAGE_SIZE);
+    return p;
+}
+
+static ptab_t *new_ptab(void)
+{
+    ptab_t *t = (ptab_t *)calloc(1, sizeof(ptab_t));
+    t->ref = 1;
+    return t;
+}
+
+/* private copy of a shared level-lvl table; its children become shared */
+static ptab_t *copy_ptab(ptab_t *t, int lvl)
+{
+    ptab_t *nt = (ptab_t *)malloc(sizeof(ptab_t));
+    int i;
+
+    memcpy(nt->ent, t->ent, sizeof(nt->ent));
+    nt->ref = 1;
+    for (i = 0; i < PT_SIZE; i++) {
+        if (!nt->ent[i])
+            continue;
+        if (lvl > 0)
+            ((ptab_t *)nt->ent[i])->ref++;
+        else
+            ((page_t *)nt->ent[i])->ref++;
+    }
+    t->ref--;
+    return nt;
+}
+
+static void unref_ptab(ptab_t *t, int lvl)
+{
+    int i;
+
+    if (--t->ref > 0)
+        return;
+    for (i = 0; i < PT_SIZE; i++) {
+        if (!t->ent[i])
+            continue;
+        if (lvl > 0)
+            unref_ptab((ptab_t *)t->ent[i], lvl - 1);
+        else if (--((page_t *)t->ent[i])->ref == 0)
+            free(t->ent[i]);
+    }
+    free((void *) t);
+}
+
+/* How walk() treats the tables on the way to a page */
+typedef enum {
+    WALK_FIND,  /* leave them alone; NULL if one is missing */
+    WALK_FILL,  /* create missing ones, but leave shared ones shared */
+    WALK_OWN    /* create missing ones and unshare shared ones */
+} walk_t;
+
+/*
+ * find the slot for page vpn; with WALK_OWN the slot may be written.
+ * WALK_FILL is for putting in an image page: every memory sharing the
+ * table reads the same image there, so none of them can tell.
+ */
+static page_t **walk(mem_t *m, unsigned long vpn, walk_t how)
+{
+    ptab_t **slot = &m->pt;
+    int lvl;
+
+    for (lvl = PT_LEVELS - 1; ; lvl--) {
+        void **ent;
+        if (how == WALK_OWN && (*slot)->ref > 1)
+            *slot = copy_ptab(*slot, lvl);
+        ent = &(*slot)->ent[(vpn >> (lvl * PT_BITS)) & (PT_SIZE-1)];
+        if (lvl == 0)
+            return (page_t **)ent;
+        if (!*ent) {
+            if (how == WALK_FIND)
+                return NULL;
+            *ent = new_ptab();
+        }
+        slot = (ptab_t **)ent;
+    }
+}
+
+static void tlb_flush(mem_t *m)
+{
+    int i;
+
+    for (i = 0; i < TLB_SIZE; i++)
+        m->tlb[i].vpn = TLB_EMPTY;
+}
+
+/* refill the TLB entry for addr, with a private page if write */
+static __attribute__((noinline))
+page_t *tlb_fill(mem_t *m, long_t addr, bool_t write)
+{
+    unsigned long vpn = VPN(addr);
+    tlb_ent_t *e = &m->tlb[vpn & (TLB_SIZE-1)];
+    /* the page holds image bytes if it starts inside the image */
+    bool_t in_img = m->img && (vpn << PAGE_BITS) < (unsigned long)m->img->len;
+    page_t **slot = walk(m, vpn, write ? WALK_OWN : in_img ? WALK_FILL : WALK_FIND);
+
+    if (!write) {
+        if (in_img && !*slot)
+            *slot = new_page(m->img, vpn);
+        e->page = (slot && *slot) ? *slot : &zero_page;
+        /* a page with ref 1 may still hang off a shared table */
+        e->rw = FALSE;
+    } else {
+        if (!*slot) {
+            *slot = new_page(m->img, vpn);
+        } else if ((*slot)->ref > 1) {
+            page_t *copy = (page_t *)malloc(sizeof(page_t));
+            memcpy(copy->data, (*slot)->data, PAGE_SIZE);
+            memcpy(copy->dirty, (*slot)->dirty, sizeof(copy->dirty));
+            copy->ref = 1;
+            (*slot)->ref--;
+            *slot = copy;
+        }
+        e->page = *slot;
+        e->rw = TRUE;
+    }
+    e->vpn = vpn;
+    return e->page;
+}
+
+/* page holding addr, for reading */
+static inline page_t *page_rd(mem_t *m, long_t addr)
+{
+    tlb_ent_t *e = &m->tlb[VPN(addr) & (TLB_SIZE-1)];
+
+    if (e->vpn == VPN(addr))
+        return e->page;
+    return tlb_fill(m, addr, FALSE);
+}
+
+/* page holding addr, for writing: allocated or unshared first if needed */
+static inline page_t *page_wr(mem_t *m, long_t addr)
+{
+    tlb_ent_t *e = &m->tlb[VPN(addr) & (TLB_SIZE-1)];
+
+    if (e->vpn == VPN(addr) && e->rw)
+        return e->page;
+    return tlb_fill(m, addr, TRUE);
+}
+
 bool_t get_byte_val(mem_t *m, long_t addr, byte_t *dest)
 {
-    if (addr < 0 || addr >= m->len)
+    if (!mem_valid(m, addr, 1))
         return FALSE;
-    *dest = m->data[addr];
+    *dest = page_rd(m, addr)->data[PG_OFF(addr)];
     return TRUE;
 }
 
@@ -51,71 +253,346 @@ bool_t get_long_val(mem_t *m, long_t addr, long_t *dest)
 {
     int i;
     long_t val;
-    if (addr < 0 || addr + 8 > m->len)
+    if (!mem_valid(m, addr, 8))
 	    return FALSE;
     val = 0;
-    for (i = 0; i < 8; i++)
-	    val = val | ((long_t)m->data[addr+i])<<(8*i);
+    if (PG_OFF(addr) <= PAGE_SIZE - 8) {
+        val = load_word(page_rd(m, addr)->data + PG_OFF(addr));
+    } else {
+        for (i = 0; i < 8; i++) {
+            unsigned long a = (unsigned long)addr + i;
+            val = val | ((long_t)page_rd(m, a)->data[PG_OFF(a)])<<(8*i);
+        }
+    }
     *dest = val;
     return TRUE;
 }
 
+/* drop every cached instruction, e.g. after the whole memory was replaced */
+void icache_flush(icache_t *ic)
+{
+    int i;
+
+    ic->gen++;
+    for (i = 0; i < ICACHE_SIZE; i++)
+        ic->ent[i].valid = FALSE;
+}
+
+/* drop every cached instruction overlapping [addr, addr+len) */
+void icache_invalidate(icache_t *ic, long_t addr, int len)
+{
+    long_t pc;
+
+    if (addr >= ic->hi || addr + len <= ic->lo)
+        return;
+    ic->gen++;
+    for (pc = addr - MAX_INSLEN + 1; pc < addr + len; pc++) {
+        icache_ent_t *e = &ic->ent[pc & (ICACHE_SIZE-1)];
+        if (e->valid && e->pc == pc && e->valP > addr)
+            e->valid = FALSE;
+    }
+}
+
+static __attribute__((noinline))
+void log_append(mem_t *m, page_t *p, unsigned long w)
+{
+    if (m->nlog == m->maxlog) {
+        m->maxlog *= 2;
+        m->log = (wlog_ent_t *)realloc(m->log, m->maxlog * sizeof(wlog_ent_t));
+    }
+    m->log[m->nlog].addr = w;
+    m->log[m->nlog].old = load_word(p->data + PG_OFF(w));
+    m->nlog++;
+}
+
+/* log word w of page p with its old value, unless already logged */
+static inline void log_word(mem_t *m, page_t *p, unsigned long w)
+{
+    int bit = PG_OFF(w) / 8;
+
+    if (p->dirty[bit/64] & (1UL << (bit%64)))
+        return;
+    p->dirty[bit/64] |= 1UL << (bit%64);
+    log_append(m, p, w);
+}
+
 bool_t set_byte_val(mem_t *m, long_t addr, byte_t val)
 {
-    if (addr < 0 || addr >= m->len)
+    page_t *p;
+    if (!mem_valid(m, addr, 1))
 	    return FALSE;
-    m->data[addr] = val;
+    p = page_wr(m, addr);
+    if (m->log)
+        log_word(m, p, (unsigned long)addr & ~7UL);
+    p->data[PG_OFF(addr)] = val;
+    if (m->icache)
+        icache_invalidate(m->icache, addr, 1);
     return TRUE;
 }
 
 bool_t set_long_val(mem_t *m, long_t addr, long_t val)
 {
     int i;
-    if (addr < 0 || addr + 8 > m->len)
+    if (!mem_valid(m, addr, 8))
 	    return FALSE;
-    for (i = 0; i < 8; i++) {
-    	m->data[addr+i] = val & 0xFF;
-    	val >>= 8;
+    if (m->icache)
+        icache_invalidate(m->icache, addr, 8);
+    if (PG_OFF(addr) <= PAGE_SIZE - 8) {
+        page_t *pg = page_wr(m, addr);
+        if (m->log) {
+            log_word(m, pg, (unsigned long)addr & ~7UL);
+            if (PG_OFF(addr) & 7)
+                log_word(m, pg, ((unsigned long)addr + 8) & ~7UL);
+        }
+        store_word(pg->data + PG_OFF(addr), val);
+    } else {
+        for (i = 0; i < 8; i++) {
+            unsigned long a = (unsigned long)addr + i;
+            page_t *pg = page_wr(m, a);
+            if (m->log && (i == 0 || !(a & 7)))
+                log_word(m, pg, a & ~7UL);
+            pg->data[PG_OFF(a)] = val & 0xFF;
+            val >>= 8;
+        }
     }
     return TRUE;
 }
 
-mem_t *init_mem(int len)
+/*
+ * word_ptr: the aligned word at addr, to be updated in place (by an atomic
+ *     read-modify-write); logged and dropped from the decode cache like a
+ *     store to it
+ * return
+ *     the word, or NULL if addr is unaligned or outside of memory
+ */
+long_t *word_ptr(mem_t *m, long_t addr)
 {
-    mem_t *m = (mem_t *)malloc(sizeof(mem_t));
+    page_t *p;
+
+    if ((addr & 7) || !mem_valid(m, addr, 8))
+        return NULL;
+    if (m->icache)
+        icache_invalidate(m->icache, addr, 8);
+    p = page_wr(m, addr);
+    if (m->log)
+        log_word(m, p, (unsigned long)addr);
+    return (long_t *)(p->data + PG_OFF(addr));
+}
+
+mem_t *init_mem(long_t len)
+{
+    mem_t *m = (mem_t *)calloc(1, sizeof(mem_t));
     len = ((len+BLK_SIZE-1)/BLK_SIZE)*BLK_SIZE;
     m->len = len;
-    m->data = (byte_t *)calloc(len, 1);
+    m->pt = new_ptab();
+    tlb_flush(m);
+    m->icache = NULL;
 
     return m;
 }
 
 void free_mem(mem_t *m)
 {
-    free((void *) m->data);
+    if (m->icache)
+        free((void *) m->icache);
+    if (m->log)
+        free((void *) m->log);
+    unref_ptab(m->pt, PT_LEVELS - 1);
+    if (m->img && --m->img->ref == 0) {
+        munmap(m->img->base, m->img->len);
+        free((void *) m->img);
+    }
     free((void *) m);
 }
 
 mem_t *dup_mem(mem_t *oldm)
 {
-    mem_t *newm = init_mem(oldm->len);
-    memcpy(newm->data, oldm->data, oldm->len);
+    mem_t *newm = (mem_t *)calloc(1, sizeof(mem_t));
+    newm->len = oldm->len;
+    newm->pt = oldm->pt;
+    newm->pt->ref++;
+    newm->img = oldm->img;
+    if (newm->img)
+        newm->img->ref++;
+    newm->icache = NULL;
+    tlb_flush(newm);
+    /* everything is shared now, so oldm's writes must copy it first */
+    tlb_flush(oldm);
     return newm;
 }
 
+/*
+ * share_mem: a view of m for another host thread: the same pages, with its
+ *     own TLB and decode cache and no write log
+ * Every page of m is made present and private first, so that no access
+ * through m or a view changes the tables again and views can be used at
+ * the same time.  Only memory of bounded length can be shared, and only
+ * while m tracks no writes.
+ */
+mem_t *share_mem(mem_t *m)
+{
+    mem_t *v = (mem_t *)malloc(sizeof(mem_t));
+    long_t addr;
+
+    assert(m->len != MEM_ALL && !m->log);
+    for (addr = 0; addr < m->len; addr += PAGE_SIZE)
+        page_wr(m, addr);
+    *v = *m;
+    v->icache = (icache_t *)calloc(1, sizeof(icache_t));
+    tlb_flush(v);
+    return v;
+}
+
+/* free a view made by share_mem(), but not the memory it shares */
+void unshare_mem(mem_t *v)
+{
+    free((void *) v->icache);
+    free((void *) v);
+}
+
+/*
+ * compare two tables of the same level, of oldm and newm; whatever they
+ * share is skipped
+ */
+static bool_t diff_table(mem_t *oldm, mem_t *newm, ptab_t *ot, ptab_t *nt,
+                         int lvl, unsigned long base, unsigned long last,
+                         bool_t diff, FILE *outfile)
+{
+    int i, off;
+
+    if (ot == nt)
+        return diff;
+    for (i = 0; (!diff || outfile) && i < PT_SIZE; i++) {
+        void *o = ot ? ot->ent[i] : NULL;
+        void *n = nt ? nt->ent[i] : NULL;
+        unsigned long vpn = (base << PT_BITS) | i;
+
+        if (o == n)
+            continue;
+        if (lvl > 0) {
+            diff = diff_table(oldm, newm, (ptab_t *)o, (ptab_t *)n, lvl - 1,
+                              vpn, last, diff, outfile);
+            continue;
+        }
+        for (off = 0; (!diff || outfile) && off < PAGE_SIZE; off += 8) {
+            unsigned long pos = (vpn << PAGE_BITS) | off;
+            long_t ov = page_word(oldm->img, (page_t *)o, vpn, off);
+            long_t nv = page_word(newm->img, (page_t *)n, vpn, off);
+            if (pos > last)
+                return diff;
+            if (nv != ov) {
+                diff = TRUE;
+                if (outfile)
+                    fprintf(outfile, "0x%.16lx:\t0x%.16lx\t0x%.16lx\n", pos, ov, nv);
+            }
+        }
+    }
+    return diff;
+}
+
 bool_t diff_mem(mem_t *oldm, mem_t *newm, FILE *outfile)
 {
-    long_t pos;
-    int len = oldm->len;
+    /* address of the last whole word both memories hold */
+    unsigned long olast = oldm->len == MEM_ALL ? ~7UL : oldm->len - 8;
+    unsigned long nlast = newm->len == MEM_ALL ? ~7UL : newm->len - 8;
+
+    return diff_table(oldm, newm, oldm->pt, newm->pt, PT_LEVELS - 1, 0,
+                      olast < nlast ? olast : nlast, FALSE, outfile);
+}
+
+static bool_t page_dirty(page_t *p)
+{
+    int j;
+
+    for (j = 0; j < PAGE_SIZE/8/64; j++)
+        if (p->dirty[j])
+            return TRUE;
+    return FALSE;
+}
+
+static bool_t table_dirty(ptab_t *t, int lvl)
+{
+    int i;
+
+    for (i = 0; i < PT_SIZE; i++)
+        if (t->ent[i] && (lvl > 0 ? table_dirty((ptab_t *)t->ent[i], lvl - 1)
+                                  : page_dirty((page_t *)t->ent[i])))
+            return TRUE;
+    return FALSE;
+}
+
+/* clear the dirty bits of every page; shared pages get a clean copy */
+static void clear_dirty(ptab_t **slot, int lvl)
+{
+    ptab_t *t = *slot;
+    int i;
+
+    if (!table_dirty(t, lvl))
+        return;
+    if (t->ref > 1)
+        *slot = t = copy_ptab(t, lvl);
+    for (i = 0; i < PT_SIZE; i++) {
+        page_t *p = (page_t *)t->ent[i];
+        if (!p)
+            continue;
+        if (lvl > 0) {
+            clear_dirty((ptab_t **)&t->ent[i], lvl - 1);
+            continue;
+        }
+        if (!page_dirty(p))
+            continue;
+        if (p->ref > 1) {
+            page_t *copy = (page_t *)calloc(1, sizeof(page_t));
+            memcpy(copy->data, p->data, PAGE_SIZE);
+            copy->ref = 1;
+            p->ref--;
+            t->ent[i] = copy;
+        } else {
+            memset(p->dirty, 0, sizeof(p->dirty));
+        }
+    }
+}
+
+/* start logging the first write to every word of m */
+void track_mem(mem_t *m)
+{
+    clear_dirty(&m->pt, PT_LEVELS - 1);
+    tlb_flush(m);
+    if (!m->log) {
+        m->maxlog = 64;
+        m->log = (wlog_ent_t *)malloc(m->maxlog * sizeof(wlog_ent_t));
+    }
+    m->nlog = 0;
+}
+
+static int cmp_log(const void *a, const void *b)
+{
+    unsigned long x = ((const wlog_ent_t *)a)->addr;
+    unsigned long y = ((const wlog_ent_t *)b)->addr;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * diff_mem_log: print the words of m that differ from when track_mem()
+ *     was called, the same way diff_mem() would, but from the log alone
+ * args
+ *     m: the tracked memory
+ *     outfile: where to print, or NULL to only check for a difference
+ *
+ * return
+ *     TRUE iff some word differs
+ */
+bool_t diff_mem_log(mem_t *m, FILE *outfile)
+{
+    int i;
     bool_t diff = FALSE;
-    
-    if (newm->len < len)
-	    len = newm->len;
-    
-    for (pos = 0; (!diff || outfile) && pos < len; pos += 8) {
-        long_t ov = 0;  long_t nv = 0;
-        get_long_val(oldm, pos, &ov);
-        get_long_val(newm, pos, &nv);
+
+    qsort(m->log, m->nlog, sizeof(wlog_ent_t), cmp_log);
+    for (i = 0; (!diff || outfile) && i < m->nlog; i++) {
+        long_t pos = m->log[i].addr;
+        long_t ov = m->log[i].old;
+        long_t nv = 0;
+        get_long_val(m, pos, &nv);
         if (nv != ov) {
             diff = TRUE;
             if (outfile)
@@ -125,7 +602,6 @@ bool_t diff_mem(mem_t *oldm, mem_t *newm, FILE *outfile)
     return diff;
 }
 
-
 reg_t reg_table[REG_NONE] = {
     {"%rax", REG_RAX},
     {"%rcx", REG_RCX},
@@ -159,6 +635,12 @@ void set_reg_val(mem_t *r, regid_t id, long_t val)
         set_long_val(r, id*8, val);
 }
 
+/* all of %rax .. %r14 at once, as the host's (little-endian) longs */
+void get_reg_file(mem_t *r, long_t *reg)
+{
+    memcpy(reg, page_rd(r, 0)->data, REG_SIZE);
+}
+
 mem_t *init_reg()
 {
     return init_mem(REG_SIZE);
@@ -174,6 +656,11 @@ mem_t *dup_reg(mem_t *oldr)
     return dup_mem(oldr);
 }
 
+void track_reg(mem_t *r)
+{
+    track_mem(r);
+}
+
 bool_t diff_reg(mem_t *oldr, mem_t *newr, FILE *outfile)
 {
     long_t pos;
@@ -198,14 +685,40 @@ bool_t diff_reg(mem_t *oldr, mem_t *newr, FILE *outfile)
     return diff;
 }
 
+/* diff_reg() against the register file as it was at track_reg() */
+bool_t diff_reg_log(mem_t *r, FILE *outfile)
+{
+    int i;
+    bool_t diff = FALSE;
+
+    qsort(r->log, r->nlog, sizeof(wlog_ent_t), cmp_log);
+    for (i = 0; (!diff || outfile) && i < r->nlog; i++) {
+        long_t pos = r->log[i].addr;
+        long_t ov = r->log[i].old;
+        long_t nv = 0;
+        get_long_val(r, pos, &nv);
+        if (nv != ov) {
+            diff = TRUE;
+            if (outfile)
+                fprintf(outfile, "%s:\t0x%.16lx\t0x%.16lx\n",
+                        reg_table[pos/8].name, ov, nv);
+        }
+    }
+    return diff;
+}
+
 /* create an y64 image with registers and memory */
-y64sim_t *new_y64sim(int slen)
+y64sim_t *new_y64sim(long_t slen)
 {
     y64sim_t *sim = (y64sim_t*)malloc(sizeof(y64sim_t));
     sim->pc = 0;
     sim->r = init_reg();
     sim->m = init_mem(slen);
+    sim->m->icache = (icache_t *)calloc(1, sizeof(icache_t));
     sim->cc = DEFAULT_CC;
+    sim->bc = NULL;
+    sim->jit = NULL;
+    sim->out = stdout;
     return sim;
 }
 
@@ -213,22 +726,72 @@ void free_y64sim(y64sim_t *sim)
 {
     free_reg(sim->r);
     free_mem(sim->m);
+    if (sim->bc)
+        free((void *) sim->bc);
+    if (sim->jit)
+        free_jit(sim->jit);
     free((void *) sim);
 }
 
+/*
+ * map a regular file read-only, so its pages are read in only as the
+ * program touches them
+ * return
+ *     1: mapped, 0: not a file that can be mapped, -1: too large
+ */
+static int map_binfile(mem_t *m, FILE *f, FILE *out)
+{
+    struct stat st;
+    void *base;
+
+    if (fstat(fileno(f), &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+        ftell(f) != 0)
+        return 0;
+    if (m->len != MEM_ALL && st.st_size > m->len) {
+        err_print(out, "too large memory footprint (0x%x)", (int)m->len);
+        return -1;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (base == MAP_FAILED)
+        return 0;
+    m->img = (image_t *)malloc(sizeof(image_t));
+    m->img->ref = 1;
+    m->img->base = (byte_t *)base;
+    m->img->len = st.st_size;
+    return 1;
+}
+
 /* load binary code and data from file to memory image */
-int load_binfile(mem_t *m, FILE *f)
+int load_binfile(mem_t *m, FILE *f, FILE *out)
 {
-    int flen;
+    byte_t buf[PAGE_SIZE];
+    long_t flen = 0;
+    int n, chunk;
+
+    if (!m->img) {
+        n = map_binfile(m, f, out);
+        if (n)
+            return n > 0 ? 0 : -1;
+    }
 
     clearerr(f);
-    flen = fread(m->data, sizeof(byte_t), m->len, f);
+    while (m->len == MEM_ALL || flen < m->len) {
+        chunk = PAGE_SIZE;
+        if (m->len != MEM_ALL && m->len - flen < chunk)
+            chunk = m->len - flen;
+        n = fread(buf, sizeof(byte_t), chunk, f);
+        if (n > 0)
+            memcpy(page_wr(m, flen)->data, buf, n);
+        flen += n;
+        if (n < chunk)
+            break;
+    }
     if (ferror(f)) {
-        err_print("fread() failed (0x%x)", flen);
+        err_print(out, "fread() failed (0x%x)", (int)flen);
         return -1;
     }
     if (!feof(f)) {
-        err_print("too large memory footprint (0x%x)", flen);
+        err_print(out, "too large memory footprint (0x%x)", (int)flen);
         return -1;
     }
     return 0;
@@ -360,6 +923,94 @@ bool_t cond_doit(cc_t cc, cond_t cond)
     return doit;
 }
 
+/*
+ * decode: fetch and split the instruction at 'pc' into its fields
+ * args
+ *     m: the memory holding the code
+ *     pc: address of the instruction
+ *     d: where to store the decoded fields
+ *
+ * return
+ *     TRUE: success
+ *     FALSE: some byte of the instruction lies outside of memory
+ */
+bool_t decode(mem_t *m, long_t pc, icache_ent_t *d)
+{
+    byte_t codefun = 0;
+    byte_t regs = 0;
+    long_t next_pc = pc;
+
+    if (!get_byte_val(m, next_pc, &codefun))
+        return FALSE;
+    d->pc = pc;
+    d->icode = GET_ICODE(codefun);
+    d->ifun = GET_FUN(codefun);
+    d->regA = d->regB = REG_NONE;
+    d->valC = 0;
+    next_pc++;
+
+    /* get registers if needed (1 byte) */
+    switch (d->icode) {
+      case I_RRMOVQ: case I_IRMOVQ: case I_RMMOVQ: case I_MRMOVQ:
+      case I_ALU: case I_PUSHQ: case I_POPQ:
+        if (!get_byte_val(m, next_pc, &regs))
+            return FALSE;
+        d->regA = GET_REGA(regs);
+        d->regB = GET_REGB(regs);
+        next_pc++;
+        break;
+      default:
+        break;
+    }
+
+    /* get immediate if needed (8 bytes) */
+    switch (d->icode) {
+      case I_IRMOVQ: case I_RMMOVQ: case I_MRMOVQ: case I_JMP: case I_CALL:
+        if (!get_long_val(m, next_pc, &d->valC))
+            return FALSE;
+        next_pc += 8;
+        break;
+      default:
+        break;
+    }
+
+    d->valP = next_pc;
+    return TRUE;
+}
+
+/*
+ * fetch: look 'pc' up in the decode cache, decoding it on a miss
+ *
+ * return
+ *     the decoded instruction, or NULL if it can't be fetched
+ */
+icache_ent_t *fetch(mem_t *m, long_t pc)
+{
+    icache_t *ic = m->icache;
+    icache_ent_t *d = &ic->ent[pc & (ICACHE_SIZE-1)];
+
+    if (d->valid && d->pc == pc) {
+        ic->hits++;
+        return d;
+    }
+
+    ic->misses++;
+    d->valid = decode(m, pc, d);
+    if (!d->valid)
+        return NULL;
+
+    if (ic->lo == ic->hi) {
+        ic->lo = pc;
+        ic->hi = d->valP;
+    } else {
+        if (pc < ic->lo)
+            ic->lo = pc;
+        if (d->valP > ic->hi)
+            ic->hi = d->valP;
+    }
+    return d;
+}
+
 /* 
  * nexti: execute single instruction and return status.
  * args
@@ -373,30 +1024,20 @@ bool_t cond_doit(cc_t cc, cond_t cond)
  */
 stat_t nexti(y64sim_t *sim)
 {
-    byte_t codefun = 0; /* 1 byte */
-    itype_t icode;
-    alu_t ifun;
-    long_t next_pc = sim->pc;
+    icache_ent_t *d;
+    long_t next_pc;
+    long_t immediate;
     
-    /* get code and function （1 byte) */
-    if (!get_byte_val(sim->m, next_pc, &codefun)) {
-        err_print("PC = 0x%lx, Invalid instruction address", sim->pc);
+    /* get the predecoded instruction */
+    d = fetch(sim->m, sim->pc);
+    if (!d) {
+        err_print(sim->out, "PC = 0x%lx, Invalid instruction address", sim->pc);
         return STAT_ADR;
     }
-    icode = GET_ICODE(codefun);
-    ifun = GET_FUN(codefun);
-    next_pc++;
-
-    /* get registers if needed (1 byte) */
-    byte_t registerSpecifier;
-    regid_t registerA;
-    regid_t registerB;
-
-    /* get immediate if needed (8 bytes) */
-    long_t immediate;
+    next_pc = d->valP;
 
     /* execute the instruction*/
-    switch (icode) {
+    switch (d->icode) {
       case I_HALT: /* 0:0 */
 	    return STAT_HLT;
 	    break;
@@ -405,150 +1046,83 @@ stat_t nexti(y64sim_t *sim)
     	break;
       case I_RRMOVQ:  /* 2:x regA:regB */
 	{
-	if (!get_byte_val(sim -> m, next_pc, &registerSpecifier)) {
-		err_print("PC = 0x%lx, Invalid instruction address", sim->pc);
-		return STAT_ADR;
-	}
+	long_t value = get_reg_val(sim -> r, d -> regA);
 
-	registerA = GET_REGA(registerSpecifier);
-	registerB = GET_REGB(registerSpecifier);
-	
-	long_t value = get_reg_val(sim -> r, registerA);
-
-	if (cond_doit(sim -> cc, ifun)) {
-		set_reg_val(sim -> r, registerB, value);
+	if (cond_doit(sim -> cc, d -> ifun)) {
+		set_reg_val(sim -> r, d -> regB, value);
 	}
 
-	sim -> pc = ++next_pc;
+	sim -> pc = next_pc;
 	
 	break;
 	}
       case I_IRMOVQ: /* 3:0 F:regB imm */
 	{
-	if (!get_byte_val(sim -> m, next_pc, &registerSpecifier)) {
-		err_print("PC = 0x%lx, Invalid instruction address", sim->pc);
-		return STAT_ADR;
-	}
-
-	registerB = GET_REGB(registerSpecifier);
-	next_pc++;
-	
-	if (!get_long_val(sim -> m, next_pc, &immediate)) {
-		err_print("PC = 0x%lx, Invalid instruction address", sim->pc);
-		return STAT_ADR;
-	}
-
-	set_reg_val(sim -> r, registerB, immediate);
-	sim -> pc = next_pc + 8; // 8 bytes immediate for y64
+	set_reg_val(sim -> r, d -> regB, d -> valC);
+	sim -> pc = next_pc;
 
 	break;
 	}
       case I_RMMOVQ: /* 4:0 regA:regB imm */
 	{
-	if (!get_byte_val(sim -> m, next_pc, &registerSpecifier)) {
-		err_print("PC = 0x%lx, Invalid instruction address", sim->pc);
-		return STAT_ADR;
-	}
-
-	registerA = GET_REGA(registerSpecifier);
-	registerB = GET_REGB(registerSpecifier);
-	next_pc++;
-	
-	if (!get_long_val(sim -> m, next_pc, &immediate)) {
-		err_print("PC = 0x%lx, Invalid instruction address", sim->pc);
-		return STAT_ADR;
-	}
-
-	long_t valueA = get_reg_val(sim -> r, registerA);
-	long_t valueB = get_reg_val(sim -> r, registerB);
-	set_long_val(sim -> m, valueB + immediate, valueA);
-	sim -> pc = next_pc + 8; // 8 bytes immediate length
+	long_t valueA = get_reg_val(sim -> r, d -> regA);
+	long_t valueB = get_reg_val(sim -> r, d -> regB);
+	set_long_val(sim -> m, valueB + d -> valC, valueA);
+	sim -> pc = next_pc;
 
 	break;
 	}
       case I_MRMOVQ: /* 5:0 regB:regA imm */
 	{
-	if (!get_byte_val(sim -> m, next_pc, &registerSpecifier)) {
-		err_print("PC = 0x%lx, Invalid instruction address", sim->pc);
-		return STAT_ADR;
-	}
-
-	registerA = GET_REGA(registerSpecifier);
-	registerB = GET_REGB(registerSpecifier);
-	next_pc++;
-	
-	if (!get_long_val(sim -> m, next_pc, &immediate)) {
-		err_print("PC = 0x%lx, Invalid instruction address", sim->pc);
-		return STAT_ADR;
-	}
-
-	long_t valueB = get_reg_val(sim -> r, registerB);
+	long_t valueB = get_reg_val(sim -> r, d -> regB);
 
-	if (!get_long_val(sim -> m, valueB + immediate, &immediate)) {
-		err_print("PC = 0x%lx, Invalid data address 0x%lx", sim->pc, valueB + immediate);
+	if (!get_long_val(sim -> m, valueB + d -> valC, &immediate)) {
+		err_print(sim->out, "PC = 0x%lx, Invalid data address 0x%lx", sim->pc, valueB + d -> valC);
 		return STAT_ADR;
 	}
 
-	set_reg_val(sim -> r, registerA, immediate);
-	sim -> pc = next_pc + 8;
+	set_reg_val(sim -> r, d -> regA, immediate);
+	sim -> pc = next_pc;
 	
 	break;
 	}
       case I_ALU: /* 6:x regA:regB */
 	{
-	if (!get_byte_val(sim -> m, next_pc, &registerSpecifier)) {
-		err_print("PC = 0x%lx, Invalid instruction address", sim->pc);
-		return STAT_ADR;
-	}
-	
-	registerA = GET_REGA(registerSpecifier);
-	registerB = GET_REGB(registerSpecifier);
-	long_t valueA = get_reg_val(sim -> r, registerA);
-	long_t valueB = get_reg_val(sim -> r, registerB);
-	long_t result = compute_alu(ifun, valueA, valueB);
-	sim -> cc = compute_cc(ifun, valueA, valueB, result);
-	set_reg_val(sim -> r, registerB, result);
-	sim -> pc = ++next_pc;
+	long_t valueA = get_reg_val(sim -> r, d -> regA);
+	long_t valueB = get_reg_val(sim -> r, d -> regB);
+	long_t result = compute_alu(d -> ifun, valueA, valueB);
+	sim -> cc = compute_cc(d -> ifun, valueA, valueB, result);
+	set_reg_val(sim -> r, d -> regB, result);
+	sim -> pc = next_pc;
 	
 	break;
 	}
       case I_JMP: /* 7:x imm */
 	{
-	if (!get_long_val(sim -> m, next_pc, &immediate)) {
-		err_print("PC = 0x%lx, Invalid instruction address", sim->pc);
-		return STAT_ADR;
-	}
-
-	if (cond_doit(sim -> cc, ifun)) {
-		sim -> pc = immediate;
+	if (cond_doit(sim -> cc, d -> ifun)) {
+		sim -> pc = d -> valC;
 		break;
 	}
 
-	sim -> pc = next_pc + 8;
+	sim -> pc = next_pc;
 
 	break;
 	}
       case I_CALL: /* 8:x imm */
 	{
-	if (!get_long_val(sim -> m, next_pc, &immediate)) {
-		err_print("PC = 0x%lx, Invalid instruction address", sim->pc);
-		return STAT_ADR;
-	}
-	
-	// first, increment pc then save it to %rsp(stack)
-	next_pc += 8;
+	// first, save the return address to %rsp(stack)
 	long_t stackAddress = get_reg_val(sim -> r, 4);
 	stackAddress -= 8;
 	set_reg_val(sim -> r, 4, stackAddress);
 	set_long_val(sim -> m, stackAddress, next_pc);
 	long_t temp;
 	if (!get_long_val(sim -> m, stackAddress, &temp)) {
-		err_print("PC = 0x%lx, Invalid stack address 0x%lx", sim->pc, stackAddress);
+		err_print(sim->out, "PC = 0x%lx, Invalid stack address 0x%lx", sim->pc, stackAddress);
 		return STAT_ADR;
 	}	
 
 	// then, set the pc to immediate
-	sim -> pc = immediate;
+	sim -> pc = d -> valC;
 
 	break;
 	}
@@ -558,7 +1132,7 @@ stat_t nexti(y64sim_t *sim)
 	long_t stackAddress = get_reg_val(sim -> r, 4);
 	
 	if (!get_long_val(sim -> m, stackAddress, &immediate)) {
-		err_print("PC = 0x%lx, Invalid instruction address", sim->pc);
+		err_print(sim->out, "PC = 0x%lx, Invalid instruction address", sim->pc);
 		return STAT_ADR;
 	}
 	
@@ -572,122 +1146,527 @@ stat_t nexti(y64sim_t *sim)
 	}
       case I_PUSHQ: /* A:0 regA:F */
 	{
-	if (!get_byte_val(sim -> m, next_pc, &registerSpecifier)) {
-		err_print("PC = 0x%lx, Invalid instruction address", sim->pc);
-		return STAT_ADR;
-	}
-
-	registerA = GET_REGA(registerSpecifier);
-	
 	// first, get the value of register to be pushed then do necessary stack changes
-	long_t valueToPush = get_reg_val(sim -> r, registerA);
+	long_t valueToPush = get_reg_val(sim -> r, d -> regA);
 	long_t stackAddress = get_reg_val(sim -> r, 4);
 	stackAddress -= 8;
 	set_reg_val(sim -> r, 4, stackAddress);
 	if (!get_long_val(sim -> m, stackAddress, &immediate)) {
-		err_print("PC = 0x%lx, Invalid stack address 0x%lx", sim->pc, stackAddress);
+		err_print(sim->out, "PC = 0x%lx, Invalid stack address 0x%lx", sim->pc, stackAddress);
 		return STAT_ADR;
 	}
 
 	// then, push the value and increment pc
 	set_long_val(sim -> m, stackAddress, valueToPush);
-	sim -> pc = ++next_pc;
+	sim -> pc = next_pc;
 	
 	break;
 	}
       case I_POPQ: /* B:0 regA:F */
 	{
-    	if (!get_byte_val(sim -> m, next_pc, &registerSpecifier)) {
-		err_print("PC = 0x%lx, Invalid instruction address", sim->pc);
-		return STAT_ADR;
-	}
-
-	registerA = GET_REGA(registerSpecifier);
-	
 	// first, get the stack address and the memory content
 	long_t stackAddress = get_reg_val(sim -> r, 4);
 	if (!get_long_val(sim -> m, stackAddress, &immediate)) {
-		err_print("PC = 0x%lx, Invalid instruction address", sim->pc);
+		err_print(sim->out, "PC = 0x%lx, Invalid instruction address", sim->pc);
 		return STAT_ADR;
 	}
 	
 	// then, save the content to register and perform required pc, stack routing
 	set_reg_val(sim -> r, 4, stackAddress + 8);
-	set_reg_val(sim -> r, registerA, immediate);
-	sim -> pc = ++next_pc;
+	set_reg_val(sim -> r, d -> regA, immediate);
+	sim -> pc = next_pc;
 
 	break;
 	}
       default:
-    	err_print("PC = 0x%lx, Invalid instruction %.2x", sim->pc, codefun);
+    	err_print(sim->out, "PC = 0x%lx, Invalid instruction %.2x", sim->pc, HPACK(d->icode, d->ifun));
     	return STAT_INS;
     }
     
     return STAT_AOK;
 }
 
-void usage(char *pname)
+/* Handlers of the threaded engine, see run_threaded() */
+typedef enum { OP_END, OP_HALT, OP_NOP, OP_RRMOVQ, OP_CMOVXX, OP_IRMOVQ,
+    OP_RMMOVQ, OP_MRMOVQ, OP_ADDQ, OP_SUBQ, OP_ANDQ, OP_XORQ, OP_ALU,
+    OP_JMP, OP_JXX, OP_CALL, OP_RET, OP_PUSHQ, OP_POPQ, OP_INS,
+    /* superinstructions, one per fuse_t */
+    OP_IRMOVQ_ADDQ, OP_MRMOVQ_RMMOVQ, OP_OPQ_JXX, OP_PUSHQ_PUSHQ,
+    OP_POPQ_POPQ, OP_POPQ_RET, OP_NUM } op_t;
+
+char *fuse_names[FUSE_NUM] = { "irmovq+addq", "mrmovq+rmmovq", "opq+jXX",
+    "pushq+pushq", "popq+popq", "popq+ret" };
+
+/* the superinstruction for ops 'a' then 'b', or OP_END if there is none */
+static op_t fuse_op(op_t a, op_t b)
 {
-    printf("Usage: %s file.bin [max_steps]\n", pname);
-    exit(0);
+    bool_t opq = a == OP_ADDQ || a == OP_SUBQ || a == OP_ANDQ || a == OP_XORQ;
+
+    if (a == OP_IRMOVQ && b == OP_ADDQ)
+        return OP_IRMOVQ_ADDQ;
+    if (a == OP_MRMOVQ && b == OP_RMMOVQ)
+        return OP_MRMOVQ_RMMOVQ;
+    if (opq && b == OP_JXX)
+        return OP_OPQ_JXX;
+    if (a == OP_PUSHQ && b == OP_PUSHQ)
+        return OP_PUSHQ_PUSHQ;
+    if (a == OP_POPQ && b == OP_POPQ)
+        return OP_POPQ_POPQ;
+    if (a == OP_POPQ && b == OP_RET)
+        return OP_POPQ_RET;
+    return OP_END;
 }
 
-int main(int argc, char *argv[])
+#define SINK_REG (REG_NONE+1)
+#define DST_REG(_id) ((_id) == REG_NONE ? SINK_REG : (_id))
+
+/* condition as a bit mask over the 8 possible condition codes */
+byte_t cond_mask(cond_t cond)
 {
-    FILE *binfile;
-    int max_steps = MAX_STEP;
-    y64sim_t *sim;
-    mem_t *saver, *savem;
-    int step = 0;
-    stat_t e = STAT_AOK;
+    byte_t mask = 0;
+    int cc;
+    for (cc = 0; cc < 8; cc++)
+        if (cond_doit(cc, cond))
+            mask |= 1 << cc;
+    return mask;
+}
+
+/*
+ * build_block: decode the basic block starting at 'pc' into 'b'
+ * args
+ *     sim: the y64 image
+ *     b: the block to fill
+ *     pc: address of its first instruction
+ *     handler: handler addresses, indexed by op_t
+ *
+ * The block ends after the first control transfer, halt or invalid
+ * instruction, before an instruction that can't be fetched, or after
+ * MAX_BLOCK_INSNS instructions. A trailing OP_END continues at the next PC.
+ * Adjacent pairs fuse_op() knows are then given a superinstruction, which
+ * runs from the first slot and skips the second.
+ */
+static void build_block(y64sim_t *sim, block_t *b, long_t pc, void *const *handler)
+{
+    op_t ops[MAX_BLOCK_INSNS];
+    int i, n = 0;
+    bool_t last = FALSE;
+
+    b->pc = pc;
+    b->gen = sim->m->icache->gen;
+    while (!last && n < MAX_BLOCK_INSNS) {
+        icache_ent_t *d = fetch(sim->m, pc);
+        tinsn_t *t = &b->insn[n];
+        op_t op;
+
+        if (!d)
+            break;
+        t->pc = pc;
+        t->valC = d->valC;
+        t->valP = d->valP;
+        t->srcA = d->regA;
+        t->srcB = d->regB;
+        t->dstA = DST_REG(d->regA);
+        t->dstB = DST_REG(d->regB);
+        t->ifun = d->ifun;
+        t->cmask = cond_mask(d->ifun);
+
+        switch (d->icode) {
+          case I_HALT:   op = OP_HALT; last = TRUE; break;
+          case I_NOP:    op = OP_NOP; break;
+          case I_RRMOVQ: op = d->ifun == C_YES ? OP_RRMOVQ : OP_CMOVXX; break;
+          case I_IRMOVQ: op = OP_IRMOVQ; break;
+          case I_RMMOVQ: op = OP_RMMOVQ; break;
+          case I_MRMOVQ: op = OP_MRMOVQ; break;
+          case I_ALU:
+            switch (d->ifun) {
+              case A_ADD: op = OP_ADDQ; break;
+              case A_SUB: op = OP_SUBQ; break;
+              case A_AND: op = OP_ANDQ; break;
+              case A_XOR: op = OP_XORQ; break;
+              default:    op = OP_ALU; break;
+            }
+            break;
+          case I_JMP:    op = d->ifun == C_YES ? OP_JMP : OP_JXX; last = TRUE; break;
+          case I_CALL:   op = OP_CALL; last = TRUE; break;
+          case I_RET:    op = OP_RET; last = TRUE; break;
+          case I_PUSHQ:  op = OP_PUSHQ; break;
+          case I_POPQ:   op = OP_POPQ; break;
+          default:       op = OP_INS; last = TRUE; break;
+        }
+        t->op = handler[op];
+        ops[n] = op;
+        pc = d->valP;
+        n++;
+    }
 
-    if (argc < 2 || argc > 3)
-        usage(argv[0]);
+    for (i = 0; i + 1 < n; i++) {
+        op_t fused = fuse_op(ops[i], ops[i+1]);
+        if (fused != OP_END) {
+            b->insn[i].op = handler[fused];
+            i++;
+        }
+    }
 
-    /* set max steps */
-    if (argc > 2)
-        max_steps = atoi(argv[2]);
+    b->n = n;
+    b->insn[n].op = handler[OP_END];
+    b->insn[n].pc = b->insn[n].valP = pc;
+}
 
-    /* load binary file to memory */
-    if (strcmp(argv[1]+(strlen(argv[1])-4), ".bin"))
-        usage(argv[0]); /* only support *.bin file */
-    
-    binfile = fopen(argv[1], "rb");
+/*
+ * run_threaded: execute up to 'max_steps' instructions, dispatching
+ * through the handler addresses of a predecoded basic block (direct
+ * threading) and checking step limit and status once per block.
+ * Faults and invalid instructions are handed back to nexti(), which
+ * reports them exactly as the single-step loop would.
+ * args
+ *     sim: the y64 image with PC, register and memory
+ *     max_steps: the most instructions to execute
+ *     steps: store the number of instructions executed
+ *
+ * return
+ *     the status of the last instruction, as nexti() returns it
+ */
+stat_t run_threaded(y64sim_t *sim, int max_steps, int *steps)
+{
+    static void *const handler[OP_NUM] = {
+        [OP_END] = &&op_end, [OP_HALT] = &&op_halt, [OP_NOP] = &&op_nop,
+        [OP_RRMOVQ] = &&op_rrmovq, [OP_CMOVXX] = &&op_cmovxx,
+        [OP_IRMOVQ] = &&op_irmovq, [OP_RMMOVQ] = &&op_rmmovq,
+        [OP_MRMOVQ] = &&op_mrmovq, [OP_ADDQ] = &&op_addq,
+        [OP_SUBQ] = &&op_subq, [OP_ANDQ] = &&op_andq, [OP_XORQ] = &&op_xorq,
+        [OP_ALU] = &&op_alu, [OP_JMP] = &&op_jmp, [OP_JXX] = &&op_jxx,
+        [OP_CALL] = &&op_call, [OP_RET] = &&op_ret, [OP_PUSHQ] = &&op_pushq,
+        [OP_POPQ] = &&op_popq, [OP_INS] = &&op_ins,
+        [OP_IRMOVQ_ADDQ] = &&op_irmovq_addq,
+        [OP_MRMOVQ_RMMOVQ] = &&op_mrmovq_rmmovq, [OP_OPQ_JXX] = &&op_opq_jxx,
+        [OP_PUSHQ_PUSHQ] = &&op_pushq_pushq, [OP_POPQ_POPQ] = &&op_popq_popq,
+        [OP_POPQ_RET] = &&op_popq_ret
+    };
+    long_t reg[SINK_REG+1];
+    long_t pc = sim->pc;
+    long_t val;
+    cc_t cc = sim->cc;
+    mem_t *m = sim->m;
+    long_t *fused;
+    icache_t *ic = m->icache;
+    int left = max_steps;   /* steps not yet charged */
+    stat_t e = STAT_AOK;
+    block_t *b;
+    tinsn_t *ip;
+    int id;
+
+#define NEXT() do { ip++; goto *ip->op; } while (0)
+/* leave the block after 'ip' completed, refunding what didn't run */
+#define LEAVE(_pc) do { \
+    pc = (_pc); left += b->n - (ip - b->insn) - 1; goto dispatch; \
+} while (0)
+/* leave before 'ip' runs and let nexti() execute (and report) it */
+#define FAULT() do { \
+    pc = ip->pc; left += b->n - (ip - b->insn); goto slow; \
+} while (0)
+
+    if (!sim->bc)
+        sim->bc = (bcache_t *)calloc(1, sizeof(bcache_t));
+    fused = sim->bc->fused;
+
+    for (id = 0; id < REG_NONE; id++)
+        reg[id] = get_reg_val(sim->r, id);
+    reg[REG_NONE] = reg[SINK_REG] = 0;
+
+dispatch:
+    if (left <= 0)
+        goto out;
+    b = &sim->bc->blk[pc & (BLOCK_CACHE_SIZE-1)];
+    if (b->pc != pc || b->gen != ic->gen || !b->insn[b->n].op) {
+        build_block(sim, b, pc, handler);
+        sim->bc->built++;
+    }
+    if (b->n == 0 || b->n > left)
+        goto slow;
+    sim->bc->entered++;
+    left -= b->n;
+    ip = b->insn;
+    goto *ip->op;
+
+op_end:
+    pc = ip->valP;
+    goto dispatch;
+op_halt:
+    pc = ip->pc;
+    e = STAT_HLT;
+    goto out;
+op_nop:
+    NEXT();
+op_rrmovq:
+    reg[ip->dstB] = reg[ip->srcA];
+    NEXT();
+op_cmovxx:
+    if (ip->cmask >> cc & 1)
+        reg[ip->dstB] = reg[ip->srcA];
+    NEXT();
+op_irmovq:
+    reg[ip->dstB] = ip->valC;
+    NEXT();
+/* each body leaves ip on its own instruction, so faults stay precise */
+#define RMMOVQ_BODY() \
+    set_long_val(m, reg[ip->srcB] + ip->valC, reg[ip->srcA]); \
+    if (b->gen != ic->gen) \
+        LEAVE(ip->valP);
+#define MRMOVQ_BODY() \
+    if (!get_long_val(m, reg[ip->srcB] + ip->valC, &val)) \
+        FAULT(); \
+    reg[ip->dstA] = val;
+#define ALU_BODY(_op) \
+    val = compute_alu(_op, reg[ip->srcA], reg[ip->srcB]); \
+    cc = compute_cc(_op, reg[ip->srcA], reg[ip->srcB], val); \
+    reg[ip->dstB] = val;
+#define RET_BODY() \
+    if (!get_long_val(m, reg[REG_RSP], &val)) \
+        FAULT(); \
+    reg[REG_RSP] += 8; \
+    LEAVE(val);
+#define PUSHQ_BODY() \
+    if (!set_long_val(m, reg[REG_RSP] - 8, reg[ip->srcA])) \
+        FAULT(); \
+    reg[REG_RSP] -= 8; \
+    if (b->gen != ic->gen) \
+        LEAVE(ip->valP);
+#define POPQ_BODY() \
+    if (!get_long_val(m, reg[REG_RSP], &val)) \
+        FAULT(); \
+    reg[REG_RSP] += 8; \
+    reg[ip->dstA] = val;
+op_rmmovq:
+    RMMOVQ_BODY();
+    NEXT();
+op_mrmovq:
+    MRMOVQ_BODY();
+    NEXT();
+#define ALU_OP(_label, _op) \
+_label: \
+    ALU_BODY(_op); \
+    NEXT();
+ALU_OP(op_addq, A_ADD)
+ALU_OP(op_subq, A_SUB)
+ALU_OP(op_andq, A_AND)
+ALU_OP(op_xorq, A_XOR)
+ALU_OP(op_alu, ip->ifun)
+#undef ALU_OP
+op_jmp:
+    LEAVE(ip->valC);
+op_jxx:
+    LEAVE((ip->cmask >> cc & 1) ? ip->valC : ip->valP);
+op_call:
+    if (!set_long_val(m, reg[REG_RSP] - 8, ip->valP))
+        FAULT();
+    reg[REG_RSP] -= 8;
+    LEAVE(ip->valC);
+op_ret:
+    RET_BODY();
+op_pushq:
+    PUSHQ_BODY();
+    NEXT();
+op_popq:
+    POPQ_BODY();
+    NEXT();
+op_irmovq_addq:
+    fused[FUSE_IRMOVQ_ADDQ]++;
+    reg[ip->dstB] = ip->valC;
+    ip++;
+    ALU_BODY(A_ADD);
+    NEXT();
+op_mrmovq_rmmovq:
+    fused[FUSE_MRMOVQ_RMMOVQ]++;
+    MRMOVQ_BODY();
+    ip++;
+    RMMOVQ_BODY();
+    NEXT();
+op_opq_jxx:
+    fused[FUSE_OPQ_JXX]++;
+    ALU_BODY(ip->ifun);
+    ip++;
+    LEAVE((ip->cmask >> cc & 1) ? ip->valC : ip->valP);
+op_pushq_pushq:
+    fused[FUSE_PUSHQ_PUSHQ]++;
+    PUSHQ_BODY();
+    ip++;
+    PUSHQ_BODY();
+    NEXT();
+op_popq_popq:
+    fused[FUSE_POPQ_POPQ]++;
+    POPQ_BODY();
+    ip++;
+    POPQ_BODY();
+    NEXT();
+op_popq_ret:
+    fused[FUSE_POPQ_RET]++;
+    POPQ_BODY();
+    ip++;
+    RET_BODY();
+#undef RMMOVQ_BODY
+#undef MRMOVQ_BODY
+#undef ALU_BODY
+#undef RET_BODY
+#undef PUSHQ_BODY
+#undef POPQ_BODY
+op_ins:
+    FAULT();
+
+slow:
+    /* single-step whatever is left through the reference interpreter */
+    sim->pc = pc;
+    sim->cc = cc;
+    for (id = 0; id < REG_NONE; id++)
+        if (get_reg_val(sim->r, id) != reg[id])
+            set_reg_val(sim->r, id, reg[id]);
+    for (; left > 0 && e == STAT_AOK; left--)
+        e = nexti(sim);
+    *steps = max_steps - left;
+    return e;
+
+out:
+    sim->pc = pc;
+    sim->cc = cc;
+    for (id = 0; id < REG_NONE; id++)
+        if (get_reg_val(sim->r, id) != reg[id])
+            set_reg_val(sim->r, id, reg[id]);
+    *steps = max_steps - left;
+    return e;
+
+#undef NEXT
+#undef LEAVE
+#undef FAULT
+}
+
+/* a new y64 image loaded from 'binname', or NULL (reported to 'out') */
+y64sim_t *open_binfile(const char *binname, y64cfg_t *cfg, FILE *out)
+{
+    FILE *binfile;
+    y64sim_t *sim;
+
+    binfile = fopen(binname, "rb");
     if (!binfile) {
-        err_print("Can't open binary file '%s'", argv[1]);
-        exit(1);
+        err_print(out, "Can't open binary file '%s'", binname);
+        return NULL;
     }
 
-    sim = new_y64sim(MEM_SIZE);
-    if (load_binfile(sim->m, binfile) < 0) {
-        err_print("Failed to load binary file '%s'", argv[1]);
+    sim = new_y64sim(cfg->mem_size);
+    sim->out = out;
+    if (load_binfile(sim->m, binfile, out) < 0) {
+        err_print(out, "Failed to load binary file '%s'", binname);
+        fclose(binfile);
         free_y64sim(sim);
-        exit(1);
+        return NULL;
     }
     fclose(binfile);
+    return sim;
+}
+
+/*
+ * run_binfile: load a binary, run it and print the report y64sim prints
+ * args
+ *     binname: the binary file
+ *     cfg: engine, step limit and memory size to run with
+ *     out: where the report and any fault messages go
+ *
+ * return
+ *     0: the program ran (whatever its final status)
+ *     -1: the binary could not be loaded
+ */
+int run_binfile(const char *binname, y64cfg_t *cfg, FILE *out)
+{
+    y64sim_t *sim;
+    struct prof *prof = NULL;
+    struct tracer *trace = NULL;
+    int step = 0;
+    stat_t e = STAT_AOK;
 
-    /* save initial register and memory stat */
-    saver = dup_reg(sim->r);
-    savem = dup_mem(sim->m);
+    sim = open_binfile(binname, cfg, out);
+    if (!sim)
+        return -1;
+    if (cfg->trace) {
+        trace = new_trace(cfg->trace, cfg->pack_trace, out);
+        if (!trace) {
+            free_y64sim(sim);
+            return -1;
+        }
+    }
 
-    /* execute binary code step-by-step */
-    for (step = 0; step < max_steps && e == STAT_AOK; step++)
-        e = nexti(sim);
+    /* log every register and memory word from here on, with its old value */
+    track_reg(sim->r);
+    track_mem(sim->m);
+
+    /* execute binary code step-by-step, or block-by-block */
+    if (trace) {
+        e = run_traced(sim, trace, cfg->max_steps, &step);
+        end_trace(trace, out);
+    } else if (cfg->profile) {
+        prof = new_prof();
+        e = run_profiled(sim, prof, cfg->max_steps, &step);
+    } else if (cfg->engine == ENG_JIT)
+        e = run_jit(sim, cfg->max_steps, &step);
+    else if (cfg->engine == ENG_THREADED)
+        e = run_threaded(sim, cfg->max_steps, &step);
+    else
+        for (step = 0; step < cfg->max_steps && e == STAT_AOK; step++)
+            e = nexti(sim);
 
     /* print final stat of y64sim */
-    printf("Stopped in %d steps at PC = 0x%lx.  Status '%s', CC %s\n",
+    fprintf(out, "Stopped in %d steps at PC = 0x%lx.  Status '%s', CC %s\n",
             step, sim->pc, stat_name(e), cc_name(sim->cc));
 
-    printf("Changes to registers:\n");
-    diff_reg(saver, sim->r, stdout);
+    fprintf(out, "Changes to registers:\n");
+    diff_reg_log(sim->r, out);
+
+    fprintf(out, "\nChanges to memory:\n");
+    diff_mem_log(sim->m, out);
+
+    if (cfg->stats) {
+        icache_t *ic = sim->m->icache;
+        long_t lookups = ic->hits + ic->misses;
+        fprintf(out, "\nInstruction cache: %ld hits, %ld misses (%.2f%% hit rate)\n",
+                ic->hits, ic->misses, lookups ? 100.0 * ic->hits / lookups : 0.0);
+        if (sim->bc) {
+            int f;
+            fprintf(out, "Threaded engine: %ld blocks decoded, %ld blocks entered\n",
+                    sim->bc->built, sim->bc->entered);
+            fprintf(out, "Fused pairs run:");
+            for (f = 0; f < FUSE_NUM; f++)
+                fprintf(out, " %s %ld%s", fuse_names[f], sim->bc->fused[f],
+                        f + 1 < FUSE_NUM ? "," : "\n");
+        }
+        if (sim->jit)
+            print_jit_stats(sim->jit, out);
+        if (trace)
+            print_trace_stats(trace, out);
+    }
 
-    printf("\nChanges to memory:\n");
-    diff_mem(savem, sim->m, stdout);
+    if (prof) {
+        print_prof(prof, out);
+        if (cfg->folded) {
+            FILE *f = fopen(cfg->folded, "w");
+            if (f) {
+                print_folded(prof, f);
+                fclose(f);
+            } else {
+                err_print(out, "Can't write folded stacks to '%s'", cfg->folded);
+            }
+        }
+        if (cfg->pcprof) {
+            FILE *f = fopen(cfg->pcprof, "w");
+            if (f) {
+                print_pcs(prof, f);
+                fclose(f);
+            } else {
+                err_print(out, "Can't write the counts at each PC to '%s'", cfg->pcprof);
+            }
+        }
+        free_prof(prof);
+    }
+    if (trace)
+        free_trace(trace);
 
     free_y64sim(sim);
-    free_reg(saver);
-    free_mem(savem);
-
     return 0;
 }
 
@@ -7,9 +7,14 @@
 #include <assert.h>
 
 #define MAX_STEP 10000
+#define CKPT_INTERVAL 10000 /* default steps between checkpoints */
+#define MAX_INSLEN 10
+
+#define ICACHE_SIZE 1024 /* must be a power of 2 */
 
 #define BLK_SIZE 32
 #define MEM_SIZE (1<<13)
+#define MEM_ALL 0        /* new_y64sim(MEM_ALL): every 64-bit address */
 #define REG_SIZE 15*8
 
 typedef unsigned char byte_t;
@@ -42,7 +47,8 @@ typedef struct reg {
 
 /* Y64 Instruction */
 typedef enum { I_HALT = 0, I_NOP, I_RRMOVQ, I_IRMOVQ, I_RMMOVQ, I_MRMOVQ,
-    I_ALU, I_JMP, I_CALL, I_RET, I_PUSHQ, I_POPQ, I_DIRECTIVE } itype_t;
+    I_ALU, I_JMP, I_CALL, I_RET, I_PUSHQ, I_POPQ, I_DIRECTIVE,
+    I_ATOMIC } itype_t;
 
 /* Function code (default) */
 typedef enum { F_NONE } func_t;
@@ -53,6 +59,9 @@ typedef enum { A_ADD, A_SUB, A_AND, A_XOR, A_NONE } alu_t;
 /* Condition code */
 typedef enum { C_YES, C_LE, C_L, C_E, C_NE, C_GE, C_G } cond_t;
 
+/* Atomic code (I_ATOMIC), run by run_cores() only */
+typedef enum { AT_XADD, AT_CMPXCHG } atom_t;
+
 /* Directive code */
 typedef enum { D_DATA, D_POS, D_ALIGN } dtv_t;
 
@@ -67,17 +76,219 @@ typedef enum { D_DATA, D_POS, D_ALIGN } dtv_t;
 #define GET_REGB(byte0) LOW(byte0)
 
 
+/* Predecoded instruction, keyed by the PC it was fetched from */
+typedef struct icache_ent {
+    long_t pc;
+    long_t valC;    /* immediate, displacement or destination */
+    long_t valP;    /* address of the following instruction */
+    itype_t icode;
+    byte_t ifun;
+    regid_t regA;
+    regid_t regB;
+    bool_t valid;
+} icache_ent_t;
+
+/* Direct-mapped decode cache, attached to the memory it decodes from */
+typedef struct icache {
+    icache_ent_t ent[ICACHE_SIZE];
+    long_t lo, hi;  /* [lo, hi) covers every instruction ever cached */
+    long_t gen;     /* bumped on every write into [lo, hi) */
+    long_t hits, misses;
+} icache_t;
+
+/* Sparse memory: pages hang off a PT_LEVELS-deep table, allocated on write */
+#define PAGE_BITS 12
+#define PAGE_SIZE (1<<PAGE_BITS)
+#define PT_BITS 9
+#define PT_SIZE (1<<PT_BITS)
+#define PT_LEVELS 6     /* 12 + 5*9 + 7 = 64 address bits */
+#define TLB_SIZE 16     /* must be a power of 2 */
+#define TLB_EMPTY (~0UL) /* no page has this number */
+
+typedef struct page {
+    int ref;        /* memories sharing the page; copied on write if > 1 */
+    unsigned long dirty[PAGE_SIZE/8/64]; /* words logged since track_mem() */
+    byte_t data[PAGE_SIZE];
+} page_t;
+
+/* A page table; tables, like pages, are shared until written through */
+typedef struct ptab {
+    int ref;
+    void *ent[PT_SIZE]; /* ptab_t below level 0, page_t at level 0 */
+} ptab_t;
+
+/* Recently used pages, so most accesses skip the table walk */
+typedef struct tlb_ent {
+    unsigned long vpn; /* TLB_EMPTY if the entry is unused */
+    page_t *page;
+    bool_t rw;      /* page is private, so it can be written in place */
+} tlb_ent_t;
+
+/* A binary file mapped read-only; its pages are copied in on first touch */
+typedef struct image {
+    int ref;        /* memories loaded from it, or dup_mem()s of those */
+    byte_t *base;
+    long_t len;
+} image_t;
+
+/* First write to a word since track_mem(), with the value it overwrote */
+typedef struct wlog_ent {
+    long_t addr;    /* 8-byte aligned */
+    long_t old;
+} wlog_ent_t;
+
 typedef struct mem {
-    int len;
-    byte_t *data;
+    long_t len;     /* addresses [0, len) are valid; MEM_ALL for all */
+    ptab_t *pt;     /* top-level page table, level PT_LEVELS-1 */
+    tlb_ent_t tlb[TLB_SIZE];
+    wlog_ent_t *log; /* NULL unless writes are being tracked */
+    int nlog, maxlog;
+    icache_t *icache; /* NULL unless instructions are fetched from here */
+    image_t *img;   /* absent pages below img->len hold the image, not 0 */
 } mem_t;
 
+/* TRUE iff all of [addr, addr+n) lies inside the memory */
+static inline bool_t mem_valid(mem_t *m, long_t addr, int n)
+{
+    return m->len == MEM_ALL || (addr >= 0 && addr <= m->len - n);
+}
+
+/* Threaded engine: instructions of a basic block, each with its handler */
+#define BLOCK_CACHE_SIZE 256 /* must be a power of 2 */
+#define MAX_BLOCK_INSNS 32
+
+typedef struct tinsn {
+    void *op;       /* address of the handler */
+    long_t pc;
+    long_t valC;
+    long_t valP;
+    byte_t srcA, srcB; /* register slots read (REG_NONE reads as 0) */
+    byte_t dstA, dstB; /* register slots written (REG_NONE is a sink) */
+    byte_t ifun;
+    byte_t cmask;   /* bit cc set iff the condition holds for that cc */
+} tinsn_t;
+
+typedef struct block {
+    long_t pc;
+    long_t gen;     /* icache generation the block was decoded in */
+    int n;          /* instructions, not counting the trailing OP_END */
+    tinsn_t insn[MAX_BLOCK_INSNS+1];
+} block_t;
+
+/* Adjacent instruction pairs the threaded engine runs as one handler */
+typedef enum { FUSE_IRMOVQ_ADDQ, FUSE_MRMOVQ_RMMOVQ, FUSE_OPQ_JXX,
+    FUSE_PUSHQ_PUSHQ, FUSE_POPQ_POPQ, FUSE_POPQ_RET, FUSE_NUM } fuse_t;
+
+typedef struct bcache {
+    block_t blk[BLOCK_CACHE_SIZE];
+    long_t built, entered;
+    long_t fused[FUSE_NUM]; /* times each fused pair ran */
+} bcache_t;
+
 typedef struct y64sim {
     long_t pc;
     mem_t *r;
     mem_t *m;
     cc_t cc;
+    bcache_t *bc;   /* allocated on first use of the threaded engine */
+    struct jit *jit; /* allocated on first use of the JIT engine */
+    FILE *out;      /* where faults are reported, stdout by default */
 } y64sim_t;
 
+/* How run_binfile() executes a program */
+typedef enum { ENG_STEP, ENG_THREADED, ENG_JIT } engine_t;
+
+typedef struct y64cfg {
+    int max_steps;
+    long_t mem_size;    /* MEM_SIZE, or MEM_ALL */
+    engine_t engine;
+    bool_t stats;       /* append cache and engine statistics */
+    bool_t profile;     /* run profiled on the step engine and report */
+    char *folded;       /* file for the profile's folded stacks, or NULL */
+    char *pcprof;       /* file for its counts at each PC, or NULL */
+    long_t ckpt_interval; /* steps between checkpoints when debugging */
+    char *lanes;        /* inputs file for run_lanes(), or NULL */
+    int cores;          /* cores for run_cores(), or 0 */
+    long_t quantum;     /* steps per turn, round-robin; 0: a thread per core */
+    char *trace;        /* file to record an execution trace in, or NULL */
+    bool_t pack_trace;  /* compress the trace's blocks */
+} y64cfg_t;
+
+/* Y64 Status */
+typedef enum {STAT_AOK, STAT_HLT, STAT_ADR, STAT_INS} stat_t;
+
+/* y64sim.c */
+extern reg_t reg_table[REG_NONE];
+mem_t *init_mem(long_t len);
+void free_mem(mem_t *m);
+mem_t *dup_mem(mem_t *oldm);
+mem_t *share_mem(mem_t *m);
+void unshare_mem(mem_t *v);
+long_t *word_ptr(mem_t *m, long_t addr);
+bool_t diff_mem(mem_t *oldm, mem_t *newm, FILE *outfile);
+void track_mem(mem_t *m);
+bool_t diff_mem_log(mem_t *m, FILE *outfile);
+mem_t *init_reg();
+void free_reg(mem_t *r);
+mem_t *dup_reg(mem_t *oldr);
+bool_t diff_reg(mem_t *oldr, mem_t *newr, FILE *outfile);
+void track_reg(mem_t *r);
+bool_t diff_reg_log(mem_t *r, FILE *outfile);
+y64sim_t *new_y64sim(long_t slen);
+y64sim_t *open_binfile(const char *binname, y64cfg_t *cfg, FILE *out);
+void free_y64sim(y64sim_t *sim);
+int load_binfile(mem_t *m, FILE *f, FILE *out);
+int run_binfile(const char *binname, y64cfg_t *cfg, FILE *out);
+char *stat_name(stat_t e);
+char *cc_name(cc_t c);
+bool_t get_byte_val(mem_t *m, long_t addr, byte_t *dest);
+bool_t set_byte_val(mem_t *m, long_t addr, byte_t val);
+bool_t get_long_val(mem_t *m, long_t addr, long_t *dest);
+bool_t set_long_val(mem_t *m, long_t addr, long_t val);
+long_t get_reg_val(mem_t *r, regid_t id);
+void set_reg_val(mem_t *r, regid_t id, long_t val);
+void get_reg_file(mem_t *r, long_t *reg);
+long_t compute_alu(alu_t op, long_t argA, long_t argB);
+cc_t compute_cc(alu_t op, long_t argA, long_t argB, long_t val);
+byte_t cond_mask(cond_t cond);
+void icache_flush(icache_t *ic);
+bool_t decode(mem_t *m, long_t pc, icache_ent_t *d);
+icache_ent_t *fetch(mem_t *m, long_t pc);
+stat_t nexti(y64sim_t *sim);
+stat_t run_threaded(y64sim_t *sim, int max_steps, int *steps);
+
+/* y64prof.c */
+struct prof *new_prof(void);
+void free_prof(struct prof *p);
+stat_t run_profiled(y64sim_t *sim, struct prof *p, int max_steps, int *steps);
+void print_prof(struct prof *p, FILE *out);
+void print_folded(struct prof *p, FILE *out);
+void print_pcs(struct prof *p, FILE *out);
+
+/* y64rec.c */
+struct tracer *new_trace(const char *name, bool_t packed, FILE *out);
+stat_t run_traced(y64sim_t *sim, struct tracer *t, int max_steps, int *steps);
+int end_trace(struct tracer *t, FILE *out);
+void print_trace_stats(struct tracer *t, FILE *out);
+void free_trace(struct tracer *t);
+
+/* y64ckpt.c */
+struct history *new_history(y64sim_t *sim, long_t interval, engine_t engine);
+void free_history(struct history *h);
+stat_t hist_run(y64sim_t *sim, struct history *h, long_t nsteps);
+stat_t hist_goto(y64sim_t *sim, struct history *h, long_t step);
+int debug_binfile(const char *binname, y64cfg_t *cfg, FILE *in, FILE *out);
+
+/* y64simt.c */
+int run_lanes(const char *binname, y64cfg_t *cfg, FILE *out);
+
+/* y64mc.c */
+int run_cores(const char *binname, y64cfg_t *cfg, FILE *out);
+
+/* y64jit.c */
+stat_t run_jit(y64sim_t *sim, int max_steps, int *steps);
+void free_jit(struct jit *jit);
+void print_jit_stats(struct jit *jit, FILE *out);
+
 #endif
 
@@ -0,0 +1,743 @@
+/*
+ * SIMT engine: many copies (lanes) of one Y64 program, each with its own
+ * inputs, run together.  Every step runs the instruction at the lowest PC
+ * any lane is at, on all the lanes at that PC; lanes elsewhere sit it out
+ * until control flow brings them back together.  Registers, PCs and
+ * condition codes are kept lane by lane in arrays, so on AVX2 hosts moves,
+ * ALU operations and branches run four lanes per instruction.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include "y64sim.h"
+
+#define LANE_VEC 4      /* lanes per AVX2 register */
+#define LANE_MSG 64
+
+#define err_print(_f, _s, _a ...) \
+    fprintf(_f, _s"\n", _a);
+
+typedef struct lanes {
+    int k;              /* lanes in use */
+    int kp;             /* k rounded up to LANE_VEC; the rest never run */
+    long_t max_steps;
+    long_t *pc, *cc, *steps;
+    long_t *live;       /* ~0 while the lane is in the pool and running */
+    long_t *on;         /* ~0 for the lanes the current instruction runs on */
+    long_t *reg[REG_NONE+1]; /* reg[id][lane]; reg[REG_NONE] stays 0 */
+    long_t *reg0[REG_NONE];  /* the registers the lane's inputs set */
+    stat_t *stat;
+    bool_t *solo;       /* its code no longer matches the image: runs alone */
+    int nsolo;          /* lanes made solo by the current step */
+    char (*msg)[LANE_MSG]; /* fault message, "" if none */
+    mem_t *base;        /* the program as loaded; never written */
+    mem_t **m;          /* each lane's memory, a dup_mem() of base */
+    long_t issued;      /* instructions run, counting once per step */
+} lanes_t;
+
+#ifdef __x86_64__
+#define AVX2 __attribute__((target("avx2")))
+static bool_t have_avx2;
+#endif
+
+static void free_lanes(lanes_t *L)
+{
+    int i;
+
+    for (i = 0; i < L->k; i++)
+        free_mem(L->m[i]);
+    free_mem(L->base);
+    free((void *) L->m);
+    free((void *) L->pc);
+    free((void *) L->stat);
+    free((void *) L->solo);
+    free((void *) L->msg);
+    free((void *) L);
+}
+
+/* k lanes, all of them at the start of the program in 'base' */
+static lanes_t *new_lanes(mem_t *base, int k, long_t max_steps)
+{
+    lanes_t *L = (lanes_t *)calloc(1, sizeof(lanes_t));
+    int kp = (k + LANE_VEC - 1) / LANE_VEC * LANE_VEC;
+    long_t *a;
+    int i, id;
+
+    L->k = k;
+    L->kp = kp;
+    L->max_steps = max_steps;
+    /* one block for every per-lane array of longs, 32-byte aligned */
+    a = (long_t *)aligned_alloc(32, (5 + REG_NONE + 1 + REG_NONE) * kp * sizeof(long_t));
+    memset(a, 0, (5 + REG_NONE + 1 + REG_NONE) * kp * sizeof(long_t));
+    L->pc = a;
+    L->cc = a + kp;
+    L->steps = a + 2*kp;
+    L->live = a + 3*kp;
+    L->on = a + 4*kp;
+    for (id = 0; id <= REG_NONE; id++)
+        L->reg[id] = a + (5 + id) * kp;
+    for (id = 0; id < REG_NONE; id++)
+        L->reg0[id] = a + (5 + REG_NONE + 1 + id) * kp;
+
+    L->stat = (stat_t *)calloc(kp, sizeof(stat_t));
+    L->solo = (bool_t *)calloc(kp, sizeof(bool_t));
+    L->msg = (char (*)[LANE_MSG])calloc(kp, LANE_MSG);
+    L->base = base;
+    L->m = (mem_t **)calloc(k, sizeof(mem_t *));
+    for (i = 0; i < kp; i++) {
+        L->cc[i] = DEFAULT_CC;
+        L->stat[i] = STAT_AOK;
+        if (i < k) {
+            L->live[i] = max_steps > 0 ? ~0L : 0;
+            L->m[i] = dup_mem(base);
+        }
+    }
+    return L;
+}
+
+/*
+ * set a lane's inputs from one line: "%reg=value" sets a register and
+ * "addr=value" the 8-byte word at addr, values in C notation
+ * return
+ *     0 on success, -1 on a malformed or out-of-range setting
+ */
+static int set_inputs(lanes_t *L, int i, char *line, FILE *out)
+{
+    char *tok;
+
+    for (tok = strtok(line, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n")) {
+        char *eq = strchr(tok, '='), *end;
+        long_t val;
+        int id;
+
+        if (tok[0] == '#')
+            break;
+        if (!eq || !eq[1]) {
+            err_print(out, "Lane %d: bad input '%s'", i, tok);
+            return -1;
+        }
+        *eq = '\0';
+        val = strtoul(eq + 1, &end, 0);
+        if (*end) {
+            err_print(out, "Lane %d: bad value '%s'", i, eq + 1);
+            return -1;
+        }
+        if (tok[0] == '%') {
+            for (id = 0; id < REG_NONE; id++)
+                if (!strcmp(tok, reg_table[id].name))
+                    break;
+            if (id == REG_NONE) {
+                err_print(out, "Lane %d: no register '%s'", i, tok);
+                return -1;
+            }
+            L->reg[id][i] = L->reg0[id][i] = val;
+        } else {
+            long_t addr = strtoul(tok, &end, 0);
+            if (*end || !set_long_val(L->m[i], addr, val)) {
+                err_print(out, "Lane %d: bad address '%s'", i, tok);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* the lowest PC of a running lane in the pool, LONG_MAX if there is none */
+#ifdef __x86_64__
+static AVX2 long_t min_pc_avx2(lanes_t *L)
+{
+    __m256i none = _mm256_set1_epi64x(LONG_MAX), best = none;
+    long_t v[LANE_VEC], min;
+    int i;
+
+    for (i = 0; i < L->kp; i += LANE_VEC) {
+        __m256i pc = _mm256_load_si256((__m256i *)(L->pc + i));
+        __m256i live = _mm256_load_si256((__m256i *)(L->live + i));
+        __m256i cand = _mm256_blendv_epi8(none, pc, live);
+        best = _mm256_blendv_epi8(best, cand, _mm256_cmpgt_epi64(best, cand));
+    }
+    _mm256_storeu_si256((__m256i *)v, best);
+    for (min = v[0], i = 1; i < LANE_VEC; i++)
+        if (v[i] < min)
+            min = v[i];
+    return min;
+}
+
+/* on = the running lanes at pc */
+static AVX2 void select_avx2(lanes_t *L, long_t pc)
+{
+    __m256i at = _mm256_set1_epi64x(pc);
+    int i;
+
+    for (i = 0; i < L->kp; i += LANE_VEC) {
+        __m256i p = _mm256_load_si256((__m256i *)(L->pc + i));
+        __m256i live = _mm256_load_si256((__m256i *)(L->live + i));
+        _mm256_store_si256((__m256i *)(L->on + i),
+                           _mm256_and_si256(live, _mm256_cmpeq_epi64(p, at)));
+    }
+}
+#endif
+
+static long_t min_pc(lanes_t *L)
+{
+    long_t min = LONG_MAX;
+    int i;
+
+#ifdef __x86_64__
+    if (have_avx2)
+        return min_pc_avx2(L);
+#endif
+    for (i = 0; i < L->k; i++)
+        if (L->live[i] && L->pc[i] < min)
+            min = L->pc[i];
+    return min;
+}
+
+static void select_lanes(lanes_t *L, long_t pc)
+{
+    int i;
+
+#ifdef __x86_64__
+    if (have_avx2) {
+        select_avx2(L, pc);
+        return;
+    }
+#endif
+    for (i = 0; i < L->kp; i++)
+        L->on[i] = L->live[i] & -(long_t)(L->pc[i] == pc);
+}
+
+/*
+ * The register and branch operations, on lanes [lo, hi) where on is set.
+ * A destination of REG_NONE is never written, so it keeps reading as 0.
+ */
+#ifdef __x86_64__
+static AVX2 void irmovq_avx2(lanes_t *L, int lo, int hi, long_t valC, int dst)
+{
+    __m256i c = _mm256_set1_epi64x(valC);
+    int i;
+
+    for (i = lo; i < hi; i += LANE_VEC) {
+        __m256i on = _mm256_load_si256((__m256i *)(L->on + i));
+        __m256i r = _mm256_load_si256((__m256i *)(L->reg[dst] + i));
+        _mm256_store_si256((__m256i *)(L->reg[dst] + i), _mm256_blendv_epi8(r, c, on));
+    }
+}
+
+/* lanes where condition mask 'cmask' holds for their cc, among 'on' */
+static inline AVX2 __m256i cond_avx2(__m256i cc, byte_t cmask, __m256i on)
+{
+    __m256i bits = _mm256_srlv_epi64(_mm256_set1_epi64x(cmask), cc);
+    __m256i one = _mm256_set1_epi64x(1);
+    return _mm256_and_si256(on, _mm256_cmpeq_epi64(_mm256_and_si256(bits, one), one));
+}
+
+static AVX2 void cmovxx_avx2(lanes_t *L, int lo, int hi, byte_t cmask, int src, int dst)
+{
+    int i;
+
+    for (i = lo; i < hi; i += LANE_VEC) {
+        __m256i on = _mm256_load_si256((__m256i *)(L->on + i));
+        __m256i cc = _mm256_load_si256((__m256i *)(L->cc + i));
+        __m256i a = _mm256_load_si256((__m256i *)(L->reg[src] + i));
+        __m256i r = _mm256_load_si256((__m256i *)(L->reg[dst] + i));
+        _mm256_store_si256((__m256i *)(L->reg[dst] + i),
+                           _mm256_blendv_epi8(r, a, cond_avx2(cc, cmask, on)));
+    }
+}
+
+/* as compute_alu() and compute_cc(): OF stays 0, SF is bit 31 */
+static AVX2 void alu_avx2(lanes_t *L, int lo, int hi, int ifun, int src, int dst)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i zf = _mm256_set1_epi64x(PACK_CC(1,0,0));
+    __m256i sf = _mm256_set1_epi64x(PACK_CC(0,1,0));
+    int i;
+
+    for (i = lo; i < hi; i += LANE_VEC) {
+        __m256i on = _mm256_load_si256((__m256i *)(L->on + i));
+        __m256i a = _mm256_load_si256((__m256i *)(L->reg[src] + i));
+        __m256i b = _mm256_load_si256((__m256i *)(L->reg[dst] + i));
+        __m256i cc = _mm256_load_si256((__m256i *)(L->cc + i));
+        __m256i r, z, s;
+
+        switch (ifun) {
+          case A_ADD: r = _mm256_add_epi64(b, a); break;
+          case A_SUB: r = _mm256_sub_epi64(b, a); break;
+          case A_AND: r = _mm256_and_si256(b, a); break;
+          case A_XOR: r = _mm256_xor_si256(b, a); break;
+          default:    r = zero; break;
+        }
+        z = _mm256_and_si256(_mm256_cmpeq_epi64(r, zero), zf);
+        s = _mm256_and_si256(_mm256_cmpgt_epi64(zero, _mm256_slli_epi64(r, 32)), sf);
+        _mm256_store_si256((__m256i *)(L->cc + i),
+                           _mm256_blendv_epi8(cc, _mm256_or_si256(z, s), on));
+        if (dst != REG_NONE)
+            _mm256_store_si256((__m256i *)(L->reg[dst] + i), _mm256_blendv_epi8(b, r, on));
+    }
+}
+
+static AVX2 void jxx_avx2(lanes_t *L, int lo, int hi, byte_t cmask, long_t valC, long_t valP)
+{
+    __m256i taken = _mm256_set1_epi64x(valC), next = _mm256_set1_epi64x(valP);
+    int i;
+
+    for (i = lo; i < hi; i += LANE_VEC) {
+        __m256i on = _mm256_load_si256((__m256i *)(L->on + i));
+        __m256i cc = _mm256_load_si256((__m256i *)(L->cc + i));
+        __m256i pc = _mm256_load_si256((__m256i *)(L->pc + i));
+        __m256i to = _mm256_blendv_epi8(next, taken, cond_avx2(cc, cmask, on));
+        _mm256_store_si256((__m256i *)(L->pc + i), _mm256_blendv_epi8(pc, to, on));
+    }
+}
+
+/* pc = valP on the lanes still running; count the step on all of them */
+static AVX2 void retire_avx2(lanes_t *L, int lo, int hi, long_t valP)
+{
+    __m256i next = _mm256_set1_epi64x(valP), one = _mm256_set1_epi64x(1);
+    __m256i max = _mm256_set1_epi64x(L->max_steps);
+    int i;
+
+    for (i = lo; i < hi; i += LANE_VEC) {
+        __m256i on = _mm256_load_si256((__m256i *)(L->on + i));
+        __m256i live = _mm256_load_si256((__m256i *)(L->live + i));
+        __m256i pc = _mm256_load_si256((__m256i *)(L->pc + i));
+        __m256i steps = _mm256_load_si256((__m256i *)(L->steps + i));
+        if (valP != -1)
+            _mm256_store_si256((__m256i *)(L->pc + i),
+                               _mm256_blendv_epi8(pc, next, _mm256_and_si256(on, live)));
+        steps = _mm256_add_epi64(steps, _mm256_and_si256(on, one));
+        _mm256_store_si256((__m256i *)(L->steps + i), steps);
+        _mm256_store_si256((__m256i *)(L->live + i),
+                           _mm256_andnot_si256(_mm256_cmpeq_epi64(steps, max), live));
+    }
+}
+#endif
+
+static void irmovq(lanes_t *L, int lo, int hi, long_t valC, int dst)
+{
+    int i;
+
+    if (dst == REG_NONE)
+        return;
+#ifdef __x86_64__
+    if (have_avx2) {
+        irmovq_avx2(L, lo, hi, valC, dst);
+        return;
+    }
+#endif
+    for (i = lo; i < hi; i++)
+        if (L->on[i])
+            L->reg[dst][i] = valC;
+}
+
+static void cmovxx(lanes_t *L, int lo, int hi, byte_t cmask, int src, int dst)
+{
+    int i;
+
+    if (dst == REG_NONE)
+        return;
+#ifdef __x86_64__
+    if (have_avx2) {
+        cmovxx_avx2(L, lo, hi, cmask, src, dst);
+        return;
+    }
+#endif
+    for (i = lo; i < hi; i++)
+        if (L->on[i] && (cmask >> L->cc[i] & 1))
+            L->reg[dst][i] = L->reg[src][i];
+}
+
+static void alu(lanes_t *L, int lo, int hi, int ifun, int src, int dst)
+{
+    int i;
+
+#ifdef __x86_64__
+    if (have_avx2) {
+        alu_avx2(L, lo, hi, ifun, src, dst);
+        return;
+    }
+#endif
+    for (i = lo; i < hi; i++) {
+        long_t a, b, r;
+        if (!L->on[i])
+            continue;
+        a = L->reg[src][i];
+        b = L->reg[dst][i];
+        r = compute_alu(ifun, a, b);
+        L->cc[i] = compute_cc(ifun, a, b, r);
+        if (dst != REG_NONE)
+            L->reg[dst][i] = r;
+    }
+}
+
+static void jxx(lanes_t *L, int lo, int hi, byte_t cmask, long_t valC, long_t valP)
+{
+    int i;
+
+#ifdef __x86_64__
+    if (have_avx2) {
+        jxx_avx2(L, lo, hi, cmask, valC, valP);
+        return;
+    }
+#endif
+    for (i = lo; i < hi; i++)
+        if (L->on[i])
+            L->pc[i] = (cmask >> L->cc[i] & 1) ? valC : valP;
+}
+
+/*
+ * finish a step on lanes [lo, hi): those still running go on to valP
+ * (unless it is -1, for instructions that set pc themselves), all of them
+ * count the step, and lanes out of steps or made solo leave the pool
+ */
+static void retire(lanes_t *L, int lo, int hi, long_t valP)
+{
+    int i;
+
+#ifdef __x86_64__
+    if (have_avx2)
+        retire_avx2(L, lo, hi, valP);
+    else
+#endif
+    for (i = lo; i < hi; i++) {
+        if (!L->on[i])
+            continue;
+        if (valP != -1 && L->live[i])
+            L->pc[i] = valP;
+        if (++L->steps[i] == L->max_steps)
+            L->live[i] = 0;
+    }
+    if (L->nsolo) {
+        for (i = lo; i < hi; i++)
+            if (L->on[i] && L->solo[i])
+                L->live[i] = 0;
+        L->nsolo = 0;
+    }
+}
+
+/* lane i stops with status e, its message formatted like nexti()'s */
+#define FAULT(L, i, e, _s, _a...) do { \
+        snprintf((L)->msg[i], LANE_MSG, _s, _a); \
+        (L)->stat[i] = (e); \
+        (L)->live[i] = 0; \
+    } while (0)
+
+/* a store by lane i; one that may hit decoded code makes the lane solo */
+static bool_t lane_store(lanes_t *L, int i, long_t addr, long_t val)
+{
+    icache_t *ic = L->base->icache;
+
+    if (!set_long_val(L->m[i], addr, val))
+        return FALSE;
+    if (addr < ic->hi && addr + 8 > ic->lo && !L->solo[i]) {
+        L->solo[i] = TRUE;
+        L->nsolo++;
+    }
+    return TRUE;
+}
+
+/*
+ * step: run instruction d on the lanes of [lo, hi) that have 'on' set,
+ *     exactly as nexti() would run it on each of them
+ */
+static void step(lanes_t *L, icache_ent_t *d, int lo, int hi)
+{
+    long_t *rsp = L->reg[REG_RSP];
+    long_t val;
+    int i;
+
+    L->issued++;
+    if (!d) {
+        for (i = lo; i < hi; i++)
+            if (L->on[i])
+                FAULT(L, i, STAT_ADR, "PC = 0x%lx, Invalid instruction address", L->pc[i]);
+        retire(L, lo, hi, -1);
+        return;
+    }
+
+    switch (d->icode) {
+      case I_HALT:
+        for (i = lo; i < hi; i++)
+            if (L->on[i]) {
+                L->stat[i] = STAT_HLT;
+                L->live[i] = 0;
+            }
+        break;
+      case I_NOP:
+        break;
+      case I_RRMOVQ:
+        cmovxx(L, lo, hi, cond_mask(d->ifun), d->regA, d->regB);
+        break;
+      case I_IRMOVQ:
+        irmovq(L, lo, hi, d->valC, d->regB);
+        break;
+      case I_RMMOVQ:
+        for (i = lo; i < hi; i++)
+            if (L->on[i])
+                lane_store(L, i, L->reg[d->regB][i] + d->valC, L->reg[d->regA][i]);
+        break;
+      case I_MRMOVQ:
+        for (i = lo; i < hi; i++) {
+            long_t addr = L->reg[d->regB][i] + d->valC;
+            if (!L->on[i])
+                continue;
+            if (!get_long_val(L->m[i], addr, &val))
+                FAULT(L, i, STAT_ADR, "PC = 0x%lx, Invalid data address 0x%lx",
+                      L->pc[i], addr);
+            else if (d->regA != REG_NONE)
+                L->reg[d->regA][i] = val;
+        }
+        break;
+      case I_ALU:
+        alu(L, lo, hi, d->ifun, d->regA, d->regB);
+        break;
+      case I_JMP:
+        jxx(L, lo, hi, cond_mask(d->ifun), d->valC, d->valP);
+        retire(L, lo, hi, -1);
+        return;
+      case I_CALL:
+        for (i = lo; i < hi; i++) {
+            if (!L->on[i])
+                continue;
+            rsp[i] -= 8;
+            lane_store(L, i, rsp[i], d->valP);
+            if (!get_long_val(L->m[i], rsp[i], &val))
+                FAULT(L, i, STAT_ADR, "PC = 0x%lx, Invalid stack address 0x%lx",
+                      L->pc[i], rsp[i]);
+            else
+                L->pc[i] = d->valC;
+        }
+        retire(L, lo, hi, -1);
+        return;
+      case I_RET:
+        for (i = lo; i < hi; i++) {
+            if (!L->on[i])
+                continue;
+            if (!get_long_val(L->m[i], rsp[i], &val)) {
+                FAULT(L, i, STAT_ADR, "PC = 0x%lx, Invalid instruction address",
+                      L->pc[i]);
+                continue;
+            }
+            rsp[i] += 8;
+            L->pc[i] = val;
+        }
+        retire(L, lo, hi, -1);
+        return;
+      case I_PUSHQ:
+        for (i = lo; i < hi; i++) {
+            long_t v = L->reg[d->regA][i];
+            if (!L->on[i])
+                continue;
+            rsp[i] -= 8;
+            if (!get_long_val(L->m[i], rsp[i], &val)) {
+                FAULT(L, i, STAT_ADR, "PC = 0x%lx, Invalid stack address 0x%lx",
+                      L->pc[i], rsp[i]);
+                continue;
+            }
+            lane_store(L, i, rsp[i], v);
+        }
+        break;
+      case I_POPQ:
+        for (i = lo; i < hi; i++) {
+            if (!L->on[i])
+                continue;
+            if (!get_long_val(L->m[i], rsp[i], &val)) {
+                FAULT(L, i, STAT_ADR, "PC = 0x%lx, Invalid instruction address",
+                      L->pc[i]);
+                continue;
+            }
+            rsp[i] += 8;
+            if (d->regA != REG_NONE)
+                L->reg[d->regA][i] = val;
+        }
+        break;
+      default:
+        for (i = lo; i < hi; i++)
+            if (L->on[i])
+                FAULT(L, i, STAT_INS, "PC = 0x%lx, Invalid instruction %.2x",
+                      L->pc[i], HPACK(d->icode, d->ifun));
+        retire(L, lo, hi, -1);
+        return;
+    }
+    retire(L, lo, hi, d->icode == I_HALT ? -1 : d->valP);
+}
+
+/*
+ * the pool decodes from base: when it first decodes the instruction at
+ * pc, lanes whose own bytes there differ (their inputs or stores changed
+ * them) go solo
+ */
+static void check_code(lanes_t *L, long_t pc, icache_ent_t *d)
+{
+    long_t end = d ? d->valP : pc + MAX_INSLEN;
+    long_t a;
+    int i;
+
+    for (i = 0; i < L->k; i++) {
+        if (!L->live[i])
+            continue;
+        for (a = pc; a < end; a++) {
+            byte_t mine = 0, theirs = 0;
+            bool_t ok1 = get_byte_val(L->m[i], a, &mine);
+            bool_t ok2 = get_byte_val(L->base, a, &theirs);
+            if (ok1 != ok2 || mine != theirs) {
+                L->solo[i] = TRUE;
+                L->live[i] = 0;
+                break;
+            }
+        }
+    }
+}
+
+/* run lane i on its own, decoding from its own memory, to the end */
+static void run_solo(lanes_t *L, int i)
+{
+    int lo = i / LANE_VEC * LANE_VEC;
+    icache_ent_t d;
+
+    memset(L->on + lo, 0, LANE_VEC * sizeof(long_t));
+    L->on[i] = ~0L;
+    while (L->stat[i] == STAT_AOK && L->steps[i] < L->max_steps) {
+        L->live[i] = ~0L;
+        step(L, decode(L->m[i], L->pc[i], &d) ? &d : NULL, lo, lo + LANE_VEC);
+    }
+    L->live[i] = 0;
+}
+
+/* run every lane until it halts, faults or runs out of steps */
+static void run_pool(lanes_t *L)
+{
+    icache_t *ic = L->base->icache;
+    long_t pc;
+    int i;
+
+    while ((pc = min_pc(L)) != LONG_MAX) {
+        long_t misses = ic->misses;
+        icache_ent_t *d = fetch(L->base, pc);
+
+        if (ic->misses != misses) {
+            check_code(L, pc, d);
+            if (min_pc(L) != pc)
+                continue;
+        }
+        select_lanes(L, pc);
+        step(L, d, 0, L->kp);
+    }
+    for (i = 0; i < L->k; i++)
+        if (L->solo[i])
+            run_solo(L, i);
+}
+
+static void print_lane(lanes_t *L, int i, FILE *out)
+{
+    int id;
+
+    fprintf(out, "Lane %d:\n", i);
+    if (L->msg[i][0])
+        fprintf(out, "%s\n", L->msg[i]);
+    fprintf(out, "Stopped in %ld steps at PC = 0x%lx.  Status '%s', CC %s\n",
+            L->steps[i], L->pc[i], stat_name(L->stat[i]), cc_name(L->cc[i]));
+
+    fprintf(out, "Changes to registers:\n");
+    for (id = 0; id < REG_NONE; id++)
+        if (L->reg[id][i] != L->reg0[id][i])
+            fprintf(out, "%s:\t0x%.16lx\t0x%.16lx\n", reg_table[id].name,
+                    L->reg0[id][i], L->reg[id][i]);
+
+    fprintf(out, "\nChanges to memory:\n");
+    diff_mem_log(L->m[i], out);
+}
+
+/*
+ * run_lanes: run a binary once per line of cfg->lanes, all together, and
+ *     print each run's report as y64sim would print it
+ * args
+ *     binname: the binary file
+ *     cfg: step limit, memory size, inputs file and whether to print stats
+ *     out: where the reports and any errors go
+ *
+ * Each line of the inputs file is one lane, set up with the registers
+ * and memory words it lists, e.g. "%rdi=0x100 0x100=5"; '#' starts a
+ * comment.  A lane's report shows its changes from that starting state.
+ *
+ * return
+ *     0: the lanes ran
+ *     -1: the binary or the inputs could not be loaded
+ */
+int run_lanes(const char *binname, y64cfg_t *cfg, FILE *out)
+{
+    FILE *f;
+    y64sim_t *sim;
+    lanes_t *L;
+    char line[4096];
+    char **lines = NULL;
+    int k = 0, max = 0, i;
+    int ret = 0;
+
+    f = fopen(cfg->lanes, "r");
+    if (!f) {
+        err_print(out, "Can't open inputs file '%s'", cfg->lanes);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#')
+            continue;
+        if (k == max) {
+            max = max ? 2 * max : 64;
+            lines = (char **)realloc(lines, max * sizeof(char *));
+        }
+        lines[k++] = strdup(line);
+    }
+    fclose(f);
+    if (!k) {
+        err_print(out, "No lanes in '%s'", cfg->lanes);
+        free((void *) lines);
+        return -1;
+    }
+
+    sim = open_binfile(binname, cfg, out);
+    if (!sim) {
+        for (i = 0; i < k; i++)
+            free(lines[i]);
+        free((void *) lines);
+        return -1;
+    }
+#ifdef __x86_64__
+    have_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+    /* take the program's memory; base keeps its icache for the pool */
+    L = new_lanes(sim->m, k, cfg->max_steps);
+    sim->m = NULL;
+    for (i = 0; i < k && !ret; i++) {
+        ret = set_inputs(L, i, lines[i], out);
+        track_mem(L->m[i]);
+    }
+    for (i = 0; i < k; i++)
+        free(lines[i]);
+    free((void *) lines);
+
+    if (!ret) {
+        run_pool(L);
+        for (i = 0; i < k; i++)
+            print_lane(L, i, out);
+        if (cfg->stats) {
+            long_t total = 0;
+            for (i = 0; i < k; i++)
+                total += L->steps[i];
+            fprintf(out, "\nSIMT: %d lanes, %ld lane steps in %ld issues (%.2f lanes per issue)\n",
+                    k, total, L->issued, L->issued ? (double)total / L->issued : 0.0);
+        }
+    }
+
+    free_lanes(L);
+    free_reg(sim->r);
+    free((void *) sim);
+    return ret;
+}
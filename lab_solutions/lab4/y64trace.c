@@ -0,0 +1,273 @@
+/*
+ * Reader of the execution traces y64sim -T records: a summary of the
+ * trace, or the steps from a given one on, found through the block index
+ * without decoding what comes before that step's block
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "y64sim.h"
+#include "y64trace.h"
+
+#define err_print(_f, _s, _a ...) \
+    fprintf(_f, _s"\n", _a);
+
+typedef struct reader {
+    FILE *f;
+    const char *name;
+    trace_hdr_t hdr;
+    trace_tail_t tail;
+    trace_idx_t *idx;
+    byte_t *raw, *pack;
+    trace_blk_t blk;    /* the block being decoded */
+    long_t bi;          /* its number */
+    const byte_t *p, *end; /* its records left */
+    long_t step;        /* step of the next record */
+    long_t pc, addr, val;
+    long_t reg[REG_NONE];
+    cc_t cc;
+} reader_t;
+
+/* One step, decoded */
+typedef struct rec {
+    long_t step;
+    long_t pc;
+    int nreg;
+    regid_t id[3];
+    bool_t store;
+    long_t addr, val;
+    bool_t ccset;
+    stat_t stat;
+} rec_t;
+
+void usage(char *pname)
+{
+    printf("Usage: %s file.trace [step [count]]\n", pname);
+    printf("   with no step, summarize the trace; otherwise print the registers\n"
+           "   before 'step' and 'count' steps from it (default 1)\n");
+    exit(0);
+}
+
+static void close_reader(reader_t *r)
+{
+    fclose(r->f);
+    free((void *) r->idx);
+    free((void *) r->raw);
+    free((void *) r->pack);
+    free((void *) r);
+}
+
+/* open a trace and read its index, or return NULL (reported to 'out') */
+static reader_t *open_reader(const char *name, FILE *out)
+{
+    reader_t *r = (reader_t *)calloc(1, sizeof(reader_t));
+
+    r->name = name;
+    r->f = fopen(name, "rb");
+    if (!r->f) {
+        err_print(out, "Can't open trace file '%s'", name);
+        free((void *) r);
+        return NULL;
+    }
+    if (fread(&r->hdr, sizeof(r->hdr), 1, r->f) != 1 ||
+        memcmp(r->hdr.magic, TRACE_MAGIC, sizeof(r->hdr.magic)) ||
+        r->hdr.version != TRACE_VERSION ||
+        fseek(r->f, -(long)sizeof(r->tail), SEEK_END) ||
+        fread(&r->tail, sizeof(r->tail), 1, r->f) != 1 ||
+        memcmp(r->tail.magic, TRACE_IDX_MAGIC, sizeof(TRACE_IDX_MAGIC)) ||
+        r->tail.nblocks < 0 ||
+        fseek(r->f, r->tail.idx_off, SEEK_SET)) {
+        err_print(out, "'%s' is not a complete trace", name);
+        close_reader(r);
+        return NULL;
+    }
+    r->idx = (trace_idx_t *)malloc(r->tail.nblocks * sizeof(trace_idx_t) + 1);
+    if (fread(r->idx, sizeof(trace_idx_t), r->tail.nblocks, r->f) != r->tail.nblocks) {
+        err_print(out, "Can't read the index of '%s'", name);
+        close_reader(r);
+        return NULL;
+    }
+    /* zeros past the records stop a corrupt last one from running off */
+    r->raw = (byte_t *)calloc(1, TRACE_BLOCK + TRACE_MAX_REC);
+    r->pack = (byte_t *)malloc(TRACE_PACK_MAX(TRACE_BLOCK));
+    r->bi = -1;
+    return r;
+}
+
+/* read block 'bi' header only, into b */
+static bool_t read_blk(reader_t *r, long_t bi, trace_blk_t *b)
+{
+    return !fseek(r->f, r->idx[bi].off, SEEK_SET) &&
+        fread(b, sizeof(*b), 1, r->f) == 1 &&
+        b->raw_len <= TRACE_BLOCK && b->len <= b->raw_len;
+}
+
+/* make block 'bi' the one being decoded, from its first record */
+static bool_t load_block(reader_t *r, long_t bi)
+{
+    trace_blk_t *b = &r->blk;
+    byte_t *data;
+
+    if (!read_blk(r, bi, b))
+        return FALSE;
+    data = b->len < b->raw_len ? r->pack : r->raw;
+    if (fread(data, 1, b->len, r->f) != b->len)
+        return FALSE;
+    if (b->len < b->raw_len &&
+        trace_unpack(r->pack, b->len, r->raw, TRACE_BLOCK) != b->raw_len)
+        return FALSE;
+
+    r->bi = bi;
+    r->p = r->raw;
+    r->end = r->raw + b->raw_len;
+    r->step = b->step;
+    r->pc = r->addr = r->val = 0;
+    memcpy(r->reg, b->reg, sizeof(r->reg));
+    r->cc = b->cc;
+    return TRUE;
+}
+
+/*
+ * next_rec: decode the next step into rec, moving on to the next block
+ *     when this one runs out
+ * return
+ *     1: decoded, 0: the trace has ended, -1: the trace is corrupt
+ */
+static int next_rec(reader_t *r, rec_t *rec)
+{
+    long_t v;
+    byte_t tag;
+    int i;
+
+    while (r->p == r->end) {
+        if (r->bi + 1 >= r->tail.nblocks)
+            return 0;
+        if (!load_block(r, r->bi + 1))
+            return -1;
+    }
+
+    tag = *r->p++;
+    rec->step = r->step++;
+    r->p = get_varint(r->p, &v);
+    r->pc += v;
+    rec->pc = r->pc;
+    rec->nreg = TR_NREG(tag);
+    for (i = 0; i < rec->nreg; i++) {
+        regid_t id = *r->p++;
+        if (!NORM_REG(id))
+            return -1;
+        r->p = get_varint(r->p, &v);
+        r->reg[id] += v;
+        rec->id[i] = id;
+    }
+    rec->store = (tag & TR_STORE) != 0;
+    if (rec->store) {
+        r->p = get_varint(r->p, &v);
+        r->addr += v;
+        r->p = get_varint(r->p, &v);
+        r->val += v;
+        rec->addr = r->addr;
+        rec->val = r->val;
+    }
+    rec->ccset = (tag & TR_CC) != 0;
+    if (rec->ccset)
+        r->cc = *r->p++;
+    rec->stat = TR_STAT(tag);
+    return r->p <= r->end ? 1 : -1;
+}
+
+static void print_rec(reader_t *r, rec_t *rec, FILE *out)
+{
+    int i;
+
+    fprintf(out, "Step %ld: PC = 0x%lx\n", rec->step, rec->pc);
+    for (i = 0; i < rec->nreg; i++)
+        fprintf(out, "    %s:\t0x%.16lx\n", reg_table[rec->id[i]].name, r->reg[rec->id[i]]);
+    if (rec->store)
+        fprintf(out, "    0x%.16lx:\t0x%.16lx\n", rec->addr, rec->val);
+    if (rec->ccset)
+        fprintf(out, "    CC %s\n", cc_name(r->cc));
+    if (rec->stat != STAT_AOK)
+        fprintf(out, "    Status '%s'\n", stat_name(rec->stat));
+}
+
+static int summarize(reader_t *r, FILE *out)
+{
+    trace_blk_t b;
+    long_t raw = 0, len = 0, bi;
+
+    for (bi = 0; bi < r->tail.nblocks; bi++) {
+        if (!read_blk(r, bi, &b)) {
+            err_print(out, "Block %ld of '%s' is corrupt", bi, r->name);
+            return -1;
+        }
+        raw += b.raw_len;
+        len += b.len;
+    }
+    fprintf(out, "%ld steps in %ld blocks%s: %ld bytes of records, %ld stored (%.2f bytes per step)\n",
+            r->tail.nsteps, r->tail.nblocks,
+            r->hdr.flags & TRACE_PACKED ? ", packed" : "", raw, len,
+            r->tail.nsteps ? (double)len / r->tail.nsteps : 0.0);
+    return 0;
+}
+
+/* print the state before 'step', then 'count' steps from it */
+static int show(reader_t *r, long_t step, long_t count, FILE *out)
+{
+    long_t lo = 0, hi = r->tail.nblocks - 1;
+    rec_t rec;
+    int id, ok = 1;
+
+    if (step < 0 || step >= r->tail.nsteps) {
+        err_print(out, "Step %ld is not in the trace (%ld steps)", step, r->tail.nsteps);
+        return -1;
+    }
+    /* the last block starting at or before step */
+    while (lo < hi) {
+        long_t mid = (lo + hi + 1) / 2;
+        if (r->idx[mid].step <= step)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    if (!load_block(r, lo))
+        ok = -1;
+    while (ok == 1 && r->step < step)
+        ok = next_rec(r, &rec);
+
+    if (ok == 1) {
+        fprintf(out, "Before step %ld: CC %s\n", step, cc_name(r->cc));
+        for (id = 0; id < REG_NONE; id++)
+            fprintf(out, "    %s:\t0x%.16lx\n", reg_table[id].name, r->reg[id]);
+    }
+    for (; ok == 1 && count > 0; count--) {
+        ok = next_rec(r, &rec);
+        if (ok == 1)
+            print_rec(r, &rec, out);
+    }
+    if (ok < 0) {
+        err_print(out, "'%s' is corrupt near step %ld", r->name, r->step);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    reader_t *r;
+    int ret;
+
+    if (argc < 2 || argc > 4)
+        usage(argv[0]);
+
+    r = open_reader(argv[1], stdout);
+    if (!r)
+        exit(1);
+    if (argc == 2)
+        ret = summarize(r, stdout);
+    else
+        ret = show(r, atol(argv[2]), argc > 3 ? atol(argv[3]) : 1, stdout);
+    close_reader(r);
+    return ret < 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * Execution trace files, written by y64sim -T and read by y64trace.
+ *
+ * A trace is a file header, then blocks, then an index of the blocks and
+ * a trailer.  Each block is a trace_blk_t and its records, one record
+ * per step, packed with trace_pack() if the header's flags say so.  The
+ * block header holds the full register file, so that decoding can start
+ * at any block.
+ *
+ * A record is a tag byte (TR_*), then
+ *     the PC of the step, as a delta from the previous step's PC;
+ *     for each register that changed, its id byte and the delta of its
+ *     value;
+ *     for a store, the deltas of its address and value from the previous
+ *     store's;
+ *     the new condition codes, if they changed.
+ * Every delta is a zigzag varint.  In each block PC and store deltas
+ * start from 0, and register deltas from the block header.
+ */
+
+#ifndef _Y64_TRACE_
+#define _Y64_TRACE_
+
+#include <stdint.h>
+
+#include "y64sim.h"
+
+#define TRACE_MAGIC "Y64TRACE"
+#define TRACE_IDX_MAGIC "Y64TIDX"
+#define TRACE_VERSION 1
+#define TRACE_PACKED 1          /* file flag: blocks are packed, where that helps */
+
+#define TRACE_BLOCK (64*1024)   /* record bytes per block, at most */
+#define TRACE_MAX_REC 64        /* bytes one record can take */
+#define TRACE_PACK_MAX(n) ((n) + (n)/255 + 16) /* trace_pack() output bound */
+
+/* Record tag: registers changed, then flags */
+#define TR_NREG(tag) ((tag) & 3)
+#define TR_STORE 0x04
+#define TR_CC 0x08
+#define TR_STAT(tag) (((tag) >> 4) & 3) /* status the step ended with */
+
+typedef struct trace_hdr {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+} trace_hdr_t;
+
+typedef struct trace_blk {
+    long_t step;            /* the first step recorded in the block */
+    long_t reg[REG_NONE];   /* the registers before that step */
+    uint32_t cc;            /* and the condition codes */
+    uint32_t nsteps;
+    uint32_t raw_len;       /* bytes of records */
+    uint32_t len;           /* bytes that follow; less than raw_len if packed */
+} trace_blk_t;
+
+typedef struct trace_idx {
+    long_t step;            /* first step of the block */
+    long_t off;             /* file offset of its trace_blk_t */
+} trace_idx_t;
+
+typedef struct trace_tail {
+    long_t idx_off;         /* file offset of the trace_idx_t array */
+    long_t nblocks;
+    long_t nsteps;
+    char magic[8];
+} trace_tail_t;
+
+static inline byte_t *put_varint(byte_t *p, long_t v)
+{
+    unsigned long z = ((unsigned long)v << 1) ^ (unsigned long)(v >> 63);
+
+    while (z >= 0x80) {
+        *p++ = (byte_t)(z | 0x80);
+        z >>= 7;
+    }
+    *p++ = (byte_t)z;
+    return p;
+}
+
+static inline const byte_t *get_varint(const byte_t *p, long_t *v)
+{
+    unsigned long z = 0;
+    int shift = 0;
+
+    while (*p & 0x80) {
+        z |= (unsigned long)(*p++ & 0x7F) << shift;
+        shift += 7;
+    }
+    z |= (unsigned long)*p++ << shift;
+    *v = (long_t)(z >> 1) ^ -(long_t)(z & 1);
+    return p;
+}
+
+/* y64rec.c */
+int trace_pack(const byte_t *src, int n, byte_t *dst);
+int trace_unpack(const byte_t *src, int n, byte_t *dst, int cap);
+
+#endif
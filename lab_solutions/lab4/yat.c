@@ -7,6 +7,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "y64sim.h"
+
+#define MAX_THREADS 64
+#define MAX_TESTS 64
 
 static int make_y64sim()
 {   
@@ -16,59 +23,143 @@ static int make_y64sim()
 #define COMMAND_BUFFER_SIZE 1024
 static char cmdbuf[COMMAND_BUFFER_SIZE];
 
-static int make_app_stu(const char *name,int steps)
+// one test case: the reference output is produced by y64sim-base, ours
+// by running the simulator library in-process; nothing touches the disk
+typedef struct test {
+    const char *name;
+    const char *dir;    // where our binary lives
+    int steps;
+    int pass;
+    char *report;       // diff of the two outputs, printed after the run
+    size_t report_len;
+} test_t;
+
+// run the reference tools in y64-base and collect what they print
+static char *get_base_output(const char *name, int steps, size_t *len)
 {
-	if(steps)
-		sprintf(cmdbuf, "cd y64-app-bin; ../y64sim %s.bin %d > %s.sim", name,steps,name);
-	else
-		sprintf(cmdbuf, "cd y64-app-bin; ../y64sim %s.bin > %s.sim", name,name);
-    
-    return system(cmdbuf);
+    char cmd[COMMAND_BUFFER_SIZE];
+    char buf[4096];
+    FILE *pipe, *out;
+    char *text;
+    size_t n;
+
+    if (steps)
+        sprintf(cmd, "cd y64-base; ./y64asm-base %s.ys >&2; ./y64sim-base %s.bin %d", name, name, steps);
+    else
+        sprintf(cmd, "cd y64-base; ./y64asm-base %s.ys >&2; ./y64sim-base %s.bin", name, name);
+
+    pipe = popen(cmd, "r");
+    if (!pipe)
+        return NULL;
+    out = open_memstream(&text, len);
+    while ((n = fread(buf, 1, sizeof(buf), pipe)) > 0)
+        fwrite(buf, 1, n, out);
+    fclose(out);
+    if (pclose(pipe)) {
+        free(text);
+        return NULL;
+    }
+    return text;
 }
 
-static int make_app_base(const char *name,int steps)
+// run dir/name.bin on the library, exactly as "../y64sim name.bin" would
+static char *get_stu_output(const char *dir, const char *name, int steps, size_t *len)
 {
-	if(steps)
-		sprintf(cmdbuf, "cd y64-base; ./y64asm-base %s.ys; ./y64sim-base %s.bin %d > %s.sim.base", name,name,steps,name);
-	else
-		sprintf(cmdbuf, "cd y64-base; ./y64asm-base %s.ys; ./y64sim-base %s.bin > %s.sim.base",name,name,name);
-    
-    return system(cmdbuf);
+    char path[COMMAND_BUFFER_SIZE];
+    y64cfg_t cfg = { steps ? steps : MAX_STEP, MEM_SIZE, ENG_STEP, FALSE };
+    FILE *out;
+    char *text;
+    int ret;
+
+    sprintf(path, "%s/%s.bin", dir, name);
+    out = open_memstream(&text, len);
+    ret = run_binfile(path, &cfg, out);
+    fclose(out);
+    if (ret < 0) {
+        free(text);
+        return NULL;
+    }
+    return text;
 }
 
-static int diff_app(const char *name)
+// print the lines where the two outputs disagree, in diff's notation
+static void diff_output(const char *base, const char *stu, FILE *out)
 {
-    sprintf(cmdbuf, " diff ./y64-base/%s.sim.base ./y64-app-bin/%s.sim", name, name);
-    
-    return system(cmdbuf);
+    int line = 0;
+
+    while (*base || *stu) {
+        size_t bl = strcspn(base, "\n");
+        size_t sl = strcspn(stu, "\n");
+
+        line++;
+        if (bl != sl || strncmp(base, stu, bl)) {
+            fprintf(out, "%dc%d\n", line, line);
+            fprintf(out, "< %.*s\n---\n> %.*s\n", (int)bl, base, (int)sl, stu);
+        }
+        base += bl + (base[bl] == '\n');
+        stu += sl + (stu[sl] == '\n');
+    }
 }
 
-static int make_ins_stu(const char *name,int steps)
+static void run_test(test_t *t)
 {
-	if(steps){
-    		sprintf(cmdbuf, "cd y64-ins-bin; ../y64sim %s.bin %d > %s.sim", name,steps,name);
-	}
-	else
-		sprintf(cmdbuf, "cd y64-ins-bin; make %s.sim > /dev/null", name);
-   
-    return system(cmdbuf);
+    size_t blen, slen;
+    char *base = get_base_output(t->name, t->steps, &blen);
+    char *stu = get_stu_output(t->dir, t->name, t->steps, &slen);
+    FILE *out = open_memstream(&t->report, &t->report_len);
+
+    if (base && stu) {
+        t->pass = blen == slen && !memcmp(base, stu, blen);
+        if (!t->pass)
+            diff_output(base, stu, out);
+    } else {
+        t->pass = 0;
+    }
+    fclose(out);
+    free(base);
+    free(stu);
 }
 
-static int make_ins_base(const char *name,int steps)
+// worker pool: each thread keeps taking the next test until none is left
+typedef struct pool {
+    test_t *tests;
+    int ntests;
+    int next;
+    pthread_mutex_t lock;
+} pool_t;
+
+static void *worker(void *arg)
 {
-	if(steps)
-  		sprintf(cmdbuf, "cd y64-base; ./y64asm-base %s.ys; ./y64sim-base %s.bin %d > %s.sim.base", name, name,steps,name);
-	else
-		sprintf(cmdbuf, "cd y64-base; ./y64asm-base %s.ys; ./y64sim-base %s.bin > %s.sim.base",name,name,name);
+    pool_t *pool = (pool_t *)arg;
 
-    return system(cmdbuf);
+    for (;;) {
+        int i;
+        pthread_mutex_lock(&pool->lock);
+        i = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        if (i >= pool->ntests)
+            return NULL;
+        run_test(&pool->tests[i]);
+    }
 }
 
-static int diff_ins(const char *name)
+static void run_tests(test_t *tests, int ntests)
 {
-    sprintf(cmdbuf, " diff ./y64-base/%s.sim.base ./y64-ins-bin/%s.sim", name, name);
-    
-    return system(cmdbuf);
+    pool_t pool = { tests, ntests, 0, PTHREAD_MUTEX_INITIALIZER };
+    pthread_t tid[MAX_THREADS];
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int i;
+
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+    if (nthreads > ntests)
+        nthreads = ntests;
+    for (i = 0; i < nthreads; i++)
+        pthread_create(&tid[i], NULL, worker, &pool);
+    for (i = 0; i < nthreads; i++)
+        pthread_join(tid[i], NULL);
 }
 
 static int ins_pass_count;
@@ -76,19 +167,44 @@ static int ins_test_count;
 static int app_test_count;
 static int app_pass_count;
 
+// print a finished test the way yat always has
+static int report_test(test_t *t, const char *kind)
+{
+    printf("[ Testing %s: %s ]\n", kind, t->name);
+    fwrite(t->report, 1, t->report_len, stdout);
+    free(t->report);
+    printf("[ Result: %s ]\n", t->pass ? "Pass" : "Fail");
+    return t->pass;
+}
+
+// run every named test on the pool, then report them in order
+static void test_list(char **names, const char *dir, int steps, int is_ins)
+{
+    test_t tests[MAX_TESTS];
+    int i, n;
+
+    for (n = 0; names[n] && n < MAX_TESTS; n++) {
+        tests[n].name = names[n];
+        tests[n].dir = dir;
+        tests[n].steps = steps;
+    }
+    run_tests(tests, n);
+    for (i = 0; i < n; i++) {
+        if (is_ins) {
+            ins_test_count++;
+            ins_pass_count += report_test(&tests[i], "instruction");
+        } else {
+            app_test_count++;
+            app_pass_count += report_test(&tests[i], "application");
+        }
+    }
+}
+
 // test a uniterm, either an instruction or an error-handling case.
 static void test_ins_bin(const char *name,int steps)
 {
-        // test an instruction
-	ins_test_count++;
-	printf("[ Testing instruction: %s ]\n", name);
-        
-	if (!make_ins_base(name,steps) && !make_ins_stu(name,steps) && !diff_ins(name)) {
-		ins_pass_count++;
-		printf("[ Result: Pass ]\n");
-	} else {
-		printf("[ Result: Fail ]\n");
-	}
+    char *names[] = { (char *)name, NULL };
+    test_list(names, "y64-ins-bin", steps, 1);
 }
 
 static char *uni_list[] = {
@@ -130,22 +246,13 @@ static char *uni_list[] = {
 
 static void test_all_ins_bin()
 {
-    char **p = uni_list;
-    while (*p)
-        test_ins_bin(*p++,0);
+    test_list(uni_list, "y64-ins-bin", 0, 1);
 }
 
 static void test_app_bin(const char *name,int steps)
 {
-    ++app_test_count;
-    printf("[ Testing application: %s ]\n", name);
-    
-    if (!make_app_base(name,steps) && !make_app_stu(name,steps) && !diff_app(name)) {
-        ++app_pass_count;
-        printf("[ Result: Pass ]\n");
-    } else {
-        printf("[ Result: Fail ]\n");
-    }
+    char *names[] = { (char *)name, NULL };
+    test_list(names, "y64-app-bin", steps, 0);
 }
 
 static char *app_list[] = {
@@ -169,15 +276,14 @@ static char *app_list[] = {
     "pushquestion",
     "pushtest",
     "ret-hazard",
+    "tail-page",
     NULL
 };
 
 static void test_all_app_bin()
 {
     // compare all .bin and .yo files
-    char **p = app_list;
-    while (*p)
-        test_app_bin(*p++,0);
+    test_list(app_list, "y64-app-bin", 0, 0);
 }
 
 static int get_correct(const char*name,int steps)
@@ -0,0 +1,27 @@
+#!/bin/sh
+#
+# Symbol table scaling: assemble generated programs of 12.5k to 100k
+# labels, each referred to twice (by an irmovq and a jmp).  With lookups
+# in constant time, the time per label stays about flat as they double.
+#
+# usage: labelbench.sh [y64asm]
+#
+YAS=${1:-./y64asm}
+DIR=${TMPDIR:-/tmp}/labelbench.$$
+mkdir -p $DIR || exit 1
+
+for n in 12500 25000 50000 100000; do
+    awk -v n=$n 'BEGIN {
+        for (i = 0; i < n; i++) {
+            printf "L%d: irmovq L%d, %%rax\n", i, (i * 7919) % n
+            printf "    jmp L%d\n", i + 1
+        }
+        printf "L%d: halt\n", n
+    }' > $DIR/labels$n.ys
+    start=$(date +%s%N)
+    $YAS $DIR/labels$n.ys || exit 1
+    end=$(date +%s%N)
+    ms=$(( (end - start) / 1000000 ))
+    echo "$n labels: $ms ms ($(( (end - start) / n )) ns per label)"
+done
+rm -rf $DIR
@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+# Parse throughput: assemble a generated program of every kind of
+# instruction and directive, some 8MB of source, and report lines per
+# second (best of 3 runs).
+#
+# usage: [YFLAGS=-s] parsebench.sh [y64asm]
+#
+YAS=${1:-./y64asm}
+DIR=${TMPDIR:-/tmp}/parsebench.$$
+mkdir -p $DIR || exit 1
+
+awk -v n=25000 'BEGIN {
+    split("%rax %rcx %rdx %rbx %rsp %rbp %rsi %rdi %r8 %r9 %r10 %r11 %r12 %r13 %r14", r, " ")
+    for (i = 0; i < n; i++) {
+        a = r[i % 15 + 1]; b = r[(i * 7) % 15 + 1]
+        printf "L%d:\n", i
+        printf "    irmovq $%d, %s      # constant\n", i, a
+        printf "    rrmovq %s, %s\n", a, b
+        printf "    mrmovq 8(%s), %s\n", b, a
+        printf "    rmmovq %s, -16(%s)\n", a, b
+        printf "    addq %s, %s\n    subq %s, %s\n", a, b, b, a
+        printf "    andq %s, %s\n    xorq %s, %s\n", a, b, b, a
+        printf "    cmovle %s, %s\n    cmovge %s, %s\n", a, b, b, a
+        printf "    pushq %s\n    popq %s\n", a, b
+        printf "    jle L%d\n    jne L%d\n", (i * 7919) % n, i + 1
+        printf "    call L%d\n    nop\n    ret\n", (i * 31) % n
+        printf "    .align 8\n    .quad L%d\n", i
+    }
+    printf "L%d: halt\n", n
+}' > $DIR/parse.ys
+
+lines=$(wc -l < $DIR/parse.ys)
+bytes=$(wc -c < $DIR/parse.ys)
+best=0
+for run in 1 2 3; do
+    start=$(date +%s%N)
+    $YAS $YFLAGS $DIR/parse.ys || exit 1
+    end=$(date +%s%N)
+    ns=$((end - start))
+    if [ $best -eq 0 ] || [ $ns -lt $best ]; then
+        best=$ns
+    fi
+done
+echo "$lines lines ($bytes bytes): $((best / 1000000)) ms," \
+     "$((lines * 1000000 / (best / 1000))) lines per second"
+rm -rf $DIR
@@ -1,9 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <time.h>
 
 #include "y64asm.h"
+#include "y64obj.h"
 
 line_t *line_head = NULL;
 line_t *line_tail = NULL;
@@ -19,6 +26,120 @@ int lineno = 0;
 
 int64_t vmaddr = 0;    /* vm addr */
 
+/*
+ * arenas for what lives as long as the assembler: every line_t, in
+ * 'lines', so that the list and its bins lie in order in a few chunks,
+ * the relocations in 'relocs', the symbol names in 'pool', and in watch
+ * mode the cached lines in 'seen' (don't forget to init and finit them)
+ */
+arena_t lines, relocs, pool, seen;
+
+#define ARENA_CHUNK (256*1024)
+#define ARENA_ALIGN 8
+
+/*
+ * arena_alloc: allocate zeroed memory from an arena
+ * args
+ *     a: the arena
+ *     size: the size of memory
+ *
+ * return
+ *     the memory, aligned for any object the assembler keeps; it is freed
+ *     by arena_free() only
+ */
+void *arena_alloc(arena_t *a, size_t size)
+{
+    chunk_t *c = a->head;
+    void *p;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (c == NULL || c->used + size > c->size) {
+        size_t n = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+
+        c = (chunk_t *)calloc(1, sizeof(chunk_t) + n);
+        if (c == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        c->size = n;
+        c->next = a->head;
+        a->head = c;
+    }
+    p = c->data + c->used;
+    c->used += size;
+    return p;
+}
+
+/* copy the first len chars of s into an arena, as a string */
+char *arena_strndup(arena_t *a, const char *s, int len)
+{
+    char *d = (char *)arena_alloc(a, len + 1);
+
+    memcpy(d, s, len);
+    return d;
+}
+
+/* free every chunk of an arena */
+void arena_free(arena_t *a)
+{
+    chunk_t *c;
+
+    while ((c = a->head) != NULL) {
+        a->head = c->next;
+        free(c);
+    }
+}
+
+/* char of a name to its column in trie_t.next, 0 if no name uses it */
+byte_t trie_char[256];
+
+/*
+ * trie_add: add a name to a trie
+ * args
+ *     t: the trie
+ *     name: the name, of chars trie_char knows
+ *     value: the index of the name in its table
+ */
+void trie_add(trie_t *t, const char *name, int value)
+{
+    int node = 0;
+
+    for (; *name; name++) {
+        byte_t c = trie_char[(byte_t)*name];
+
+        assert(c != 0);
+        if (t->next[node][c] == 0) {
+            assert(t->nnodes < TRIE_NODES);
+            t->next[node][c] = t->nnodes++;
+        }
+        node = t->next[node][c];
+    }
+    if (t->value[node] == 0)
+        t->value[node] = value + 1;
+}
+
+/*
+ * trie_find: find the longest name in a trie that text starts with
+ * args
+ *     t: the trie
+ *     text: the text
+ *
+ * return
+ *     the index of the name in its table, -1 if none matches
+ */
+static inline int trie_find(const trie_t *t, const char *text)
+{
+    int node = 0, found = 0;
+    byte_t c;
+
+    while ((c = trie_char[(byte_t)*text++]) && (node = t->next[node][c]))
+        if (t->value[node])
+            found = t->value[node];
+    return found - 1;
+}
+
+trie_t reg_trie, instr_trie;
+
 /* register table */
 const reg_t reg_table[REG_NONE] = {
     {"%rax", REG_RAX, 4},
@@ -39,11 +160,9 @@ const reg_t reg_table[REG_NONE] = {
 };
 const reg_t* find_register(char *name)
 {
-    int i;
-    for (i = 0; i < REG_NONE; i++)
-        if (!strncmp(name, reg_table[i].name, reg_table[i].namelen))
-            return &reg_table[i];
-    return NULL;
+    int i = trie_find(&reg_trie, name);
+
+    return i < 0 ? NULL : &reg_table[i];
 }
 
 
@@ -76,6 +195,8 @@ instr_t instr_set[] = {
     {"ret", 3,   HPACK(I_RET, F_NONE), 1 },
     {"pushq", 5, HPACK(I_PUSHQ, F_NONE), 2 },
     {"popq", 4,  HPACK(I_POPQ, F_NONE),  2 },
+    {"xaddq", 5, HPACK(I_ATOMIC, AT_XADD), 10 },
+    {"cmpxchgq", 8, HPACK(I_ATOMIC, AT_CMPXCHG), 10 },
     {".byte", 5, HPACK(I_DIRECTIVE, D_DATA), 1 },
     {".word", 5, HPACK(I_DIRECTIVE, D_DATA), 2 },
     {".long", 5, HPACK(I_DIRECTIVE, D_DATA), 4 },
@@ -85,47 +206,303 @@ instr_t instr_set[] = {
     {NULL, 1,    0   , 0 } //end
 };
 
+/*
+ * find_instr: find the instruction 'name' starts with; where one starts
+ * with another (e.g., jle and jl), the longer comes first in instr_set,
+ * so the longest match is also the first
+ */
 instr_t *find_instr(char *name)
 {
+    int i = trie_find(&instr_trie, name);
+
+    return i < 0 ? NULL : &instr_set[i];
+}
+
+/* build the tries of register and instruction names */
+void init_tries(void)
+{
+    const char *chars = "abcdefghijklmnopqrstuvwxyz0123456789.%";
     int i;
+
+    for (i = 0; chars[i]; i++)
+        trie_char[(byte_t)chars[i]] = i + 1;
+
+    memset(&reg_trie, 0, sizeof(reg_trie));
+    reg_trie.nnodes = 1;
+    for (i = 0; i < REG_NONE; i++)
+        trie_add(&reg_trie, reg_table[i].name, i);
+
+    memset(&instr_trie, 0, sizeof(instr_trie));
+    instr_trie.nnodes = 1;
     for (i = 0; instr_set[i].name; i++)
-	if (strncmp(instr_set[i].name, name, instr_set[i].len) == 0)
-	    return &instr_set[i];
-    return NULL;
+        trie_add(&instr_trie, instr_set[i].name, i);
 }
 
-/* symbol table (don't forget to init and finit it) */
+/* macro for parsing y64 assembly code */
+#define IS_DIGIT(s) ((*(s)>='0' && *(s)<='9') || *(s)=='-' || *(s)=='+')
+#define IS_LETTER(s) ((*(s)>='a' && *(s)<='z') || (*(s)>='A' && *(s)<='Z'))
+#define IS_COMMENT(s) (*(s)=='#')
+#define IS_REG(s) (*(s)=='%')
+#define IS_IMM(s) (*(s)=='$')
+
+#define IS_BLANK(s) (*(s)==' ' || *(s)=='\t')
+#define IS_END(s) (*(s)=='\0' || *(s)=='\n' || *(s)=='\r')
+
+#define SKIP_BLANK(s) do {  \
+  while(!IS_END(s) && IS_BLANK(s))  \
+    (s)++;    \
+} while(0);
+
+/*
+ * symbol table, indexed by symbol ID, and an open-addressing hash table of
+ * the names in it (don't forget to init and finit them)
+ */
 symbol_t *symtab = NULL;
+int nsyms = 0, maxsyms = 0;
+int *symhash = NULL; /* 1 + ID of the symbol in each slot, 0 if empty */
+int hashsize = 0;    /* a power of 2, at least twice nsyms */
+
+/*
+ * the length of the symbol name at 'name', which ends at the first char
+ * that parse_symbol() would not take into it (in the source text) or at
+ * its '\0' (in the symbol table)
+ */
+static int symbol_len(const char *name)
+{
+    const char *p = name;
+
+    while (IS_LETTER(p) || IS_DIGIT(p))
+        p++;
+    return p - name;
+}
+
+/* FNV-1a */
+static unsigned int hash_name(const char *name, int len)
+{
+    unsigned int h = 2166136261U;
+
+    while (len--)
+        h = (h ^ (byte_t)*name++) * 16777619U;
+    return h;
+}
+
+/* the slot of 'name' in symhash, or the empty slot where it would go */
+static int hash_slot(const char *name)
+{
+    int len = symbol_len(name);
+    int h = hash_name(name, len) & (hashsize - 1);
+    const char *s;
+
+    while (symhash[h] && (s = symtab[symhash[h] - 1].name,
+                          strncmp(s, name, len) || s[len] != '\0'))
+        h = (h + 1) & (hashsize - 1);
+    return h;
+}
+
+/* double symhash, moving every symbol over */
+static void grow_hash(void)
+{
+    int i;
+
+    hashsize *= 2;
+    free(symhash);
+    symhash = (int *)calloc(hashsize, sizeof(int));
+    for (i = 0; i < nsyms; i++)
+        symhash[hash_slot(symtab[i].name)] = i + 1;
+}
+
+/*
+ * intern: find the symbol, adding it (not yet defined) if it is new
+ * args
+ *     name: the name of symbol, in the source text; the table keeps a
+ *           copy of it if the symbol is new
+ *
+ * return
+ *     the ID of the symbol
+ */
+int intern(char *name)
+{
+    int h = hash_slot(name);
+
+    if (symhash[h])
+        return symhash[h] - 1;
+
+    if (nsyms == maxsyms) {
+        maxsyms = maxsyms ? 2 * maxsyms : 64;
+        symtab = (symbol_t *)realloc(symtab, maxsyms * sizeof(symbol_t));
+    }
+    symtab[nsyms].name = arena_strndup(&pool, name, symbol_len(name));
+    symtab[nsyms].addr = 0;
+    symtab[nsyms].defined = FALSE;
+    symtab[nsyms].pending = NULL;
+    symhash[h] = ++nsyms;
+    if (2 * nsyms > hashsize)
+        grow_hash();
+    return nsyms - 1;
+}
 
 /*
- * find_symbol: scan table to find the symbol
+ * find_symbol: look the symbol up in the hash table
  * args
  *     name: the name of symbol
  *
  * return
  *     symbol_t: the 'name' symbol
- *     NULL: not exist
+ *     NULL: not defined
  */
 symbol_t *find_symbol(char *name)
 {
-	// declaration	
-	symbol_t *temp = symtab -> next;
+	int h = hash_slot(name);
 
-        while (temp != NULL) {
-                if (!strcmp(temp -> name, name)) { // comparing 2 strings to see if they have same characters
-                        return temp;
-                }
+	if (!symhash[h] || !symtab[symhash[h] - 1].defined) {
+		return NULL;
+	}
+
+	return &symtab[symhash[h] - 1];
+}
+
+/*
+ * streaming mode (-s): the code of each line goes out to the binary file
+ * as soon as the line is assembled, and of the references to symbols
+ * only those not yet defined are kept, as fixups, until they are
+ */
+bool_t stream = FALSE;
+
+/*
+ * watch mode (-w): the file is assembled again whenever it changes, and
+ * the lines whose text has not changed are not parsed again: what they
+ * did, recorded when they were, is done again where they now are
+ */
+bool_t watching = FALSE;
+
+/*
+ * peephole (-O): the code is assembled, then assembled again with the
+ * lines that do nothing deleted and some rewritten shorter (see
+ * peep_mark()), so that every address after them moves up, until none
+ * are left
+ */
+bool_t optimize = FALSE;
+
+/*
+ * layout (-P): the code is assembled, then assembled again with its
+ * basic blocks laid out by the profile in this file (see layout())
+ */
+char *profname = NULL;
+
+/*
+ * costs (-C): the readable output gives what each instruction costs on
+ * PIPE, from the lines as assembled (see print_costs())
+ */
+bool_t costs = FALSE;
+
+/* watch, peephole, layout, costs: the symbols the line being parsed defines (and where) and refers to */
+int *rec_labels = NULL, *rec_refs = NULL;
+int64_t *rec_offs = NULL;
+int rec_nlabels = 0, rec_nrefs = 0, rec_max = 0;
+bool_t pinned = FALSE; /* the line has .pos or .align: it can't move */
+bool_t has_data = FALSE; /* the line has .byte, .word, .long or .quad: its code is data */
+
+/* watch, peephole, layout, costs: add that the line defines symbol 'id' at 'off' (or, not a label, refers to it) */
+static void record(bool_t label, int id, int64_t off)
+{
+    if (rec_nlabels == rec_max || rec_nrefs == rec_max) {
+        rec_max = rec_max ? 2 * rec_max : 16;
+        rec_labels = (int *)realloc(rec_labels, rec_max * sizeof(int));
+        rec_refs = (int *)realloc(rec_refs, rec_max * sizeof(int));
+        rec_offs = (int64_t *)realloc(rec_offs, rec_max * sizeof(int64_t));
+    }
+    if (label) {
+        rec_offs[rec_nlabels] = off;
+        rec_labels[rec_nlabels++] = id;
+    } else {
+        rec_refs[rec_nrefs++] = id;
+    }
+}
+
+#define OUT_BUF (64*1024)
+
+int out_fd = -1;
+byte_t out_buf[OUT_BUF];
+int64_t out_off = 0;      /* where out_buf starts in the file */
+int out_fill = 0;
+bool_t out_failed = FALSE; /* a write failed; binfile() reports it */
 
-                temp = temp -> next;
+/* write out what is in out_buf */
+static void out_flush(void)
+{
+    int done = 0, n;
+
+    while (done < out_fill) {
+        n = write(out_fd, out_buf + done, out_fill - done);
+        if (n < 0) {
+            out_failed = TRUE;
+            break;
         }
+        done += n;
+    }
+    out_off += out_fill;
+    out_fill = 0;
+}
 
-        return NULL;
+/* append n bytes to the file: 'codes', or zeros if it is NULL */
+static void out_put(const byte_t *codes, int64_t n)
+{
+    int k;
+
+    /* leave a long run of zeros as a hole; code always follows it */
+    if (codes == NULL && n >= OUT_BUF) {
+        out_flush();
+        if (lseek(out_fd, n, SEEK_CUR) < 0)
+            out_failed = TRUE;
+        out_off += n;
+        return;
+    }
+
+    while (n > 0) {
+        k = n < OUT_BUF - out_fill ? n : OUT_BUF - out_fill;
+        if (codes) {
+            memcpy(out_buf + out_fill, codes, k);
+            codes += k;
+        } else {
+            memset(out_buf + out_fill, 0, k);
+        }
+        out_fill += k;
+        n -= k;
+        if (out_fill == OUT_BUF)
+            out_flush();
+    }
+}
+
+/* patch the first 'size' bytes of 'addr' in at 'off' in the file */
+static void out_patch(int64_t off, int64_t addr, int size)
+{
+    if (off >= out_off) {
+        memcpy(out_buf + (off - out_off), &addr, size);
+        return;
+    }
+    if (off + size > out_off)
+        out_flush();
+    if (pwrite(out_fd, &addr, size, off) != size)
+        out_failed = TRUE;
+}
+
+/* a symbol is now defined: patch in its address wherever it is pending */
+static void resolve(symbol_t *s)
+{
+    fixup_t *f;
+
+    while ((f = s -> pending) != NULL) {
+        s -> pending = f -> next;
+        if (f -> off >= 0)
+            out_patch(f -> off, s -> addr, f -> size);
+        free(f);
+    }
 }
 
 /*
- * add_symbol: add a new symbol to the symbol table
+ * add_symbol: define a symbol at the current address
  * args
- *     name: the name of symbol
+ *     name: the name of symbol (kept as by intern())
  *
  * return
  *     0: success
@@ -133,19 +510,24 @@ symbol_t *find_symbol(char *name)
  */
 int add_symbol(char *name)
 {
+	int id;
+
 	/* check duplicate */
-        if (find_symbol(name) != NULL) {
-                return -1;
-        }
-	
-        /* create new symbol_t (don't forget to free it)*/
-        symbol_t *temp = (symbol_t *)malloc(sizeof(symbol_t));
-	
-        /* add the new symbol_t to symbol table */
-	temp -> addr = vmaddr;
-	temp -> name = name;
-	temp -> next = symtab -> next;
-	symtab -> next = temp;
+	if (find_symbol(name) != NULL) {
+		return -1;
+	}
+
+	id = intern(name);
+	symtab[id].addr = vmaddr;
+	symtab[id].defined = TRUE;
+
+	if (stream) {
+		resolve(&symtab[id]);
+	}
+
+	if (watching || optimize || profname || costs) {
+		record(TRUE, id, vmaddr);
+	}
 
 	return 0;
 }
@@ -153,42 +535,45 @@ int add_symbol(char *name)
 /* relocation table (don't forget to init and finit it) */
 reloc_t *reltab = NULL;
 
+/* streaming: the references made by the line being assembled */
+fixup_t *unplaced = NULL;
+long nfixups = 0;
+
 /*
  * add_reloc: add a new relocation to the relocation table
  * args
- *     name: the name of symbol
- *
- * return
- *     0: success
- *     -1: error, the symbol has exist
+ *     name: the name of symbol (kept as by intern())
+ *     bin: the code to patch with its address
  */
 void add_reloc(char *name, bin_t *bin)
 {
-	/* create new reloc_t (don't forget to free it)*/
-        reloc_t *temp = (reloc_t *)malloc(sizeof(reloc_t));
-	temp -> name = name;
+	/* streaming: the line is placed (and its references looked up) later */
+	if (stream) {
+		fixup_t *f = (fixup_t *)malloc(sizeof(fixup_t));
+
+		f -> sym = intern(name);
+		f -> seq = nfixups++;
+		f -> next = unplaced;
+		unplaced = f;
+
+		return;
+	}
+
+	/* create new reloc_t (freed with the relocs arena) */
+        reloc_t *temp = (reloc_t *)arena_alloc(&relocs, sizeof(reloc_t));
+	temp -> sym = intern(name);
         temp -> y64bin = bin;
 
         /* add the new reloc_t to relocation table */
         temp -> next = reltab -> next;
 	reltab -> next = temp;
-}
 
+	if (watching || optimize || profname || costs) {
+		record(FALSE, temp -> sym, 0);
+	}
+}
 
-/* macro for parsing y64 assembly code */
-#define IS_DIGIT(s) ((*(s)>='0' && *(s)<='9') || *(s)=='-' || *(s)=='+')
-#define IS_LETTER(s) ((*(s)>='a' && *(s)<='z') || (*(s)>='A' && *(s)<='Z'))
-#define IS_COMMENT(s) (*(s)=='#')
-#define IS_REG(s) (*(s)=='%')
-#define IS_IMM(s) (*(s)=='$')
-
-#define IS_BLANK(s) (*(s)==' ' || *(s)=='\t')
-#define IS_END(s) (*(s)=='\0')
 
-#define SKIP_BLANK(s) do {  \
-  while(!IS_END(s) && IS_BLANK(s))  \
-    (s)++;    \
-} while(0);
 
 /* return value from different parse_xxx function */
 typedef enum { PARSE_ERR=-1, PARSE_REG, PARSE_DIGIT, PARSE_SYMBOL, 
@@ -281,7 +666,7 @@ parse_t parse_delim(char **ptr, char delim)
 parse_t parse_reg(char **ptr, regid_t *regid)
 {
 	/* skip the blank and check */
-	reg_t *registerTemp = (reg_t *)malloc(sizeof(reg_t));
+	const reg_t *registerTemp;
 
 	SKIP_BLANK(*ptr);
 
@@ -307,18 +692,17 @@ parse_t parse_reg(char **ptr, regid_t *regid)
  * parse_symbol: parse an expected symbol token (e.g., 'Main')
  * args
  *     ptr: point to the start of string
- *     name: point to the name of symbol (should be allocated in this function)
+ *     name: point to the name of symbol (in the text, see symbol_len())
  *
  * return
  *     PARSE_SYMBOL: success, move 'ptr' to the first char after token,
- *                               and allocate and store name to 'name'
+ *                               and point 'name' to the token
  *     PARSE_ERR: error, the value of 'ptr' and 'name' are undefined
  */
 parse_t parse_symbol(char **ptr, char **name)
 {
 	/* skip the blank and check */
 	char *temp = *ptr;
-	int counter = 0;
 
 	SKIP_BLANK(temp);
 	SKIP_BLANK(*ptr); // add this to prevent error
@@ -327,19 +711,14 @@ parse_t parse_symbol(char **ptr, char **name)
 		return PARSE_ERR;
 	}
 
-	/* allocate name and copy to it */
+	/* find the end of name */
     	while (IS_LETTER(temp) || IS_DIGIT(temp)) {
-		counter++;
 		temp++;
 	}
 
-    	char *c = malloc(sizeof(char) * (counter+1));
-	memset(c, '\0', counter+1); // set string ending
-    	memcpy(c, *ptr, counter); // copy string
-	
 	/* set 'ptr' and 'name' */
+	*name = *ptr;
 	*ptr = temp;
-	*name = c;
 
 	return PARSE_SYMBOL;
 }
@@ -380,7 +759,7 @@ parse_t parse_digit(char **ptr, long *value)
  * parse_imm: parse an expected immediate token (e.g., '$0x100' or 'STACK')
  * args
  *     ptr: point to the start of string
- *     name: point to the name of symbol (should be allocated in this function)
+ *     name: point to the name of symbol (in the text, see symbol_len())
  *     value: point to the value of digit
  *
  * return
@@ -389,7 +768,7 @@ parse_t parse_digit(char **ptr, long *value)
  *                            and store the value of digit to 'value'
  *     PARSE_SYMBOL: success, the immediate token is a symbol,
  *                            move 'ptr' to the first char after token,
- *                            and allocate and store name to 'name' 
+ *                            and point 'name' to the symbol
  *     PARSE_ERR: error, the value of 'ptr', 'name' and 'value' are undefined
  */
 parse_t parse_imm(char **ptr, char **name, long *value)
@@ -487,7 +866,7 @@ parse_t parse_mem(char **ptr, long *value, regid_t *regid)
  * parse_data: parse an expected data token (e.g., '0x100' or 'array')
  * args
  *     ptr: point to the start of string
- *     name: point to the name of symbol (should be allocated in this function)
+ *     name: point to the name of symbol (in the text, see symbol_len())
  *     value: point to the value of digit
  *
  * return
@@ -496,7 +875,7 @@ parse_t parse_mem(char **ptr, long *value, regid_t *regid)
  *                            and store the value of digit to 'value'
  *     PARSE_SYMBOL: success, data token is a symbol,
  *                            and move 'ptr' to the first char after token,
- *                            and allocate and store name to 'name' 
+ *                            and point 'name' to the symbol
  *     PARSE_ERR: error, the value of 'ptr', 'name' and 'value' are undefined
  */
 parse_t parse_data(char **ptr, char **name, long *value)
@@ -541,11 +920,11 @@ parse_t parse_data(char **ptr, char **name, long *value)
  * parse_label: parse an expected label token (e.g., 'Loop:')
  * args
  *     ptr: point to the start of string
- *     name: point to the name of symbol (should be allocated in this function)
+ *     name: point to the name of symbol (in the text, see symbol_len())
  *
  * return
  *     PARSE_LABEL: success, move 'ptr' to the first char after token
- *                            and allocate and store name to 'name'
+ *                            and point 'name' to the name
  *     PARSE_ERR: error, the value of 'ptr' is undefined
  */
 parse_t parse_label(char **ptr, char **name)
@@ -553,7 +932,6 @@ parse_t parse_label(char **ptr, char **name)
 	/* skip the blank and check */
 	// declarations
 	char *temp = *ptr;
-	int counter = 0;
 
 	SKIP_BLANK(temp);
 	SKIP_BLANK(*ptr); // add this to prevent error
@@ -562,20 +940,16 @@ parse_t parse_label(char **ptr, char **name)
 		return PARSE_ERR;
 	}
 
-	/* allocate name and copy to it */
+	/* find the end of name */
 	while (IS_LETTER(temp) || IS_DIGIT(temp)) {
-		counter++; // get counter to know length of string to copy
 		temp++;
 	}
 	
 	/* set 'ptr' and 'name' */
 	if ((*temp) == ':') {
-		char *newLabel = malloc(counter+1);
-		memset(newLabel, '\0', counter+1); // add end of string
-		memcpy(newLabel, *ptr, counter); // copy string
 		temp++; // skip ':' after parsing
+		*name = *ptr;
 		*ptr = temp;
-		*name = newLabel;
 
 		return PARSE_LABEL;
 	}
@@ -597,11 +971,9 @@ type_t parse_line(line_t *line)
 {
 	// initialisation
 	bin_t *y64bin = &line -> y64bin;
-	char *y64asm = (char *)malloc(strlen(line -> y64asm) + 1);
-	strcpy(y64asm, line -> y64asm); // make sure both strings of line are equal
 	char *label = NULL;
 	instr_t *instruction = NULL;
-	char *temp = y64asm;
+	char *temp = line -> y64asm; // only read, never written
 	
 /* when finish parse an instruction or lable, we still need to continue check 
 * e.g., 
@@ -626,7 +998,7 @@ type_t parse_line(line_t *line)
 	if (parse_label(&temp, &label) == PARSE_LABEL) {
 		if (add_symbol(label) < 0) {
 			line -> type = TYPE_ERR;
-			err_print("Dup symbol:%s", label);
+			err_print("Dup symbol:%.*s", symbol_len(label), label);
 
 			goto end;
 		}
@@ -705,7 +1077,7 @@ type_t parse_line(line_t *line)
 
 			goto loop;
 		}
-		case I_RMMOVQ:
+		case I_RMMOVQ: case I_ATOMIC:
 		{
 			regid_t registerA, registerB;
 
@@ -858,6 +1230,7 @@ type_t parse_line(line_t *line)
 						goto end;
 					}
 
+					has_data = TRUE;
 					if (p == PARSE_SYMBOL) {
 						add_reloc(n, y64bin);
 
@@ -888,6 +1261,7 @@ type_t parse_line(line_t *line)
             				}
 
            				vmaddr = (int)l;
+            				pinned = TRUE;
             				y64bin -> addr = vmaddr;
 
             				goto loop;
@@ -903,6 +1277,7 @@ type_t parse_line(line_t *line)
   	          				goto end;;
               				}
 					
+  	    				pinned = TRUE;
   	    				while (vmaddr % l) {
 						vmaddr++;
 					}
@@ -932,97 +1307,1325 @@ type_t parse_line(line_t *line)
 	}
 
 	end: ;
-	free(y64asm);
 
 	return line -> type;
 }
 
+/* where the address of a symbol goes in the code of a line, by its itype */
+static int reloc_field(bin_t *bin)
+{
+	byte_t type = HIGH(bin -> codes[0]);
+
+	if (type == I_IRMOVQ) {
+		return 2;
+	} else if (type == I_CALL || type == I_JMP) {
+		return 1;
+	}
+	return 0; /* data */
+}
+
+/* streaming: the last line with code, and what the lines since ask for */
+int64_t last_base = 0; /* where its code would go if it were the last */
+int64_t last_at = 0;   /* where it went */
+int last_bytes = 0;
+int64_t pad_to = 0;    /* the highest address of the lines with no code */
+
 /*
- * assemble: assemble an y64 file (e.g., 'asum.ys')
+ * place_line: streaming: write the code of a line where binfile() puts
+ *     it, padded with zeros up to its address (and those of the lines
+ *     with no code before it), patch in the symbols it refers to that
+ *     are defined, and keep the rest pending
  * args
- *     in: point to input file (an y64 assembly file)
- *
- * return
- *     0: success, assmble the y64 file to a list of line_t
- *     -1: error, try to print err information (e.g., instr type and line number)
+ *     line: the line just assembled
  */
-int assemble(FILE *in)
+static void place_line(line_t *line)
 {
-    static char asm_buf[MAX_INSLEN]; /* the current line of asm code */
-    line_t *line;
-    int slen;
-    char *y64asm;
-
-    /* read y64 code line-by-line, and parse them to generate raw y64 binary code list */
-    while (fgets(asm_buf, MAX_INSLEN, in) != NULL) {
-        slen  = strlen(asm_buf);
-        while ((asm_buf[slen-1] == '\n') || (asm_buf[slen-1] == '\r')) { 
-            asm_buf[--slen] = '\0'; /* replace terminator */
-        }
+	bin_t *y64bin = &line -> y64bin;
+	int64_t pos = out_off + out_fill, at = -1;
+	int field = reloc_field(y64bin);
+	fixup_t *f;
+
+	if (y64bin -> bytes > 0) {
+		if (pos < pad_to) {
+			out_put(NULL, pad_to - pos);
+			pos = pad_to;
+		}
+		last_base = pos;
 
-        /* store y64 assembly code */
-        y64asm = (char *)malloc(sizeof(char) * (slen + 1)); // free in finit
-        strcpy(y64asm, asm_buf);
+		if (pos < y64bin -> addr) {
+			out_put(NULL, y64bin -> addr - pos);
+			pos = y64bin -> addr;
+		}
+		at = last_at = pos;
+		last_bytes = y64bin -> bytes;
+	} else if (pad_to < y64bin -> addr) {
+		pad_to = y64bin -> addr;
+	}
 
-        line = (line_t *)malloc(sizeof(line_t)); // free in finit
-        memset(line, '\0', sizeof(line_t));
+	/* the references, as relocate() would patch them */
+	while ((f = unplaced) != NULL) {
+		symbol_t *s = &symtab[f -> sym];
 
-        line->type = TYPE_COMM;
-        line->y64asm = y64asm;
-        line->next = NULL;
+		unplaced = f -> next;
+		if (s -> defined) {
+			memcpy(&y64bin -> codes[field], &s -> addr, sizeof(s -> addr));
+			free(f);
+			continue;
+		}
 
-        line_tail->next = line;
-        line_tail = line;
-        lineno ++;
-	
-        if (parse_line(line) == TYPE_ERR) {
-            return -1;
-        }
-    }
+		/* only the bytes of the line go out */
+		f -> off = at >= 0 && field < y64bin -> bytes ? at + field : -1;
+		f -> size = y64bin -> bytes - field < 8 ? y64bin -> bytes - field : 8;
+		f -> next = s -> pending;
+		s -> pending = f;
+	}
 
-	lineno = -1;
-    return 0;
+	out_put(y64bin -> codes, y64bin -> bytes);
+}
+
+/* the source text: mapped (src_map bytes of it) or read into memory */
+char *src_text = NULL;
+long src_map = 0;
+long src_dropped = 0; /* streaming: the text given back so far */
+
+#define DROP_STEP (4*1024*1024)
+
+/* streaming: the text before 'upto' is done with, give its pages back */
+static void drop_source(char *upto)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	long done = (upto - src_text) & ~(page - 1);
+
+	if (src_map && done - src_dropped >= DROP_STEP) {
+		madvise(src_text + src_dropped, done - src_dropped, MADV_DONTNEED);
+		src_dropped = done;
+	}
 }
 
 /*
- * relocate: relocate the raw y64 binary code with symbol address
+ * reset: forget the lines and relocations of the last assembly, and
+ *     where its symbols were defined (but not their IDs), to assemble
+ *     the code again
+ */
+static void reset(void)
+{
+	int i;
+
+	arena_free(&lines);
+	arena_free(&relocs);
+	reltab = (reloc_t *)arena_alloc(&relocs, sizeof(reloc_t));
+	line_head = line_tail = (line_t *)arena_alloc(&lines, sizeof(line_t));
+	for (i = 0; i < nsyms; i++) {
+		symtab[i].defined = FALSE;
+	}
+	vmaddr = 0;
+	lineno = 0;
+}
+
+/* peephole, layout: each line (by line number - 1), and the line each symbol is defined on */
+peep_t *peep = NULL;
+int npeep = 0, maxpeep = 0;
+int *defline = NULL;
+int maxdef = 0;
+
+/* peephole: what it has done */
+int peep_deleted = 0, peep_rewritten = 0;
+long peep_saved = 0;
+
+/*
+ * peep_line: peephole, layout: parse a line, note what the optimizer
+ *     needs to know of it, and delete or rewrite it if it was found to be
+ * args
+ *     line: the line
  *
  * return
- *     0: success
- *     -1: error, try to print err information (e.g., addr and symbol)
+ *     its type, as parse_line()
  */
-int relocate(void)
+static type_t peep_line(line_t *line)
 {
-	// initialisaton	
-	reloc_t *rtmp = reltab -> next;
+	bin_t *y64bin = &line -> y64bin;
+	int64_t start = vmaddr;
+	int k = lineno - 1, i;
+	peep_t *p;
+	type_t type;
+
+	if (k == maxpeep) {
+		maxpeep = maxpeep ? 2 * maxpeep : 1024;
+		peep = (peep_t *)realloc(peep, maxpeep * sizeof(peep_t));
+	}
+	p = &peep[k];
+	if (k == npeep) {
+		p -> action = P_KEEP;
+		npeep++;
+	}
 
-    	while (rtmp) {
-        	/* find symbol */
-		symbol_t *s = find_symbol(rtmp -> name);
+	rec_nlabels = rec_nrefs = 0;
+	has_data = FALSE;
+	type = parse_line(line);
+	if (type == TYPE_ERR) {
+		return type;
+	}
 
-		if (s == NULL) {
-			err_print("Unknown symbol:'%s'", rtmp -> name);
+	p -> line = line;
+	p -> data = has_data;
+	p -> labeled = rec_nlabels > 0;
+	p -> ref = rec_nrefs > 0 ? rec_refs[0] : -1;
+	p -> simple = y64bin -> addr == start && vmaddr == start + y64bin -> bytes &&
+		rec_nrefs <= 1;
+	for (i = 0; i < rec_nlabels; i++) {
+		if (rec_offs[i] != start) {
+			p -> simple = FALSE;
+		}
+		while (rec_labels[i] >= maxdef) {
+			int j = maxdef;
 
-			return -1;
+			maxdef = maxdef ? 2 * maxdef : 1024;
+			defline = (int *)realloc(defline, maxdef * sizeof(int));
+			while (j < maxdef) {
+				defline[j++] = -1;
+			}
 		}
+		defline[rec_labels[i]] = k;
+	}
 
-		long *a;
-		byte_t type = HIGH(rtmp -> y64bin -> codes[0]);
+	switch (p -> action) {
+		case P_DELETE:
+		{
+			/* its reference was the last added */
+			if (p -> ref >= 0) {
+				reltab -> next = reltab -> next -> next;
+			}
+			y64bin -> bytes = 0;
+			vmaddr = start;
 
-		/* relocate y64bin according itype */
-		if (type == I_IRMOVQ) {
-			a = (long *)&rtmp -> y64bin -> codes[2];
-		} else if (type == I_CALL || type == I_JMP) {
-			a = (long *)&rtmp -> y64bin -> codes[1];
-		} else { /* next */
-			a = (long *)&rtmp -> y64bin -> codes[0];
+			break;
 		}
+		case P_XOR:
+		{
+			byte_t reg = LOW(y64bin -> codes[1]);
 
-		*a = s -> addr;
-		rtmp = rtmp -> next;
+			y64bin -> codes[0] = HPACK(I_ALU, A_XOR);
+			y64bin -> codes[1] = HPACK(reg, reg);
+			y64bin -> bytes = 2;
+			vmaddr = start + 2;
+
+			break;
+		}
+		default:
+			break;
 	}
 
-	return 0;
+	return type;
+}
+
+/* peephole: whether the code that follows line k's is never run after it */
+static bool_t ends_flow(int k)
+{
+	byte_t code = peep[k].line -> y64bin.codes[0];
+
+	return peep[k].data || HIGH(code) == I_HALT || HIGH(code) == I_RET ||
+		code == HPACK(I_JMP, C_YES);
+}
+
+/* peephole, layout: whether a line is a .pos or .align (of dtv) */
+static bool_t is_directive(line_t *line, dtv_t dtv)
+{
+	return line -> type == TYPE_INS && line -> y64bin.bytes == 0 &&
+		line -> y64bin.codes[0] == HPACK(I_DIRECTIVE, dtv);
+}
+
+/* peephole: mark line k to be deleted (or rewritten) from now on */
+static void peep_act(int k, peep_act_t action)
+{
+	peep[k].action = action;
+	if (action == P_DELETE) {
+		peep_deleted++;
+		peep_saved += peep[k].line -> y64bin.bytes;
+	} else {
+		peep_rewritten++;
+		peep_saved += 8;
+	}
+}
+
+/*
+ * peep_mark: peephole: find, in the code as assembled, the lines to
+ *     delete: a move of a register onto itself (rrmovq or cmovXX), a jump
+ *     to the next instruction; and to rewrite: irmovq $0 right before an
+ *     ALU op, as a xorq (the op sets the condition codes the xorq does)
+ *
+ * return
+ *     how many lines it found
+ */
+static int peep_mark(void)
+{
+	bool_t frozen = FALSE, reach = FALSE, barrier = FALSE;
+	int k, prev = -1, n = 0;
+
+	/*
+	 * the zeros an .align pads with, or a .pos skips, change with the code
+	 * before it (up to the .pos before that); where they may be run, as
+	 * halts, because the code before falls through to them or a label is
+	 * right before them, that code can't move
+	 */
+	for (k = npeep - 1; k >= 0; k--) {
+		line_t *line = peep[k].line;
+
+		if (is_directive(line, D_POS) || is_directive(line, D_ALIGN)) {
+			if (is_directive(line, D_POS)) {
+				frozen = FALSE;
+			}
+			reach = TRUE;
+		}
+		if (reach && peep[k].labeled) {
+			frozen = TRUE;
+			reach = FALSE;
+		} else if (reach && line -> y64bin.bytes > 0) {
+			frozen = frozen || !ends_flow(k);
+			reach = FALSE;
+		}
+		peep[k].frozen = frozen;
+	}
+
+	/* each line with code (not data), and the one run right before it (prev) */
+	for (k = 0; k <= npeep; k++) {
+		bin_t *y64bin = k < npeep ? &peep[k].line -> y64bin : NULL;
+
+		if (y64bin != NULL && (y64bin -> bytes == 0 || peep[k].data)) {
+			barrier = barrier || peep[k].data ||
+				is_directive(peep[k].line, D_POS) ||
+				is_directive(peep[k].line, D_ALIGN);
+			continue;
+		}
+
+		if (prev >= 0 && !barrier && peep[prev].simple && !peep[prev].frozen &&
+		    peep[prev].action == P_KEEP) {
+			peep_t *p = &peep[prev];
+			bin_t *pbin = &p -> line -> y64bin;
+			long imm;
+
+			memcpy(&imm, &pbin -> codes[2], sizeof(imm));
+
+			/* to a label between the two, or before the code of line k */
+			if (HIGH(pbin -> codes[0]) == I_JMP && p -> ref >= 0 &&
+			    p -> ref < maxdef && symtab[p -> ref].defined &&
+			    defline[p -> ref] > prev && defline[p -> ref] <= k &&
+			    symtab[p -> ref].addr == pbin -> addr + pbin -> bytes) {
+				peep_act(prev, P_DELETE);
+				n++;
+			} else if (pbin -> codes[0] == HPACK(I_IRMOVQ, F_NONE) &&
+				   p -> ref < 0 && imm == 0 && y64bin != NULL &&
+				   peep[k].simple && HIGH(y64bin -> codes[0]) == I_ALU) {
+				peep_act(prev, P_XOR);
+				n++;
+			}
+		}
+		if (y64bin == NULL) {
+			break;
+		}
+
+		if (peep[k].simple && !peep[k].frozen && peep[k].action == P_KEEP &&
+		    HIGH(y64bin -> codes[0]) == I_RRMOVQ &&
+		    HIGH(y64bin -> codes[1]) == LOW(y64bin -> codes[1])) {
+			peep_act(k, P_DELETE);
+			n++;
+		}
+		prev = k;
+		barrier = FALSE;
+	}
+
+	return n;
+}
+
+/*
+ * watch: the lines assembled so far, by text, in a chained hash table
+ * (the cached_t are in 'seen', all dropped when too many of them are of
+ * lines no longer in the file)
+ */
+cached_t **cache = NULL;
+int cachesize = 0;  /* a power of 2 */
+int ncached = 0;
+int nassembled = 0; /* lines assembled in this build */
+int nparsed = 0;    /* of them, those not found in the cache */
+int nlines = 0;     /* lines in the file, the last time it assembled */
+
+/*
+ * watch: the cached line each line was assembled as (NULL: it was parsed
+ * and not cached), in this build and in the last; most lines are where
+ * they were, give or take those added or removed before them ('shift'),
+ * so they are found without hashing them
+ */
+cached_t **used = NULL, **was = NULL;
+int nwas = 0, maxused = 0;
+int shift = 0;
+
+/* watch: keep what parsing 'line', from vmaddr 'start', did */
+static cached_t *add_cached(line_t *line, unsigned int h, int64_t start)
+{
+	cached_t *c = (cached_t *)arena_alloc(&seen, sizeof(cached_t));
+	int n = rec_nlabels + rec_nrefs, i;
+
+	c -> text = arena_strndup(&seen, line -> y64asm, line -> len);
+	c -> len = line -> len;
+	c -> hash = h;
+	c -> type = line -> type;
+	c -> y64bin = line -> y64bin;
+	if (c -> type == TYPE_INS) {
+		c -> y64bin.addr -= start;
+	}
+	c -> size = vmaddr - start;
+	c -> nlabels = rec_nlabels;
+	c -> nrefs = rec_nrefs;
+	c -> ids = (int *)arena_alloc(&seen, n * sizeof(int));
+	c -> offs = (int64_t *)arena_alloc(&seen, rec_nlabels * sizeof(int64_t));
+	for (i = 0; i < rec_nlabels; i++) {
+		c -> ids[i] = rec_labels[i];
+		c -> offs[i] = rec_offs[i] - start;
+	}
+	memcpy(c -> ids + rec_nlabels, rec_refs, rec_nrefs * sizeof(int));
+
+	/* double the table when it is full, moving every chain over */
+	if (ncached == cachesize) {
+		cached_t **old = cache, *next;
+		int oldsize = cachesize;
+
+		cachesize = cachesize ? 2 * cachesize : 1024;
+		cache = (cached_t **)calloc(cachesize, sizeof(cached_t *));
+		for (i = 0; i < oldsize; i++) {
+			for (; old[i]; old[i] = next) {
+				next = old[i] -> next;
+				old[i] -> next = cache[old[i] -> hash & (cachesize - 1)];
+				cache[old[i] -> hash & (cachesize - 1)] = old[i];
+			}
+		}
+		free(old);
+	}
+	c -> next = cache[h & (cachesize - 1)];
+	cache[h & (cachesize - 1)] = c;
+	ncached++;
+
+	return c;
+}
+
+/* watch: do again, at vmaddr, what the cached line c did */
+static type_t replay(line_t *line, cached_t *c)
+{
+	int i;
+
+	line -> type = c -> type;
+	line -> y64bin = c -> y64bin;
+	if (c -> type == TYPE_INS) {
+		line -> y64bin.addr += vmaddr;
+	}
+
+	for (i = 0; i < c -> nlabels; i++) {
+		symbol_t *s = &symtab[c -> ids[i]];
+
+		if (s -> defined) {
+			line -> type = TYPE_ERR;
+			err_print("Dup symbol:%s", s -> name);
+
+			return TYPE_ERR;
+		}
+		s -> addr = vmaddr + c -> offs[i];
+		s -> defined = TRUE;
+	}
+
+	for (i = c -> nlabels; i < c -> nlabels + c -> nrefs; i++) {
+		reloc_t *r = (reloc_t *)arena_alloc(&relocs, sizeof(reloc_t));
+
+		r -> sym = c -> ids[i];
+		r -> y64bin = &line -> y64bin;
+		r -> next = reltab -> next;
+		reltab -> next = r;
+	}
+
+	vmaddr += c -> size;
+	return line -> type;
+}
+
+/*
+ * assemble_line: watch: assemble a line as it was the last time its text
+ *     was seen, or parse it (and keep what it did, unless it is pinned)
+ * args
+ *     line: the line
+ *
+ * return
+ *     its type, as parse_line()
+ */
+static type_t assemble_line(line_t *line)
+{
+	int i = nassembled++;
+	int64_t start = vmaddr;
+	unsigned int h = 0;
+	cached_t *c = NULL;
+	type_t type;
+
+	if (i == maxused) {
+		maxused = maxused ? 2 * maxused : 1024;
+		used = (cached_t **)realloc(used, maxused * sizeof(cached_t *));
+		was = (cached_t **)realloc(was, maxused * sizeof(cached_t *));
+	}
+
+	/* the line where it was, or any line of the same text */
+	if (i + shift >= 0 && i + shift < nwas) {
+		c = was[i + shift];
+	}
+	if (c == NULL || c -> len != line -> len ||
+	    memcmp(c -> text, line -> y64asm, line -> len)) {
+		h = hash_name(line -> y64asm, line -> len);
+		for (c = ncached ? cache[h & (cachesize - 1)] : NULL; c; c = c -> next) {
+			if (c -> hash == h && c -> len == line -> len &&
+			    !memcmp(c -> text, line -> y64asm, line -> len)) {
+				shift = c -> at - i;
+				break;
+			}
+		}
+	}
+
+	if (c != NULL) {
+		type = replay(line, c);
+	} else {
+		rec_nlabels = rec_nrefs = 0;
+		pinned = FALSE;
+		type = parse_line(line);
+		nparsed++;
+		if (type != TYPE_ERR && !pinned) {
+			c = add_cached(line, h ? h : hash_name(line -> y64asm, line -> len), start);
+		}
+	}
+
+	if (c != NULL) {
+		c -> at = i;
+	}
+	used[i] = c;
+	return type;
+}
+
+/*
+ * assemble: assemble y64 code (e.g., the text of 'asum.ys')
+ * args
+ *     text: point to the code, followed by a '\0'
+ *     len: the length of the code
+ *
+ * return
+ *     0: success, assmble the y64 code to a list of line_t (streaming:
+ *        write out the code of each line instead)
+ *     -1: error, try to print err information (e.g., instr type and line number)
+ */
+int assemble(char *text, long len)
+{
+    static line_t one; /* streaming: the line being assembled */
+    char *end = text + len, *eol;
+    line_t *line;
+
+    /* split the code into lines, and parse them to generate raw y64 binary code list */
+    for (; text < end; text = eol + 1) {
+        eol = memchr(text, '\n', end - text);
+        if (eol == NULL) {
+            eol = end;
+        }
+
+        if (stream) {
+            line = &one;
+            memset(line, '\0', sizeof(line_t));
+        } else {
+            line = (line_t *)arena_alloc(&lines, sizeof(line_t)); // free in finit
+            line_tail->next = line;
+            line_tail = line;
+        }
+
+        /* the line is kept where it is in the text */
+        line->type = TYPE_COMM;
+        line->y64asm = text;
+        line->len = eol - text;
+        while (line->len > 0 && text[line->len - 1] == '\r') {
+            line->len--;
+        }
+        lineno ++;
+	
+        if ((watching ? assemble_line(line) :
+             optimize || profname || costs ? peep_line(line) :
+             parse_line(line)) == TYPE_ERR) {
+            return -1;
+        }
+
+        if (stream) {
+            place_line(line);
+            drop_source(eol);
+        }
+    }
+
+	lineno = -1;
+    return 0;
+}
+
+/*
+ * peephole: optimize the assembled code (see peep_mark()), assembling it
+ *     again until there is nothing left to do, and report what it saved
+ * args
+ *     text, len: the code, as given to assemble()
+ *
+ * return
+ *     0: success
+ *     -1: error
+ */
+int peephole(char *text, long len)
+{
+	int passes = 1;
+
+	while (peep_mark() > 0) {
+		reset();
+		if (assemble(text, len) < 0) {
+			return -1;
+		}
+		passes++;
+	}
+
+	fprintf(stderr, "Peephole: %d instructions deleted, %d rewritten, "
+		"%ld bytes saved (%d passes)\n", peep_deleted, peep_rewritten,
+		peep_saved, passes);
+
+	return 0;
+}
+
+/*
+ * layout (-P): the counts at each PC of a run of the code (y64sim -p of
+ * it as assembled without -P or -O), by PC
+ */
+pcount_t *pcs = NULL;
+int npcs = 0;
+
+/* layout: the basic blocks, in the order of their lines, and the block of each line (-1: none) */
+block_t *blk = NULL;
+int nblk = 0;
+int *blockof = NULL;
+
+/* layout: the code laid out, as text to assemble (freed in finit) */
+char *laid = NULL;
+long nlaid = 0, maxlaid = 0;
+
+/* layout: what it has done, and the cycles that saves on PIPE by the profile */
+int lay_moved = 0, lay_flipped = 0, lay_added = 0, lay_dropped = 0;
+long lay_saved = 0;
+
+/* layout: how a block ends: falling through, with a jmp, a jXX, or neither (ret, halt) */
+typedef enum { END_FALL, END_JMP, END_COND, END_STOP } blkend_t;
+
+/* layout: the jXX that jumps when jXX (cond) does not */
+static const cond_t flip_cond[] = { C_YES, C_G, C_GE, C_NE, C_E, C_L, C_LE };
+
+static int cmp_pcount(const void *a, const void *b)
+{
+	const pcount_t *x = (const pcount_t *)a, *y = (const pcount_t *)b;
+
+	return x -> pc < y -> pc ? -1 : x -> pc > y -> pc;
+}
+
+/* layout: the counts at 'pc', NULL if it never ran */
+static pcount_t *find_pcount(int64_t pc)
+{
+	pcount_t key;
+
+	/* no profile (-C) */
+	if (npcs == 0) {
+		return NULL;
+	}
+	key.pc = pc;
+	return (pcount_t *)bsearch(&key, pcs, npcs, sizeof(pcount_t), cmp_pcount);
+}
+
+/*
+ * read_profile: layout: read the counts y64sim -p wrote to a .pcprof file
+ * args
+ *     name: the file
+ *
+ * return
+ *     0: success
+ *     -1: error (it is printed)
+ */
+static int read_profile(char *name)
+{
+	FILE *f = fopen(name, "r");
+	char buf[256];
+	int maxpcs = 0, n = 0;
+	long pc;
+
+	if (f == NULL) {
+		err_print("Can't open profile '%s'", name);
+		return -1;
+	}
+
+	while (fgets(buf, sizeof(buf), f) != NULL) {
+		pcount_t *c;
+
+		n++;
+		if (buf[0] == '#' || buf[0] == '\n') {
+			continue;
+		}
+		if (npcs == maxpcs) {
+			maxpcs = maxpcs ? 2 * maxpcs : 1024;
+			pcs = (pcount_t *)realloc(pcs, maxpcs * sizeof(pcount_t));
+		}
+		c = &pcs[npcs];
+		if (sscanf(buf, "%li %ld %ld %ld", &pc, &c -> count, &c -> taken,
+			   &c -> not_taken) != 4) {
+			err_print("Bad line %d in profile '%s'", n, name);
+			fclose(f);
+			return -1;
+		}
+		c -> pc = pc;
+		c -> line = -1;
+		npcs++;
+	}
+	fclose(f);
+
+	qsort(pcs, npcs, sizeof(pcount_t), cmp_pcount);
+	return 0;
+}
+
+/* layout: the name of the instruction with code 'code' */
+static char *instr_name(byte_t code)
+{
+	instr_t *i;
+
+	for (i = instr_set; i -> name != NULL && i -> code != code; i++)
+		;
+	return i -> name;
+}
+
+/* layout: how block b ends */
+static blkend_t block_end(block_t *b)
+{
+	byte_t code;
+
+	if (b -> term < 0) {
+		return END_FALL;
+	}
+	code = peep[b -> term].line -> y64bin.codes[0];
+	if (code == HPACK(I_JMP, C_YES)) {
+		return END_JMP;
+	}
+	if (HIGH(code) == I_JMP) {
+		return END_COND;
+	}
+	if (HIGH(code) == I_HALT || HIGH(code) == I_RET) {
+		return END_STOP;
+	}
+	return END_FALL;
+}
+
+/*
+ * split_blocks: layout: split the lines assembled into basic blocks, each
+ *     from a label, or from the code after a jump, ret or halt, to the
+ *     next; the lines of data, .pos and .align are in none, and split the
+ *     blocks into segments, which the blocks do not move out of
+ */
+static void split_blocks(void)
+{
+	int *label = (int *)malloc((npeep + 1) * sizeof(int));
+	int k, i, cur = -1;
+
+	/* a label defined on each line, -1 if none */
+	for (k = 0; k < npeep; k++) {
+		label[k] = -1;
+	}
+	for (i = 0; i < nsyms && i < maxdef; i++) {
+		if (symtab[i].defined) {
+			label[defline[i]] = i;
+		}
+	}
+
+	blk = (block_t *)realloc(blk, (npeep + 1) * sizeof(block_t));
+	blockof = (int *)realloc(blockof, (npeep + 1) * sizeof(int));
+	nblk = 0;
+	for (k = 0; k < npeep; k++) {
+		line_t *line = peep[k].line;
+		bin_t *y64bin = &line -> y64bin;
+		bool_t code = line -> type == TYPE_INS && y64bin -> bytes > 0;
+		pcount_t *c;
+		block_t *b;
+
+		if (peep[k].data || is_directive(line, D_POS) || is_directive(line, D_ALIGN)) {
+			blockof[k] = cur = -1;
+			continue;
+		}
+
+		if (cur < 0 || (blk[cur].term >= 0 && (peep[k].labeled ||
+		    (code && block_end(&blk[cur]) != END_FALL)))) {
+			cur = nblk++;
+			b = &blk[cur];
+			memset(b, 0, sizeof(block_t));
+			b -> first = k;
+			b -> term = b -> fall = b -> target = -1;
+			b -> prev = b -> next = -1;
+			b -> chain = b -> head = b -> tail = cur;
+		}
+		b = &blk[cur];
+		b -> last = k;
+		blockof[k] = cur;
+
+		if (b -> term < 0 && b -> label == NULL && label[k] >= 0) {
+			b -> label = symtab[label[k]].name;
+		}
+		if (code) {
+			c = find_pcount(y64bin -> addr);
+			if (b -> term < 0) {
+				b -> count = c ? c -> count : 0;
+			}
+			b -> term = k;
+			b -> taken = c ? c -> taken : 0;
+			b -> not_taken = c ? c -> not_taken : 0;
+		}
+	}
+	free(label);
+
+	/* where each goes next: the block after it, in its segment, and the one it jumps to */
+	for (i = 0; i < nblk; i++) {
+		block_t *b = &blk[i];
+		blkend_t end = block_end(b);
+		int ref = b -> term >= 0 ? peep[b -> term].ref : -1;
+
+		if ((end == END_FALL || end == END_COND) && i + 1 < nblk &&
+		    blk[i + 1].first == b -> last + 1) {
+			b -> fall = i + 1;
+		}
+		if ((end == END_JMP || end == END_COND) && ref >= 0 && ref < maxdef &&
+		    symtab[ref].defined) {
+			b -> target = blockof[defline[ref]];
+		}
+	}
+}
+
+static int find_chain(int b)
+{
+	while (blk[b].chain != b) {
+		blk[b].chain = blk[blk[b].chain].chain;
+		b = blk[b].chain;
+	}
+	return b;
+}
+
+static int cmp_edge(const void *a, const void *b)
+{
+	const edge_t *x = (const edge_t *)a, *y = (const edge_t *)b;
+
+	if (x -> weight != y -> weight) {
+		return x -> weight < y -> weight ? 1 : -1;
+	}
+	return x -> from - y -> from;
+}
+
+/* layout: add the chain that starts with block b to ord, from n on */
+static int put_chain(int b, int *ord, int n)
+{
+	for (; b >= 0; b = blk[b].next) {
+		ord[n++] = b;
+	}
+	return n;
+}
+
+/* layout: whether any block of the chain that starts with block b ran */
+static bool_t chain_ran(int b)
+{
+	for (; b >= 0; b = blk[b].next) {
+		if (blk[b].count > 0) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/*
+ * order_blocks: layout: order the blocks of a segment: put next to each
+ *     other those that save the most cycles on PIPE for it, as chains,
+ *     heaviest first; then the segment's first chain, the chains that
+ *     ran, those that did not, and the chain the segment's last block
+ *     ends, each lot in the order of the lines
+ * args
+ *     b0, b1: the blocks of the segment are b0 to b1 - 1
+ *     last: the block that must stay last (the code after it falls
+ *           through out of the segment), -1 if none
+ *     ord: (out) the blocks, in their new order
+ */
+static void order_blocks(int b0, int b1, int last, int *ord)
+{
+	edge_t *edges = (edge_t *)malloc((b1 - b0 + 1) * sizeof(edge_t));
+	int nedges = 0, n = 0, i, b, pass;
+
+	/*
+	 * what running into a block, rather than jumping to it, saves, as
+	 * PIPE predicts that every jump is taken: a jmp (a cycle), each
+	 * time the block before falls through or jumps to it; and for a jXX,
+	 * only for its colder way: the other is best jumped to, even if it
+	 * needs a jmp of its own, as a jXX not taken costs two bubbles
+	 */
+	for (b = b0; b < b1; b++) {
+		block_t *p = &blk[b];
+		edge_t *e = &edges[nedges];
+
+		switch (block_end(p)) {
+			case END_FALL:
+				e -> to = p -> fall;
+				e -> weight = p -> count;
+				break;
+			case END_JMP:
+				e -> to = p -> target;
+				e -> weight = p -> count;
+				break;
+			case END_COND:
+				e -> to = p -> not_taken <= p -> taken ? p -> fall : p -> target;
+				e -> weight = p -> not_taken <= p -> taken ? p -> not_taken : p -> taken;
+				break;
+			default:
+				continue;
+		}
+		/* blocks that never ran are left out of the way of those that did */
+		if (e -> to < b0 || e -> to >= b1 || e -> to == b ||
+		    (e -> weight == 0 && p -> count > 0)) {
+			continue;
+		}
+		e -> from = b;
+		nedges++;
+	}
+	qsort(edges, nedges, sizeof(edge_t), cmp_edge);
+
+	/* join the chains, never putting a block before the first or after the last */
+	for (i = 0; i < nedges; i++) {
+		int from = edges[i].from, to = edges[i].to;
+		int cf = find_chain(from), ct = find_chain(to);
+
+		if (blk[from].next >= 0 || blk[to].prev >= 0 || to == b0 ||
+		    from == last || cf == ct ||
+		    (cf == find_chain(b0) && last >= 0 && ct == find_chain(last))) {
+			continue;
+		}
+		blk[from].next = to;
+		blk[to].prev = from;
+		blk[ct].chain = cf;
+		blk[cf].tail = blk[ct].tail;
+	}
+	free(edges);
+
+	n = put_chain(b0, ord, n);
+	for (pass = 1; pass >= 0; pass--) {
+		for (b = b0 + 1; b < b1; b++) {
+			if (blk[b].prev < 0 && (last < 0 || find_chain(b) != find_chain(last)) &&
+			    chain_ran(b) == pass) {
+				n = put_chain(b, ord, n);
+			}
+		}
+	}
+	if (last >= 0 && find_chain(last) != find_chain(b0)) {
+		n = put_chain(blk[find_chain(last)].head, ord, n);
+	}
+}
+
+/* layout: the label of block b, made up if it has none */
+static char *block_label(block_t *b)
+{
+	static int nmade = 0;
+	char name[32];
+
+	if (b -> label == NULL) {
+		do {
+			snprintf(name, sizeof(name), "Block%d", nmade++);
+		} while (symhash[hash_slot(name)]);
+		b -> label = arena_strndup(&pool, name, strlen(name));
+		b -> made = TRUE;
+	}
+	return b -> label;
+}
+
+/*
+ * plan_block: layout: how block b ends, now that 'next' comes after it
+ *     (-1: nothing in its segment): whether its jmp goes, its jXX is
+ *     made the opposite one, and it needs a jmp to where it went before
+ *
+ * return
+ *     the cycles that saves on PIPE, by the profile
+ */
+static long plan_block(block_t *b, int next)
+{
+	long t = b -> taken, nt = b -> not_taken, keep, flip;
+	bool_t fadj = b -> fall == next, tadj = b -> target >= 0 && b -> target == next;
+
+	switch (block_end(b)) {
+		case END_FALL:
+			if (b -> fall >= 0 && !fadj) {
+				b -> jump = block_label(&blk[b -> fall]);
+				lay_added++;
+				return -b -> count;
+			}
+			return 0;
+
+		case END_JMP:
+			if (tadj && !peep[b -> term].labeled) {
+				b -> drop = TRUE;
+				lay_dropped++;
+				return b -> count;
+			}
+			return 0;
+
+		case END_COND:
+			/* a jXX not taken costs two bubbles, a jmp a cycle */
+			keep = t + 3 * nt + (fadj ? 0 : nt);
+			flip = nt + 3 * t + (tadj ? 0 : t);
+			if (b -> fall >= 0 && (flip < keep || (flip == keep && tadj && !fadj))) {
+				b -> flip = TRUE;
+				lay_flipped++;
+				block_label(&blk[b -> fall]);
+				if (!tadj) {
+					b -> jump = symtab[peep[b -> term].ref].name;
+					lay_added++;
+				}
+				return t + 3 * nt - flip;
+			}
+			if (!fadj) {
+				b -> jump = block_label(&blk[b -> fall]);
+				lay_added++;
+			}
+			return t + 3 * nt - keep;
+
+		default:
+			return 0;
+	}
+}
+
+/* layout: add to the text laid out */
+static void lay_put(const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(laid + nlaid, maxlaid - nlaid, fmt, ap);
+		va_end(ap);
+		if (nlaid + n < maxlaid) {
+			break;
+		}
+		maxlaid = 2 * maxlaid + n + 1;
+		laid = (char *)realloc(laid, maxlaid);
+	}
+	nlaid += n;
+}
+
+/* layout: add block b, as planned, to the text laid out */
+static void put_block(block_t *b)
+{
+	int k;
+
+	if (b -> made) {
+		lay_put("%s:\n", b -> label);
+	}
+	for (k = b -> first; k <= b -> last; k++) {
+		line_t *line = peep[k].line;
+		int i, gap, len = 0;
+
+		if (k == b -> term && b -> drop) {
+			continue;
+		}
+		if (k != b -> term || !b -> flip) {
+			lay_put("%.*s\n", line -> len, line -> y64asm);
+			continue;
+		}
+
+		/* the opposite jXX, where the line has its jXX: after its label
+		   and indent, and with the blanks it has before its comment */
+		for (i = 0; i < line -> len && line -> y64asm[i] != '#'; i++) {
+			if (line -> y64asm[i] == ':') {
+				len = i + 1;
+			}
+		}
+		while (len < i && IS_BLANK(line -> y64asm + len)) {
+			len++;
+		}
+		gap = i;
+		while (gap > len && IS_BLANK(line -> y64asm + gap - 1)) {
+			gap--;
+		}
+		if (i == line -> len) {
+			gap = i;
+		}
+		lay_put("%.*s%s %s%s%.*s\n", len, line -> y64asm,
+			instr_name(HPACK(I_JMP, flip_cond[LOW(line -> y64bin.codes[0])])),
+			blk[b -> fall].label, gap < line -> len && gap == i ? " " : "",
+			line -> len - gap, line -> y64asm + gap);
+	}
+	if (b -> jump != NULL) {
+		lay_put("\tjmp %s\n", b -> jump);
+	}
+}
+
+/* layout: how many .pos the code before runs past, as assembled */
+static int overruns(void)
+{
+	line_t *line;
+	int64_t end = 0;
+	int n = 0;
+
+	for (line = line_head -> next; line != NULL; line = line -> next) {
+		if (is_directive(line, D_POS)) {
+			n += end > line -> y64bin.addr;
+			end = 0;
+		} else if (line -> type == TYPE_INS && line -> y64bin.bytes > 0 &&
+			   line -> y64bin.addr + line -> y64bin.bytes > end) {
+			end = line -> y64bin.addr + line -> y64bin.bytes;
+		}
+	}
+	return n;
+}
+
+/*
+ * layout: lay the basic blocks of the assembled code out by a profile of
+ *     it, for PIPE, and assemble it again: in each segment (see
+ *     split_blocks()), the blocks that run one after the other most go
+ *     next to each other, each jXX is made to jump the way it goes most
+ *     (as PIPE predicts it does), and the blocks that never ran go last,
+ *     with a jmp added wherever a block no longer falls through to the
+ *     one it did; code that jumps to a numeric address, or a profile
+ *     that is not of the code, leaves it as it is
+ * args
+ *     text, len: the code, as given to assemble(); (out) the code laid
+ *                out, if it was
+ *
+ * return
+ *     0: success
+ *     -1: error
+ */
+int layout(char **text, long *len)
+{
+	int *ord = NULL;
+	int k, b0, b1, i, before = overruns();
+	pcount_t *c;
+
+	if (read_profile(profname) < 0) {
+		return -1;
+	}
+
+	/* code that jumps or calls by number (not by label) can't move */
+	for (k = 0; k < npeep; k++) {
+		bin_t *y64bin = &peep[k].line -> y64bin;
+
+		if (peep[k].line -> type != TYPE_INS || y64bin -> bytes == 0 || peep[k].data) {
+			continue;
+		}
+		if ((HIGH(y64bin -> codes[0]) == I_JMP || HIGH(y64bin -> codes[0]) == I_CALL) &&
+		    peep[k].ref < 0) {
+			fprintf(stderr, "Layout: line %d jumps to a numeric address, "
+				"the code is left as it is\n", k + 1);
+			return 0;
+		}
+		if ((c = find_pcount(y64bin -> addr)) != NULL) {
+			c -> line = k;
+		}
+	}
+	for (i = 0; i < npcs; i++) {
+		if (pcs[i].line < 0) {
+			fprintf(stderr, "Layout: the profile is not of this code (no "
+				"instruction at 0x%lx), the code is left as it is\n", (long)pcs[i].pc);
+			return 0;
+		}
+	}
+
+	split_blocks();
+	ord = (int *)malloc((nblk + 1) * sizeof(int));
+
+	for (k = 0; k < npeep; k++) {
+		int last = -1;
+
+		if (blockof[k] < 0) {
+			lay_put("%.*s\n", peep[k].line -> len, peep[k].line -> y64asm);
+			continue;
+		}
+
+		/* the segment: blocks b0 to b1 - 1, and the line after it */
+		b0 = blockof[k];
+		for (b1 = b0 + 1; b1 < nblk && blk[b1].first == blk[b1 - 1].last + 1; b1++)
+			;
+		k = blk[b1 - 1].last + 1;
+
+		/*
+		 * its last block falls through out of it (or a label is right
+		 * before what follows), into zeros that .pos or .align pad with,
+		 * as many as there is room for: it can't change size; else the
+		 * block stays last
+		 */
+		if (blk[b1 - 1].fall < 0 && block_end(&blk[b1 - 1]) != END_JMP &&
+		    block_end(&blk[b1 - 1]) != END_STOP) {
+			last = b1 - 1;
+		}
+		if (k < npeep && (is_directive(peep[k].line, D_POS) ||
+		    is_directive(peep[k].line, D_ALIGN)) &&
+		    (last >= 0 || peep[k].labeled)) {
+			b1 = b0 + 1;
+		}
+
+		if (b1 - b0 < 2) {
+			for (i = blk[b0].first; i < k; i++) {
+				lay_put("%.*s\n", peep[i].line -> len, peep[i].line -> y64asm);
+			}
+		} else {
+			order_blocks(b0, b1, last, ord);
+			for (i = 0; i < b1 - b0; i++) {
+				lay_saved += plan_block(&blk[ord[i]], i + 1 < b1 - b0 ? ord[i + 1] : -1);
+				if (ord[i] != (i ? ord[i - 1] + 1 : b0)) {
+					lay_moved++;
+				}
+			}
+			for (i = 0; i < b1 - b0; i++) {
+				put_block(&blk[ord[i]]);
+			}
+		}
+		k--;
+	}
+	free(ord);
+
+	/* then assemble it again, unless it would not change, or runs past a .pos */
+	if (lay_moved + lay_flipped + lay_added + lay_dropped > 0) {
+		npeep = 0;
+		reset();
+		if (assemble(laid, nlaid) < 0 || overruns() > before) {
+			fprintf(stderr, "Layout: the code laid out runs past a .pos, "
+				"it is left as it is\n");
+			lay_moved = lay_flipped = lay_added = lay_dropped = 0;
+			lay_saved = 0;
+			npeep = 0;
+			reset();
+			return assemble(*text, *len);
+		}
+		*text = laid;
+		*len = nlaid;
+	}
+
+	fprintf(stderr, "Layout: %d blocks moved, %d jumps inverted, %d added, "
+		"%d deleted (about %ld cycles fewer on PIPE)\n", lay_moved,
+		lay_flipped, lay_added, lay_dropped, lay_saved);
+	return 0;
+}
+
+/*
+ * relocate: relocate the raw y64 binary code with symbol address
+ *
+ * return
+ *     0: success
+ *     -1: error, try to print err information (e.g., addr and symbol)
+ */
+int relocate(void)
+{
+	// initialisaton	
+	reloc_t *rtmp = reltab -> next;
+
+	/* streaming: the references still pending are to unknown symbols */
+	if (stream) {
+		fixup_t *f, *last = NULL;
+		int i;
+
+		for (i = 0; i < nsyms; i++) {
+			for (f = symtab[i].pending; f != NULL; f = f -> next) {
+				if (last == NULL || f -> seq > last -> seq) {
+					last = f;
+				}
+			}
+		}
+
+		/* the last one, as below */
+		if (last != NULL) {
+			err_print("Unknown symbol:'%s'", symtab[last -> sym].name);
+
+			return -1;
+		}
+
+		return 0;
+	}
+
+    	while (rtmp) {
+        	/* find symbol, by ID */
+		symbol_t *s = &symtab[rtmp -> sym];
+
+		if (!s -> defined) {
+			err_print("Unknown symbol:'%s'", s -> name);
+
+			return -1;
+		}
+
+		/* relocate y64bin according itype */
+		long *a = (long *)&rtmp -> y64bin -> codes[reloc_field(rtmp -> y64bin)];
+
+		*a = s -> addr;
+		rtmp = rtmp -> next;
+	}
+
+	return 0;
+}
+
+/*
+ * build_image: lay the code of all lines out in an image: each at the
+ *     address of its line, padded with zeros up to it, unless no code
+ *     follows the line; otherwise right after the code before it
+ * args
+ *     len: point to the length of the image
+ *
+ * return
+ *     the image (free it), NULL if out of memory
+ */
+static byte_t *build_image(long *len)
+{
+	line_t *line, *last = NULL;
+	long pos = 0, base = 0, cap = 4096;
+	byte_t *image = (byte_t *)calloc(cap, sizeof(byte_t)), *p;
+
+	for (line = line_head; line != NULL && image != NULL; line = line -> next) {
+		bin_t *y64bin = &line -> y64bin;
+
+		/* where the code goes if no code follows it */
+		if (y64bin -> bytes != 0) {
+			base = pos;
+			last = line;
+		}
+		if (pos < y64bin -> addr) {
+			pos = y64bin -> addr;
+		}
+		if (y64bin -> bytes == 0) {
+			continue;
+		}
+
+		/* the zeros up to addr are already in the image */
+		if (pos + y64bin -> bytes > cap) {
+			long n = cap;
+
+			while (pos + y64bin -> bytes > n) {
+				n *= 2;
+			}
+			p = (byte_t *)realloc(image, n);
+			if (p != NULL) {
+				memset(p + cap, 0, n - cap);
+				cap = n;
+			}
+			image = p;
+			if (image == NULL) {
+				break;
+			}
+		}
+		memcpy(image + pos, y64bin -> codes, y64bin -> bytes);
+		y64bin -> pos = pos;
+		pos += y64bin -> bytes;
+	}
+	if (image == NULL) {
+		return NULL;
+	}
+
+	/* the last line with code gets no padding */
+	*len = 0;
+	if (last != NULL) {
+		bin_t *y64bin = &last -> y64bin;
+
+		memmove(image + base, image + y64bin -> pos, y64bin -> bytes);
+		y64bin -> pos = base;
+		*len = base + y64bin -> bytes;
+	}
+
+	return image;
 }
 
 /*
@@ -1036,52 +2639,131 @@ int relocate(void)
  */
 int binfile(FILE *out)
 {
-	// declarations	
-	line_t *line = line_head;
-	int currentPosition = 0;
-
-	/* prepare image with y64 binary code */
-	while (line != NULL) {
-		// initialisation
-		line_t *line2 = line;
-		line2 = line2 -> next;
-		bool_t endCheck = 0; // error if using mere bool type, so use bool_t instead
-		
-		// do loop to iterate to all possible binaries
-		while (line2 != NULL) {
-			if (line2 -> y64bin.bytes != 0) {
-				endCheck = 1;
-				break;
-			} else {
-				line2 = line2 -> next;
-			}
+	// declarations
+	byte_t *image;
+	long len;
+	int ret = 0;
+
+	/* streaming: the code is out, but the last line with code goes right
+	 * after the code before it, as build_image() puts it */
+	if (stream) {
+		byte_t codes[sizeof(line_head -> y64bin.codes)];
+
+		out_flush();
+		if (last_at != last_base &&
+		    (pread(out_fd, codes, last_bytes, last_at) != last_bytes ||
+		     pwrite(out_fd, codes, last_bytes, last_base) != last_bytes ||
+		     ftruncate(out_fd, last_base + last_bytes) < 0)) {
+			out_failed = TRUE;
 		}
-		
-		// do required checking
-		if (currentPosition < line -> y64bin.addr && endCheck) {
-			int positionShift = line -> y64bin.addr - currentPosition;
-			
-			// fprintf to send formatted output into a stream for latter use
-			for (int i = 0; i < positionShift; i++) {
-				fprintf(out, "%c", 0);	
-			}
 
-			currentPosition = line -> y64bin.addr; // go to next address position
+		return out_failed ? -1 : 0;
+	}
+
+	/* prepare image with y64 binary code, then write it at once */
+	image = build_image(&len);
+	if (image == NULL) {
+		return -1;
+	}
+
+	if (fwrite(image, sizeof(byte_t), len, out) != len) {
+		ret = -1;
+	}
+	free(image);
+
+	return ret;
+}
+
+/*
+ * objfile: generate a relocatable object (see y64obj.h): the image
+ *     binfile() would write, with the addresses of symbols left out, and
+ *     the symbols and relocations for y64ld to patch them in
+ * args
+ *     out: point to output file (an y64 object file)
+ *
+ * return
+ *     0: success
+ *     -1: error
+ */
+int objfile(FILE *out)
+{
+	// declarations
+	obj_hdr_t hdr;
+	obj_sym_t *syms;
+	obj_reloc_t *relocs;
+	reloc_t *rtmp;
+	byte_t *image;
+	long len;
+	int i, n = 0;
+
+	image = build_image(&len);
+	for (rtmp = reltab -> next; rtmp; rtmp = rtmp -> next) {
+		n++;
+	}
+	syms = (obj_sym_t *)calloc(nsyms + 1, sizeof(obj_sym_t));
+	relocs = (obj_reloc_t *)calloc(n + 1, sizeof(obj_reloc_t));
+	if (image == NULL || syms == NULL || relocs == NULL) {
+		free(image);
+		free(syms);
+		free(relocs);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, OBJ_MAGIC, sizeof(OBJ_MAGIC));
+	hdr.version = OBJ_VERSION;
+	hdr.nsyms = nsyms;
+	hdr.size = len;
+	hdr.extent = len > vmaddr ? len : vmaddr;
+
+	/* the symbols, with their names one after another */
+	for (i = 0; i < nsyms; i++) {
+		syms[i].name = hdr.strsize;
+		syms[i].defined = symtab[i].defined;
+		syms[i].addr = symtab[i].addr;
+		hdr.strsize += strlen(symtab[i].name) + 1;
+
+		if (symtab[i].defined && symtab[i].addr > hdr.extent) {
+			hdr.extent = symtab[i].addr;
+		}
+	}
+
+	/* where each address goes: only the bytes of its line are written */
+	for (rtmp = reltab -> next; rtmp; rtmp = rtmp -> next) {
+		bin_t *y64bin = rtmp -> y64bin;
+		int field = reloc_field(y64bin);
+
+		if (field >= y64bin -> bytes) {
+			continue;
 		}
+		relocs[hdr.nrelocs].off = y64bin -> pos + field;
+		relocs[hdr.nrelocs].sym = rtmp -> sym;
+		relocs[hdr.nrelocs].size = y64bin -> bytes - field < 8 ? y64bin -> bytes - field : 8;
+		hdr.nrelocs++;
+	}
 
-		/* binary write y64 code to output file (NOTE: see fwrite()) */
-		fwrite(line -> y64bin.codes, sizeof(byte_t), line -> y64bin.bytes, out); // write binary codes to output file
-		currentPosition += line -> y64bin.bytes;
-		line = line -> next;
+	fwrite(&hdr, sizeof(hdr), 1, out);
+	fwrite(image, sizeof(byte_t), len, out);
+	fwrite(syms, sizeof(obj_sym_t), nsyms, out);
+	fwrite(relocs, sizeof(obj_reloc_t), hdr.nrelocs, out);
+	for (i = 0; i < nsyms; i++) {
+		fwrite(symtab[i].name, 1, strlen(symtab[i].name) + 1, out);
 	}
 
-	return 0;
+	free(image);
+	free(syms);
+	free(relocs);
+
+	return ferror(out) ? -1 : 0;
 }
 
 
 /* whether print the readable output to screen or not ? */
 bool_t screen = FALSE; 
 
+/* whether generate a relocatable object (.obj) instead of a .bin file */
+bool_t object = FALSE;
+
 static void hexstuff(char *dest, int value, int len)
 {
     int i;
@@ -1112,7 +2794,7 @@ void print_line(line_t *line)
         strcpy(buf, "                              | ");
     }
 
-    printf("%s%s\n", buf, line->y64asm);
+    printf("%s%.*s\n", buf, line->len, line->y64asm);
 }
 
 /* 
@@ -1128,55 +2810,385 @@ void print_screen(void)
     }
 }
 
+/* -C: whether line k has an instruction (not data) */
+static bool_t is_code(int k)
+{
+    return peep[k].line->type == TYPE_INS && peep[k].line->y64bin.bytes > 0 &&
+        !peep[k].data;
+}
+
+/* -C: whether the code of 'line' reads register 'reg' (on PIPE, as decode does) */
+static bool_t reads_reg(line_t *line, regid_t reg)
+{
+    byte_t rA = HIGH(line->y64bin.codes[1]), rB = LOW(line->y64bin.codes[1]);
+
+    switch (HIGH(line->y64bin.codes[0])) {
+      case I_RRMOVQ:
+        return rA == reg;
+      case I_RMMOVQ:
+      case I_ALU:
+      case I_ATOMIC:
+        return rA == reg || rB == reg;
+      case I_MRMOVQ:
+        return rB == reg;
+      case I_PUSHQ:
+        return rA == reg || reg == REG_RSP;
+      case I_POPQ:
+      case I_CALL:
+      case I_RET:
+        return reg == REG_RSP;
+      default:
+        return FALSE;
+    }
+}
+
+/*
+ * line_cost: -C: the cycles the code of line k takes on PIPE (with a
+ *     jXX, if taken; it takes two more if not, as PIPE predicts every
+ *     jump taken), and what costs more than a cycle, in 'note'
+ */
+static int line_cost(int k, char *note, int size)
+{
+    bin_t *y64bin = &peep[k].line->y64bin;
+    byte_t code = y64bin->codes[0];
+    int n;
+
+    note[0] = '\0';
+    switch (HIGH(code)) {
+      case I_MRMOVQ:
+      case I_POPQ:
+        /* load/use: the next instruction reads what it loads */
+        for (n = k + 1; n < npeep && peep[n].line->y64bin.bytes == 0 &&
+             !is_directive(peep[n].line, D_POS) &&
+             !is_directive(peep[n].line, D_ALIGN); n++)
+            ;
+        if (n < npeep && is_code(n) &&
+            reads_reg(peep[n].line, HIGH(y64bin->codes[1]))) {
+            snprintf(note, size, "load/use %s", reg_table[HIGH(y64bin->codes[1])].name);
+            return 2;
+        }
+        return 1;
+      case I_RET:
+        snprintf(note, size, "ret bubbles");
+        return 4;
+      case I_JMP:
+        if (code != HPACK(I_JMP, C_YES) && peep[k].ref >= 0 &&
+            symtab[peep[k].ref].addr > y64bin->addr)
+            snprintf(note, size, "forward jump");
+        return 1;
+      default:
+        return 1;
+    }
+}
+
+/*
+ * print_costs: -C: print the readable output, with what each instruction
+ *     costs on PIPE, and what each basic block in a loop costs in all;
+ *     a block is in a loop from one a later one jumps back to
+ */
+void print_costs(void)
+{
+    bool_t *loop = NULL;
+    char note[32], cyc[16];
+    int k, b, t, ninstr = 0, nload = 0, nret = 0, ncond = 0, nforward = 0;
+
+    split_blocks();
+    loop = (bool_t *)calloc(nblk + 1, sizeof(bool_t));
+    for (b = 0; b < nblk; b++)
+        if (blk[b].target >= 0 && blk[b].target <= b)
+            for (t = blk[b].target; t <= b; t++)
+                loop[t] = TRUE;
+
+    for (k = 0; k < npeep; k++) {
+        line_t *line = peep[k].line;
+        bin_t *y64bin = &line->y64bin;
+        bool_t cond = HIGH(y64bin->codes[0]) == I_JMP && LOW(y64bin->codes[0]) != C_YES;
+        char buf[34];
+        int i, c;
+
+        strcpy(buf, "                              | ");
+        note[0] = cyc[0] = '\0';
+        if (line->type == TYPE_INS) {
+            strcpy(buf, "  0x000:                      | ");
+            hexstuff(buf+4, y64bin->addr, 3);
+            for (i = 0; i < y64bin->bytes; i++)
+                hexstuff(buf+9+2*i, y64bin->codes[i]&0xFF, 2);
+        }
+        if (is_code(k)) {
+            c = line_cost(k, note, sizeof(note));
+            snprintf(cyc, sizeof(cyc), cond ? "%d/%d" : "%d", c, c + 2);
+            ninstr++;
+            nload += c == 2;
+            nret += HIGH(y64bin->codes[0]) == I_RET;
+            ncond += cond;
+            nforward += note[0] == 'f';
+        }
+        printf("%s%5s %-16s| %.*s\n", buf, cyc, note, line->len, line->y64asm);
+
+        /* the block's total, at its last line */
+        b = blockof[k];
+        if (b >= 0 && k == blk[b].last && loop[b] && blk[b].term >= 0) {
+            int lo = 0;
+            bool_t jxx = FALSE;
+
+            for (i = blk[b].first; i <= blk[b].last; i++) {
+                bin_t *ib = &peep[i].line->y64bin;
+
+                if (is_code(i)) {
+                    lo += line_cost(i, note, sizeof(note));
+                    jxx = HIGH(ib->codes[0]) == I_JMP && LOW(ib->codes[0]) != C_YES;
+                }
+            }
+            snprintf(cyc, sizeof(cyc), jxx ? "%d/%d" : "%d", lo, lo + 2);
+            printf("                              | %5s %-16s|\n", cyc, "block, in a loop");
+        }
+    }
+    free(loop);
+
+    printf("\nPIPE: %d instructions; %d load/use bubbles, %d rets (3 bubbles each), "
+           "%d jXX (2 bubbles each when not taken; %d of them forward)\n",
+           ninstr, nload, nret, ncond, nforward);
+}
+
 /* init and finit */
 void init(void)
 {
-    reltab = (reloc_t *)malloc(sizeof(reloc_t)); // free in finit
-    memset(reltab, 0, sizeof(reloc_t));
+    lines.head = relocs.head = pool.head = seen.head = NULL; // free in finit
+    reltab = (reloc_t *)arena_alloc(&relocs, sizeof(reloc_t));
 
-    symtab = (symbol_t *)malloc(sizeof(symbol_t)); // free in finit
-    memset(symtab, 0, sizeof(symbol_t));
+    nsyms = maxsyms = 0;
+    symtab = NULL; // grown by intern, free in finit
+    hashsize = 64;
+    symhash = (int *)calloc(hashsize, sizeof(int)); // free in finit
 
-    line_head = (line_t *)malloc(sizeof(line_t)); // free in finit
-    memset(line_head, 0, sizeof(line_t));
+    line_head = (line_t *)arena_alloc(&lines, sizeof(line_t));
     line_tail = line_head;
     lineno = 0;
+
+    init_tries();
 }
 
 void finit(void)
 {
-    reloc_t *rtmp = NULL;
-    do {
-        rtmp = reltab->next;
-        if (reltab->name) 
-            free(reltab->name);
-        free(reltab);
-        reltab = rtmp;
-    } while (reltab);
-    
-    symbol_t *stmp = NULL;
-    do {
-        stmp = symtab->next;
-        if (symtab->name) 
-            free(symtab->name);
-        free(symtab);
-        symtab = stmp;
-    } while (symtab);
-
-    line_t *ltmp = NULL;
-    do {
-        ltmp = line_head->next;
-        if (line_head->y64asm) 
-            free(line_head->y64asm);
-        free(line_head);
-        line_head = ltmp;
-    } while (line_head);
+    free(symtab);
+    free(symhash);
+
+    /* the lines, relocations, symbol names and cached lines */
+    arena_free(&lines);
+    arena_free(&relocs);
+    arena_free(&pool);
+    arena_free(&seen);
+    free(cache);
+    free(used);
+    free(was);
+    free(peep);
+    free(defline);
+    free(pcs);
+    free(blk);
+    free(blockof);
+    free(laid);
+    free(rec_labels);
+    free(rec_refs);
+    free(rec_offs);
+
+    if (src_map)
+        munmap(src_text, src_map);
+    else
+        free(src_text);
+}
+
+/*
+ * map_source: map the source file into memory, with a '\0' after its text
+ * args
+ *     in: point to input file (an y64 assembly file)
+ *     len: point to the length of the text
+ *
+ * return
+ *     the text (unmapped or freed in finit), NULL on error
+ */
+char *map_source(FILE *in, long *len)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    struct stat st;
+    size_t n = 0, cap = 64*1024, k;
+    char *p;
+
+    if (watching && fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode)) {
+        /* watch: read it, as the file may be cut short while it is mapped */
+        cap = st.st_size + 1;
+    } else if (fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        /* a page more than the file, zeros whatever size the file is */
+        src_map = (st.st_size / page + 1) * page;
+        p = mmap(NULL, src_map, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED) {
+            if (mmap(p, st.st_size, PROT_READ, MAP_PRIVATE | MAP_FIXED,
+                     fileno(in), 0) != MAP_FAILED) {
+                *len = st.st_size;
+                return src_text = p;
+            }
+            munmap(p, src_map);
+        }
+    }
+
+    /* empty, not a regular file, watched, or it can't be mapped: read it */
+    src_map = 0;
+    p = (char *)malloc(cap + 1);
+    while (p != NULL && (k = fread(p + n, 1, cap - n, in)) > 0) {
+        n += k;
+        if (n == cap) {
+            cap *= 2;
+            p = (char *)realloc(p, cap + 1);
+        }
+    }
+    if (p == NULL)
+        return NULL;
+
+    p[n] = '\0';
+    *len = n;
+    return src_text = p;
+}
+
+/*
+ * rebuild: watch: assemble the file again, from the start, but keeping
+ *     the symbol IDs and the cached lines, and write it out
+ * args
+ *     infname: the .ys file
+ *     outfname: the .bin (or .obj) file
+ *
+ * return
+ *     0: success
+ *     -1: error (it is printed)
+ */
+static int rebuild(char *infname, char *outfname)
+{
+    struct timespec t0, t1;
+    cached_t **tmp;
+    FILE *in, *out;
+    char *text;
+    long len;
+    int ret;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    /* the last build is done with; drop the cache if it is mostly stale */
+    reset();
+    free(src_text);
+    src_text = NULL;
+    if (nassembled == nlines) {
+        /* (else the last build failed: keep the one before it as 'was') */
+        tmp = was;
+        was = used;
+        used = tmp;
+        nwas = nassembled;
+    }
+    shift = 0;
+    if (ncached > 2 * nlines + 1024) {
+        arena_free(&seen);
+        free(cache);
+        cache = NULL;
+        cachesize = ncached = nwas = 0;
+    }
+    nassembled = nparsed = 0;
+
+    in = fopen(infname, "r");
+    if (!in) {
+        err_print("Can't open input file '%s'", infname);
+        return -1;
+    }
+    text = map_source(in, &len);
+    fclose(in);
+    if (!text) {
+        err_print("Can't read input file '%s'", infname);
+        return -1;
+    }
+
+    if (assemble(text, len) < 0) {
+        err_print("Assemble y64 code error");
+        return -1;
+    }
+    nlines = nassembled;
+    if (!object && relocate() < 0) {
+        err_print("Relocate binary code error");
+        return -1;
+    }
+
+    out = fopen(outfname, "wb");
+    if (!out) {
+        err_print("Can't open output file '%s'", outfname);
+        return -1;
+    }
+    ret = object ? objfile(out) : binfile(out);
+    if (fclose(out) || ret < 0) {
+        err_print("Generate binary file error");
+        return -1;
+    }
+
+    if (screen)
+        print_screen();
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("Wrote '%s' in %.1f ms (%d lines, %d of them parsed)\n", outfname,
+           (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6,
+           nassembled, nparsed);
+    fflush(stdout);
+    return 0;
+}
+
+/* watch: build the file, then again each time it is written, until killed */
+static void watch(char *infname, char *outfname)
+{
+    char dir[512], buf[4096] __attribute__((aligned(8)));
+    char *base = strrchr(infname, '/');
+    struct inotify_event *e;
+    bool_t changed;
+    int fd, n, off;
+
+    /* watch the directory: an editor may write a new file over the old */
+    if (base == NULL) {
+        strcpy(dir, ".");
+        base = infname;
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", base == infname ? 1 : (int)(base - infname), infname);
+        base++;
+    }
+    fd = inotify_init();
+    if (fd < 0 || inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        err_print("Can't watch '%s'", infname);
+        exit(1);
+    }
+
+    rebuild(infname, outfname);
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        changed = FALSE;
+        for (off = 0; off < n; off += sizeof(struct inotify_event) + e->len) {
+            e = (struct inotify_event *)(buf + off);
+            if (e->len && !strcmp(e->name, base))
+                changed = TRUE;
+        }
+        if (changed)
+            rebuild(infname, outfname);
+    }
+    err_print("Can't watch '%s'", infname);
+    exit(1);
 }
 
 static void usage(char *pname)
 {
-    printf("Usage: %s [-v] file.ys\n", pname);
+    printf("Usage: %s [-v | -C | -s] [-c] [-w | [-O] [-P file.pcprof]] file.ys\n", pname);
     printf("   -v print the readable output to screen\n");
+    printf("   -C print it with the cycles each instruction takes on PIPE, flagging\n"
+           "      load/use hazards, rets and forward jXX (PIPE predicts every jump\n"
+           "      taken), and the total of each basic block in a loop\n");
+    printf("   -c generate a relocatable object, file.obj, for y64ld\n");
+    printf("   -s stream: write out the code as it is assembled, keeping\n"
+           "      only references to symbols not yet defined\n");
+    printf("   -w watch: assemble the file again each time it is written,\n"
+           "      parsing only the lines that changed\n");
+    printf("   -O optimize: delete moves of a register onto itself and jumps\n"
+           "      to the next instruction, zero with xorq where it is safe, and\n"
+           "      report what it saved (addresses given as numbers stay as they are)\n");
+    printf("   -P lay the basic blocks out for PIPE by a profile of the code, as\n"
+           "      assembled without -P or -O, that y64sim -p wrote to file.pcprof\n");
     exit(0);
 }
 
@@ -1187,26 +3199,58 @@ int main(int argc, char *argv[])
     char outfname[512];
     int nextarg = 1;
     FILE *in = NULL, *out = NULL;
+    char *text;
+    long len;
     
-    if (argc < 2)
-        usage(argv[0]);
-    
-    if (argv[nextarg][0] == '-') {
+    while (nextarg < argc && argv[nextarg][0] == '-') {
         char flag = argv[nextarg][1];
         switch (flag) {
           case 'v':
             screen = TRUE;
             nextarg++;
             break;
+          case 'C':
+            screen = costs = TRUE;
+            nextarg++;
+            break;
+          case 's':
+            stream = TRUE;
+            nextarg++;
+            break;
+          case 'c':
+            object = TRUE;
+            nextarg++;
+            break;
+          case 'w':
+            watching = TRUE;
+            nextarg++;
+            break;
+          case 'O':
+            optimize = TRUE;
+            nextarg++;
+            break;
+          case 'P':
+            if (nextarg + 1 >= argc)
+                usage(argv[0]);
+            profname = argv[nextarg + 1];
+            nextarg += 2;
+            break;
           default:
             usage(argv[0]);
         }
     }
+    /* the lines are not kept for the screen, an object, watching, the
+     * optimizer or the layout in streaming; a watched line is not parsed
+     * to optimize, lay out or cost */
+    if (nextarg >= argc ||
+        (stream && (screen || object || watching || optimize || profname)) ||
+        (watching && (optimize || profname || costs)))
+        usage(argv[0]);
 
     /* parse input file name */
     rootlen = strlen(argv[nextarg])-3;
     /* only support the .ys file */
-    if (strcmp(argv[nextarg]+rootlen, ".ys"))
+    if (rootlen < 0 || strcmp(argv[nextarg]+rootlen, ".ys"))
         usage(argv[0]);
     
     if (rootlen > 500) {
@@ -1219,46 +3263,87 @@ int main(int argc, char *argv[])
     init();
 
     
-    /* assemble .ys file */
+    /* map .ys file */
     strncpy(infname, argv[nextarg], rootlen);
     strcpy(infname+rootlen, ".ys");
+    strncpy(outfname, argv[nextarg], rootlen);
+    strcpy(outfname+rootlen, object ? ".obj" : ".bin");
+    if (watching)
+        watch(infname, outfname);
+
     in = fopen(infname, "r");
     if (!in) {
         err_print("Can't open input file '%s'", infname);
         exit(1);
     }
+
+    text = map_source(in, &len);
+    fclose(in);
+    if (!text) {
+        err_print("Can't read input file '%s'", infname);
+        exit(1);
+    }
+
+    /* streaming: the .bin file is written while assembling */
+    if (stream) {
+        out = fopen(outfname, "wb");
+        if (!out) {
+            err_print("Can't open output file '%s'", outfname);
+            exit(1);
+        }
+        out_fd = fileno(out);
+    }
     
-    if (assemble(in) < 0) {
+    /* assemble .ys file */
+    if (assemble(text, len) < 0) {
         err_print("Assemble y64 code error");
-        fclose(in);
+        if (stream) {
+            fclose(out);
+            remove(outfname);
+        }
+        exit(1);
+    }
+
+    /* lay it out by the profile (-P), then optimize it (-O) */
+    if (profname && layout(&text, &len) < 0) {
+        err_print("Lay out y64 code error");
+        exit(1);
+    }
+    if (optimize && peephole(text, len) < 0) {
+        err_print("Optimize y64 code error");
         exit(1);
     }
-    fclose(in);
 
-    /* relocate binary code */
-    if (relocate() < 0) {
+    /* relocate binary code (objects leave it to y64ld) */
+    if (!object && relocate() < 0) {
         err_print("Relocate binary code error");
+        if (stream) {
+            fclose(out);
+            remove(outfname);
+        }
         exit(1);
     }
 
     /* generate .bin file */
-    strncpy(outfname, argv[nextarg], rootlen);
-    strcpy(outfname+rootlen, ".bin");
-    out = fopen(outfname, "wb");
-    if (!out) {
-        err_print("Can't open output file '%s'", outfname);
-        exit(1);
+    if (!stream) {
+        out = fopen(outfname, "wb");
+        if (!out) {
+            err_print("Can't open output file '%s'", outfname);
+            exit(1);
+        }
     }
 
-    if (binfile(out) < 0) {
+    if ((object ? objfile(out) : binfile(out)) < 0) {
         err_print("Generate binary file error");
         fclose(out);
         exit(1);
     }
     fclose(out);
  
-    /* print to screen (.yo file) */
-    if (screen)
+    /* print to screen (.yo file), with the costs (-C) */
+    if (costs)
+        print_costs();
+    else if (screen)
        print_screen(); 
 
     /* finit */
@@ -1266,5 +3351,3 @@ int main(int argc, char *argv[])
  
     return 0;
 }
-
-
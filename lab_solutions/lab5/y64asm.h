@@ -6,8 +6,6 @@
 #include <string.h>
 #include <assert.h>
 
-#define MAX_INSLEN  512
-
 typedef unsigned char byte_t;
 typedef int64_t word_t;
 typedef enum { FALSE, TRUE } bool_t;
@@ -27,7 +25,8 @@ typedef struct reg {
 
 /* Y64 Instruction */
 typedef enum { I_HALT, I_NOP, I_RRMOVQ, I_IRMOVQ, I_RMMOVQ, I_MRMOVQ,
-    I_ALU, I_JMP, I_CALL, I_RET, I_PUSHQ, I_POPQ, I_DIRECTIVE } itype_t;
+    I_ALU, I_JMP, I_CALL, I_RET, I_PUSHQ, I_POPQ, I_DIRECTIVE,
+    I_ATOMIC } itype_t;
 
 /* Function code (default) */
 typedef enum { F_NONE } func_t;
@@ -38,6 +37,9 @@ typedef enum { A_ADD, A_SUB, A_AND, A_XOR, A_NONE } alu_t;
 /* Condition code */
 typedef enum { C_YES, C_LE, C_L, C_E, C_NE, C_GE, C_G } cond_t;
 
+/* Atomic code (run by y64sim's cores, -n) */
+typedef enum { AT_XADD, AT_CMPXCHG } atom_t;
+
 /* Directive code */
 typedef enum { D_DATA, D_POS, D_ALIGN } dtv_t;
 
@@ -62,29 +64,132 @@ typedef struct bin {
     int64_t addr;
     byte_t codes[10];
     int bytes;
+    int64_t pos; /* where build_image() put the code in the image */
 } bin_t;
 
 typedef struct line {
     type_t type; /* TYPE_COMM: no y64bin, TYPE_INS: both y64bin and y64asm */
     bin_t y64bin;
-    char *y64asm;
+    char *y64asm; /* the line in the source text, not '\0'-terminated */
+    int len;      /* its length, less the line terminator */
     
     struct line *next;
 } line_t;
 
-/* label defined in y64 assembly code, e.g. Loop */
+/*
+ * label used in y64 assembly code, e.g. Loop; each name is interned once,
+ * so a symbol's ID (its index in the symbol table) stands for its name
+ */
 typedef struct symbol {
     char *name;
     int64_t addr;
-    struct symbol *next;
+    bool_t defined; /* FALSE while it has only been referred to */
+    struct fixup *pending; /* streaming: references waiting for addr */
 } symbol_t;
 
 /* binary code need to be relocated */
 typedef struct reloc {
     bin_t *y64bin;
-    char *name;
+    int sym; /* ID of the symbol */
     struct reloc *next;
 } reloc_t;
 
+/* streaming: a reference to a symbol, patched in the output once defined */
+typedef struct fixup {
+    int sym;
+    long seq;     /* the order it was made in */
+    int64_t off;  /* where the address goes in the output, -1: nowhere */
+    int size;     /* how many of its bytes go there */
+    struct fixup *next;
+} fixup_t;
+
+/*
+ * watch: what assembling a line did, to do again for the same text
+ * wherever it is, with its addresses relative to where the line starts
+ */
+typedef struct cached {
+    char *text;         /* a copy of the line */
+    int len;
+    unsigned int hash;
+    type_t type;
+    bin_t y64bin;
+    int64_t size;       /* how far the line moves vmaddr */
+    int nlabels, nrefs;
+    int *ids;           /* the symbols it defines, then those it refers to */
+    int64_t *offs;      /* where it defines each */
+    int at;             /* the line it was last assembled as */
+    struct cached *next; /* in its hash chain */
+} cached_t;
+
+/* peephole (-O): what is done to a line each time it is assembled */
+typedef enum { P_KEEP, P_DELETE, P_XOR } peep_act_t;
+
+/* peephole: what the optimizer knows of a line */
+typedef struct peep {
+    line_t *line;
+    bool_t simple;      /* one instruction, with no label after it */
+    bool_t labeled;     /* it defines a label */
+    bool_t data;        /* its code is data (.byte, .word, .long, .quad) */
+    int ref;            /* the symbol it refers to, -1 if none */
+    bool_t frozen;      /* its code can't move (see peep_mark()) */
+    peep_act_t action;
+} peep_t;
+
+/* layout (-P): what y64sim -p counted at one PC */
+typedef struct pcount {
+    int64_t pc;
+    long count;
+    long taken, not_taken; /* conditional jumps only */
+    int line;           /* the line of the code there, -1 if none */
+} pcount_t;
+
+/* layout: a basic block, from a label or a jump to the next one */
+typedef struct block {
+    int first, last;    /* its lines, by line number - 1 */
+    int term;           /* its last line with code, -1 if it has none */
+    char *label;        /* a label it starts with, NULL if none (yet) */
+    bool_t made;        /* the label is made up, to jump to the block */
+    int fall, target;   /* the blocks it falls through and jumps to, -1 if none */
+    long count;         /* times its first instruction ran */
+    long taken, not_taken; /* its last, if a conditional jump */
+    int prev, next;     /* the blocks before and after it in its chain */
+    int chain;          /* union-find of the chains, by a block in them */
+    int head, tail;     /* of a chain, in the block that stands for it */
+    bool_t flip;        /* its conditional jump is made the opposite one */
+    bool_t drop;        /* its jmp is to the block right after it */
+    char *jump;         /* the label it jumps to after its code, NULL if none */
+} block_t;
+
+/* layout: that a block had best come right after another */
+typedef struct edge {
+    long weight;        /* the cycles that saves, by the profile */
+    int from, to;
+} edge_t;
+
+/* a chunk of arena memory, handed out front to back */
+typedef struct chunk {
+    struct chunk *next; /* the chunk filled before this one */
+    size_t size, used;
+    char data[];
+} chunk_t;
+
+/* memory freed all at once, e.g. everything the assembler keeps */
+typedef struct arena {
+    chunk_t *head;      /* the chunk being filled */
+} arena_t;
+
+/*
+ * trie of the names in a table (of instructions or registers), walked a
+ * char at a time to find the longest name the text starts with
+ */
+#define TRIE_NODES 256  /* node IDs fit a byte; node 0 is the root */
+#define TRIE_CHARS 40   /* chars a name may use: a-z, 0-9, '.', '%' */
+
+typedef struct trie {
+    int nnodes;
+    byte_t next[TRIE_NODES][TRIE_CHARS]; /* child for each char, 0 if none */
+    int value[TRIE_NODES]; /* 1 + index of the name ending here, 0 if none */
+} trie_t;
+
 #endif
 
@@ -0,0 +1,320 @@
+/*
+ * y64ld: link relocatable objects (y64asm -c, see y64obj.h) into a y64
+ * binary file.  Reading the objects and patching their relocations into
+ * the image is done by several threads at once, each taking the next
+ * object left; only laying the objects out and collecting the symbols
+ * they define is done in order, on one thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "y64asm.h"
+#include "y64obj.h"
+
+#define err_print(_s, _a ...) \
+    fprintf(stderr, "[--]: "_s"\n", ## _a)
+
+typedef struct object {
+    const char *name;
+    obj_hdr_t hdr;
+    byte_t *image;
+    obj_sym_t *syms;
+    obj_reloc_t *relocs;
+    char *names;
+    int64_t base;       /* where it goes in the linked image */
+    char err[256];      /* what went wrong with it, if anything did */
+} object_t;
+
+/* a symbol defined by some object, at its final address */
+typedef struct global {
+    const char *name;   /* NULL: the slot is empty */
+    int64_t addr;
+    object_t *obj;
+} global_t;
+
+typedef struct linker {
+    object_t *obj;
+    int nobjs;
+    int next;           /* the next object for a thread to take */
+    int (*job)(struct linker *, object_t *);
+    global_t *globals;  /* open addressing, at most half full */
+    int nglobals;
+    byte_t *image;
+} linker_t;
+
+/* FNV-1a, as y64asm hashes its symbols */
+static unsigned int hash_name(const char *name)
+{
+    unsigned int h = 2166136261U;
+
+    while (*name)
+        h = (h ^ (byte_t)*name++) * 16777619U;
+    return h;
+}
+
+/* the slot of 'name' in L->globals, or the empty slot where it would go */
+static global_t *find_global(linker_t *L, const char *name)
+{
+    int h = hash_name(name) & (L->nglobals - 1);
+
+    while (L->globals[h].name && strcmp(L->globals[h].name, name))
+        h = (h + 1) & (L->nglobals - 1);
+    return &L->globals[h];
+}
+
+static void *read_part(FILE *f, size_t size, size_t n)
+{
+    void *p = malloc(size * n + 1);
+
+    if (p && fread(p, size, n, f) != n) {
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+
+/* read object o, checking that everything in it points inside it */
+static int load_object(linker_t *L, object_t *o)
+{
+    obj_hdr_t *h = &o->hdr;
+    FILE *f = fopen(o->name, "rb");
+    uint32_t i;
+
+    if (!f) {
+        snprintf(o->err, sizeof(o->err), "Can't open object file '%s'", o->name);
+        return -1;
+    }
+    if (fread(h, sizeof(*h), 1, f) != 1 ||
+        memcmp(h->magic, OBJ_MAGIC, sizeof(OBJ_MAGIC)) ||
+        h->version != OBJ_VERSION || h->size < 0 || h->extent < h->size ||
+        !(o->image = (byte_t *)read_part(f, 1, h->size)) ||
+        !(o->syms = (obj_sym_t *)read_part(f, sizeof(obj_sym_t), h->nsyms)) ||
+        !(o->relocs = (obj_reloc_t *)read_part(f, sizeof(obj_reloc_t), h->nrelocs)) ||
+        !(o->names = (char *)read_part(f, 1, h->strsize)) ||
+        (h->strsize && o->names[h->strsize - 1] != '\0')) {
+        snprintf(o->err, sizeof(o->err), "'%s' is not a y64 object", o->name);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    for (i = 0; i < h->nsyms; i++)
+        if (o->syms[i].name >= h->strsize)
+            goto corrupt;
+    for (i = 0; i < h->nrelocs; i++)
+        if (o->relocs[i].sym >= h->nsyms || o->relocs[i].size > 8 ||
+            o->relocs[i].off < 0 || o->relocs[i].off + o->relocs[i].size > h->size)
+            goto corrupt;
+    return 0;
+
+  corrupt:
+    snprintf(o->err, sizeof(o->err), "'%s' is corrupt", o->name);
+    return -1;
+}
+
+/* copy object o into the image, and patch in the addresses it refers to */
+static int link_object(linker_t *L, object_t *o)
+{
+    int64_t *addr = (int64_t *)malloc((o->hdr.nsyms + 1) * sizeof(int64_t));
+    uint32_t i;
+
+    memcpy(L->image + o->base, o->image, o->hdr.size);
+
+    /* the address of each of its symbols, wherever it is defined */
+    for (i = 0; i < o->hdr.nsyms; i++) {
+        obj_sym_t *s = &o->syms[i];
+        global_t *g;
+
+        if (s->defined) {
+            addr[i] = o->base + s->addr;
+            continue;
+        }
+        g = find_global(L, o->names + s->name);
+        /* unknown (-1), but only wrong if it is used */
+        addr[i] = g->name ? g->addr : -1;
+    }
+
+    for (i = 0; i < o->hdr.nrelocs; i++) {
+        obj_reloc_t *r = &o->relocs[i];
+
+        if (addr[r->sym] < 0) {
+            snprintf(o->err, sizeof(o->err), "Unknown symbol:'%s' (in '%s')",
+                     o->names + o->syms[r->sym].name, o->name);
+            free(addr);
+            return -1;
+        }
+        memcpy(L->image + o->base + r->off, &addr[r->sym], r->size);
+    }
+
+    free(addr);
+    return 0;
+}
+
+static void *worker(void *arg)
+{
+    linker_t *L = (linker_t *)arg;
+    int i;
+
+    while ((i = __atomic_fetch_add(&L->next, 1, __ATOMIC_RELAXED)) < L->nobjs)
+        L->job(L, &L->obj[i]);
+    return NULL;
+}
+
+/*
+ * run_job: do job to every object, on nthreads threads
+ *
+ * return
+ *     0: success
+ *     -1: it failed on some object (the errors are printed, in order)
+ */
+static int run_job(linker_t *L, int (*job)(linker_t *, object_t *), int nthreads)
+{
+    pthread_t *t = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+    int i, ret = 0;
+
+    for (i = 0; i < L->nobjs; i++)
+        L->obj[i].err[0] = '\0';
+    L->job = job;
+    L->next = 0;
+    for (i = 1; i < nthreads; i++)
+        pthread_create(&t[i], NULL, worker, L);
+    worker(L);
+    for (i = 1; i < nthreads; i++)
+        pthread_join(t[i], NULL);
+    free(t);
+
+    for (i = 0; i < L->nobjs; i++) {
+        if (L->obj[i].err[0]) {
+            err_print("%s", L->obj[i].err);
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+/*
+ * lay_out: put each object after the one before, and collect the symbols
+ *     they define
+ *
+ * return
+ *     the size of the image, -1 if a symbol is defined twice
+ */
+static int64_t lay_out(linker_t *L)
+{
+    int64_t base = 0, size = 0;
+    int i, n = 0;
+    uint32_t k;
+
+    for (i = 0; i < L->nobjs; i++)
+        for (k = 0; k < L->obj[i].hdr.nsyms; k++)
+            n += L->obj[i].syms[k].defined != 0;
+    for (L->nglobals = 64; L->nglobals < 2 * n; L->nglobals *= 2)
+        ;
+    L->globals = (global_t *)calloc(L->nglobals, sizeof(global_t));
+
+    for (i = 0; i < L->nobjs; i++) {
+        object_t *o = &L->obj[i];
+
+        /* like y64asm, no zeros after the last code */
+        o->base = base;
+        if (o->hdr.size > 0)
+            size = base + o->hdr.size;
+        base = (base + o->hdr.extent + OBJ_ALIGN - 1) & ~(int64_t)(OBJ_ALIGN - 1);
+
+        for (k = 0; k < o->hdr.nsyms; k++) {
+            obj_sym_t *s = &o->syms[k];
+            global_t *g;
+
+            if (!s->defined)
+                continue;
+            g = find_global(L, o->names + s->name);
+            if (g->name) {
+                err_print("Dup symbol:%s (in '%s' and '%s')", g->name, g->obj->name, o->name);
+                return -1;
+            }
+            g->name = o->names + s->name;
+            g->addr = o->base + s->addr;
+            g->obj = o;
+        }
+    }
+    return size;
+}
+
+static void usage(char *pname)
+{
+    printf("Usage: %s [-j threads] [-o file.bin] file.obj ...\n", pname);
+    printf("   -j link on 'threads' threads (default: one per CPU)\n");
+    printf("   -o the binary file (default: the first object's, as .bin)\n");
+    exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    linker_t L;
+    char *outfname = NULL;
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int nextarg = 1, i, rootlen;
+    int64_t size;
+    FILE *out;
+
+    while (nextarg < argc && argv[nextarg][0] == '-') {
+        char flag = argv[nextarg][1];
+        if (nextarg + 1 >= argc)
+            usage(argv[0]);
+        switch (flag) {
+          case 'j':
+            nthreads = atoi(argv[nextarg + 1]);
+            break;
+          case 'o':
+            outfname = argv[nextarg + 1];
+            break;
+          default:
+            usage(argv[0]);
+        }
+        nextarg += 2;
+    }
+    if (nextarg >= argc || nthreads < 1)
+        usage(argv[0]);
+
+    memset(&L, 0, sizeof(L));
+    L.nobjs = argc - nextarg;
+    L.obj = (object_t *)calloc(L.nobjs, sizeof(object_t));
+    for (i = 0; i < L.nobjs; i++)
+        L.obj[i].name = argv[nextarg + i];
+    if (nthreads > L.nobjs)
+        nthreads = L.nobjs;
+
+    if (!outfname) {
+        rootlen = strlen(L.obj[0].name) - 4;
+        if (rootlen < 0 || strcmp(L.obj[0].name + rootlen, ".obj"))
+            usage(argv[0]);
+        outfname = (char *)malloc(rootlen + 5);
+        strncpy(outfname, L.obj[0].name, rootlen);
+        strcpy(outfname + rootlen, ".bin");
+    }
+
+    /* read the objects, lay them out, then link each where it goes */
+    if (run_job(&L, load_object, nthreads) < 0)
+        exit(1);
+    size = lay_out(&L);
+    if (size < 0)
+        exit(1);
+    L.image = (byte_t *)calloc(size + 1, 1);
+    if (run_job(&L, link_object, nthreads) < 0)
+        exit(1);
+
+    out = fopen(outfname, "wb");
+    if (!out) {
+        err_print("Can't open output file '%s'", outfname);
+        exit(1);
+    }
+    if (fwrite(L.image, 1, size, out) != size || fclose(out)) {
+        err_print("Generate binary file error");
+        exit(1);
+    }
+    return 0;
+}
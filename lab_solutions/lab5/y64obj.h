@@ -0,0 +1,47 @@
+/*
+ * Relocatable objects, written by y64asm -c and linked by y64ld.
+ *
+ * An object is an obj_hdr_t, then the image of the code as y64asm would
+ * write it to a .bin file, but with a zero wherever the address of a
+ * symbol goes, then the symbols (obj_sym_t), the relocations (obj_reloc_t)
+ * and the names of the symbols, each ending with a '\0'.
+ *
+ * Addresses in an object are relative to its start: y64ld puts each
+ * object after the extent of the one before, at a multiple of 8, and
+ * adds where it put the object to its symbols.  Every symbol an object
+ * defines is seen by all the others; one it uses but does not define
+ * must be defined by exactly one of them.
+ */
+
+#ifndef _Y64_OBJ_
+#define _Y64_OBJ_
+
+#include <stdint.h>
+
+#define OBJ_MAGIC "Y64OBJ"
+#define OBJ_VERSION 1
+#define OBJ_ALIGN 8             /* where objects start, in the image */
+
+typedef struct obj_hdr {
+    char magic[8];
+    uint32_t version;
+    uint32_t nsyms;
+    uint32_t nrelocs;
+    uint32_t strsize;           /* bytes of names */
+    int64_t size;               /* bytes of image */
+    int64_t extent;             /* the addresses it spans, at least size */
+} obj_hdr_t;
+
+typedef struct obj_sym {
+    uint32_t name;              /* offset of its name in the names */
+    uint32_t defined;           /* 0: the object only refers to it */
+    int64_t addr;
+} obj_sym_t;
+
+typedef struct obj_reloc {
+    int64_t off;                /* where in the image the address goes */
+    uint32_t sym;               /* index of the symbol in the object */
+    uint32_t size;              /* bytes of the address that go there */
+} obj_reloc_t;
+
+#endif
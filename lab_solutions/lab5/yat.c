@@ -36,9 +36,27 @@ static int diff_app(const char *name)
     return system(cmdbuf);
 }
 
+// error-handling cases to assemble with flags; the base assembler
+// gets none, and must give the same errors
+static const char *err_flags[][2] = {
+    {"unknown-jump-O-error", "-O"},
+    {"undefined-label-O-error", "-O"},
+    {NULL, NULL}
+};
+
+static const char *flags_of(const char *name)
+{
+    int i;
+
+    for (i = 0; err_flags[i][0]; i++)
+        if (!strcmp(err_flags[i][0], name))
+            return err_flags[i][1];
+    return "";
+}
+
 static int make_err_stu(const char *name)
 {
-    sprintf(cmdbuf, "./y64asm y64-err/%s.ys 2> %s.err", name, name);
+    sprintf(cmdbuf, "./y64asm %s y64-err/%s.ys 2> %s.err", flags_of(name), name, name);
     
     return !system(cmdbuf);
 }
@@ -52,7 +70,8 @@ static int make_err_base(const char *name)
 
 static int diff_err(const char *name)
 {
-    sprintf(cmdbuf, "diff %s.err %s.err.base", name, name);
+    // what -O saved is reported, but is no error
+    sprintf(cmdbuf, "grep -v '^Peephole:' %s.err | diff - %s.err.base", name, name);
     
     return system(cmdbuf);
 }
@@ -164,6 +183,8 @@ static char *uni_list[] = {
     "invalid-dest-error",
     "unknown-symbol-error",
     "invalid-directive-error",
+    "unknown-jump-O-error",
+    "undefined-label-O-error",
     NULL
 };
 
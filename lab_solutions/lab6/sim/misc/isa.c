@@ -330,11 +330,15 @@ bool_t set_byte_val(mem_t m, word_t pos, byte_t val)
     return TRUE;
 }
 
+void (*store_hook)(mem_t m, word_t pos) = NULL;
+
 bool_t set_word_val(mem_t m, word_t pos, word_t val)
 {
     int i;
     if (pos < 0 || pos + 8 > m->len)
 	return FALSE;
+    if (store_hook)
+	store_hook(m, pos);
     for (i = 0; i < 8; i++) {
 	m->contents[pos+i] = (byte_t) val & 0xFF;
 	val >>= 8;
@@ -131,6 +131,9 @@ bool_t set_byte_val(mem_t m, word_t pos, byte_t val);
 /* Set 8 bytes in memory */
 bool_t set_word_val(mem_t m, word_t pos, word_t val);
 
+/* If set, called with the address of every successful set_word_val() */
+extern void (*store_hook)(mem_t m, word_t pos);
+
 /* Print contents of memory */
 void dump_memory(FILE *outfile, mem_t m, word_t pos, int cnt);
 
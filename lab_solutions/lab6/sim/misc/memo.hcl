@@ -0,0 +1,78 @@
+## Checks hcl2c -m against the default code: make memo-check builds
+## this both ways, and the two must print the same values.
+
+## Like a simulator, main sets the inputs, then computes the signals,
+## storing those other signals use where their wordsig says.  With -m
+## (MEMO), eval_cycle() computes them all at once: the stores come too
+## late to matter, and the values stored first are garbage.
+
+quote '#include <stdio.h>'
+quote '#include <stdlib.h>'
+quote 'long long a_val, b_val, c_val, op_val, x_val, y_val;'
+quote 'long long never_val, sel_val, hit_val;'
+
+wordsig A 'a_val'
+wordsig B 'b_val'
+wordsig C 'c_val'
+wordsig OP 'op_val'
+## Bools from C need not be 0 or 1: main makes these 0, 1 or 2
+boolsig X 'x_val'
+boolsig Y 'y_val'
+
+boolsig never 'never_val'
+wordsig sel 'sel_val'
+boolsig hit 'hit_val'
+
+## Folds to 0, and so do its uses
+bool never = 0;
+
+## Uses never; its tests are shared with hit and nodef
+word sel = [
+	OP in { 1, 2 } : A;
+	OP in { 3 } : B;
+	never : C;
+	1 : 7;
+];
+
+## Uses sel, which must be computed first
+bool hit = OP in { 1, 2 } && sel == B || never;
+
+## Only X && 1 with X 0 or 1 is X
+bool xs = X && 1;
+bool ys = Y || 0;
+
+## A constant guard ends the cases
+word pick = [
+	hit : sel;
+	X : A;
+	2 == 2 : C;
+	B == 3 : 5;
+];
+
+## No default: 0
+word nodef = [
+	OP in { 4, 5 } && !Y : -8;
+	OP == 6 : sel;
+];
+
+bool same = OP in { 1, 2 } && A == A;
+bool ord = A < B && B <= C || C > A && !(C >= B) || A != C;
+
+quote 'int main() {'
+quote '  int n;'
+quote '  for (n = 0; n < 100000; n++) {'
+quote '    a_val = rand() % 8; b_val = rand() % 8; c_val = rand() % 8;'
+quote '    op_val = rand() % 8; x_val = rand() % 3; y_val = rand() % 3;'
+quote '    never_val = sel_val = hit_val = -1;'
+quote '#ifdef MEMO'
+quote '    eval_cycle();'
+quote '#endif'
+quote '    never_val = gen_never();'
+quote '    sel_val = gen_sel();'
+quote '    hit_val = gen_hit();'
+quote '    printf("%lld %lld %lld %lld %lld %lld %lld %lld %lld\n",'
+quote '           gen_never(), gen_sel(), gen_hit(), gen_xs(), gen_ys(),'
+quote '           gen_pick(), gen_nodef(), gen_same(), gen_ord());'
+quote '  }'
+quote '  return 0;'
+quote '}'
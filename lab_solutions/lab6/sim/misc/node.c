@@ -18,6 +18,14 @@ void yyserror(const char *str, char *other);
 /* For error reporting */
 static char* show_expr(node_ptr expr);
 
+#if !defined(VLOG) && !defined(UCLID)
+/* Compute every signal once, in eval_cycle()? (-m) */
+int memoize = 0;
+static void add_stage(char *inputs);
+static void add_def(node_ptr var, node_ptr expr);
+static void gen_cycle();
+#endif
+
 /* The symbol table */
 #define SYM_LIM 100
 static node_ptr sym_tab[2][SYM_LIM];
@@ -48,7 +56,11 @@ static void usage(char *name)
     fprintf(stderr, "Usage: %s [-ah] < HCL_file  > uclid_file\n", name);
     fprintf(stderr, "   -a     Add define/use annotations\n");
 #else /* !UCLID */
-    fprintf(stderr, "Usage: %s [-h][-n NAM] < HCL_file  > C_file\n", name);
+    fprintf(stderr, "Usage: %s [-h][-m [-s IN,...]...][-n NAM] < HCL_file  > C_file\n",
+	    name);
+    fprintf(stderr, "   -m     Compute every signal once, in eval_cycle()\n");
+    fprintf(stderr, "   -s IN,...  The inputs set next: signals using them are\n");
+    fprintf(stderr, "          computed in eval_IN(), once they are set\n");
 #endif /* UCLID */
 #endif /* VLOG */
     fprintf(stderr, "   -h     Print this message\n");
@@ -66,7 +78,7 @@ void init_node(int argc, char **argv)
     int other_indents = 2;
 
     /* Parse the command line arguments */
-    while ((c = getopt(argc, argv, "hna")) != -1) {
+    while ((c = getopt(argc, argv, "hnams:")) != -1) {
 	switch(c) {
 	case 'h':
 	    usage(argv[0]);
@@ -78,6 +90,14 @@ void init_node(int argc, char **argv)
 	case 'a':
 	    annotate = 1;
 	    break;
+#endif
+#if !defined(VLOG) && !defined(UCLID)
+	case 'm':
+	    memoize = 1;
+	    break;
+	case 's':
+	    add_stage(optarg);
+	    break;
 #endif
 	default:
 	    printf("Invalid option '%c'\n", c);
@@ -120,6 +140,10 @@ static void show_node(node_ptr node)
 
 void finish_node(int check_ref)
 {
+#if !defined(VLOG) && !defined(UCLID)
+    if (memoize)
+	gen_cycle();
+#endif
     if (check_ref) {
 	int i;
 	for (i = 0; i < sym_count; i++)
@@ -686,6 +710,11 @@ void gen_funct(node_ptr var, node_ptr expr, int isbool)
     }
     outgen_terminate();
 #else /* !UCLID */
+    if (memoize) {
+	/* Printed by gen_cycle, once all signals are known */
+	add_def(var, expr);
+	return;
+    }
     /* Print function header */
     outgen_print("long long gen_%s()", var->sval);
     outgen_terminate();
@@ -701,3 +730,517 @@ void gen_funct(node_ptr var, node_ptr expr, int isbool)
 #endif /* UCLID */
 #endif /* VLOG */
 }
+
+#if !defined(VLOG) && !defined(UCLID)
+/*
+ * With -m, the signals are not printed as they are defined.  Once all of
+ * them are known, gen_cycle prints eval_cycle(), which computes each
+ * signal once, after the signals it uses, into a field of hcl_sig; the
+ * gen_ functions just return that field.  A signal used by another is
+ * not read back from where the simulator stores it: the value just
+ * computed is used.  Every other input is read as it is when
+ * eval_cycle() is called.
+ *
+ * A simulator that sets inputs between reading signals (as psim and ssim
+ * do) names each group of them, in the order it sets them, with -s.  A
+ * signal using an input of group k (and none of a later one) is computed
+ * in eval_IN(), IN the first input of group k, which the simulator calls
+ * once the group is set; eval_cycle() computes the others.  memo.hcl
+ * (make memo-check) and the memo-check of pipe/ and seq/ check the
+ * default code and this agree.
+ *
+ * Before printing, each expression is folded and made canonical: there
+ * is one node for each distinct subexpression of any signal, so one used
+ * more than once is found, and computed once, into a local.
+ */
+
+#define CSE_LIM 4096
+#define STAGE_LIM 16
+
+/* The inputs given with -s, and the group each is in (from 1) */
+static struct {
+    char *name;
+    int stage;
+} stage_in[SYM_LIM];
+static int stage_in_count = 0;
+/* The first input of each group, naming its eval_ function */
+static char *stage_name[STAGE_LIM];
+static int stage_count = 0;
+
+/* The signals, in the order they are defined */
+static struct {
+    node_ptr var;
+    node_ptr expr;	/* canonical, once ordered */
+    int state;		/* 0: not ordered, 1: being ordered, 2: done */
+    int stage;		/* computed in eval_cycle() (0) or eval_IN() */
+} def_tab[SYM_LIM];
+static int def_count = 0;
+
+/* The signals in the order they are computed */
+static int def_order[SYM_LIM];
+static int order_count = 0;
+
+/* The canonical nodes; a canonical node's ref is its index here */
+static struct {
+    node_ptr node;
+    int uses;		/* how many expressions use it */
+    int local;		/* > 0: it is computed into c<local> */
+    int done;		/* c<local> has been computed */
+} cse_tab[CSE_LIM];
+static int cse_count = 0;
+static int local_count = 0;
+
+/* Add the group of inputs in the comma separated list inputs (-s) */
+static void add_stage(char *inputs)
+{
+    char *name;
+    if (stage_count >= STAGE_LIM - 1) {
+	fprintf(stderr, "Too many -s groups\n");
+	exit(1);
+    }
+    stage_count++;
+    for (name = strtok(inputs, ","); name; name = strtok(NULL, ",")) {
+	if (stage_in_count >= SYM_LIM) {
+	    fprintf(stderr, "Too many -s inputs\n");
+	    exit(1);
+	}
+	if (!stage_name[stage_count])
+	    stage_name[stage_count] = name;
+	stage_in[stage_in_count].name = name;
+	stage_in[stage_in_count].stage = stage_count;
+	stage_in_count++;
+    }
+    if (!stage_name[stage_count]) {
+	fprintf(stderr, "Empty -s group\n");
+	exit(1);
+    }
+    memoize = 1;
+}
+
+static void add_def(node_ptr var, node_ptr expr)
+{
+    int i;
+    for (i = 0; i < def_count; i++)
+	if (strcmp(def_tab[i].var->sval, var->sval) == 0) {
+	    yyserror("Signal '%s' defined twice", var->sval);
+	    return;
+	}
+    if (def_count >= SYM_LIM) {
+	yyerror("Signal table limit exceeded");
+	return;
+    }
+    def_tab[def_count].var = var;
+    def_tab[def_count].expr = expr;
+    def_tab[def_count].state = 0;
+    def_tab[def_count].stage = 0;
+    /* Code quoted after this may call it, as without -m */
+    if (def_count++ == 0) {
+	int k;
+	outgen_print("void eval_cycle();");
+	outgen_terminate();
+	for (k = 1; k <= stage_count; k++) {
+	    outgen_print("void eval_%s();", stage_name[k]);
+	    outgen_terminate();
+	}
+    }
+    outgen_print("long long gen_%s();", var->sval);
+    outgen_terminate();
+}
+
+/* Index of the signal named name, -1 if it is only an input */
+static int find_def(char *name)
+{
+    int i;
+    for (i = 0; i < def_count; i++)
+	if (strcmp(name, def_tab[i].var->sval) == 0)
+	    return i;
+    return -1;
+}
+
+/* The canonical node with these fields, made if there is none yet.
+   For N_CASE, arg1 ? arg2 : next */
+static node_ptr intern(node_type_t t, char *s,
+		       node_ptr a1, node_ptr a2, node_ptr next)
+{
+    int i;
+    node_ptr n;
+    for (i = 0; i < cse_count; i++) {
+	n = cse_tab[i].node;
+	if (n->type == t && n->arg1 == a1 && n->arg2 == a2 && n->next == next
+	    && (s == n->sval || (s && n->sval && strcmp(s, n->sval) == 0)))
+	    return n;
+    }
+    if (cse_count >= CSE_LIM) {
+	yyerror("Subexpression table limit exceeded");
+	exit(1);
+    }
+    n = new_node(t, 0, s, a1, a2);
+    n->next = next;
+    n->ref = cse_count;
+    cse_tab[cse_count].node = n;
+    cse_tab[cse_count].uses = 0;
+    cse_tab[cse_count].local = 0;
+    cse_tab[cse_count].done = 0;
+    cse_count++;
+    return n;
+}
+
+static node_ptr make_const(long long val)
+{
+    char buf[32];
+    char *s;
+    sprintf(buf, "%lld", val);
+    s = malloc(strlen(buf)+1);
+    strcpy(s, buf);
+    return intern(N_NUM, s, NULL, NULL, NULL);
+}
+
+static int is_const(node_ptr n, long long val)
+{
+    return n->type == N_NUM && atoll(n->sval) == val;
+}
+
+/* Is canonical n always 0 or 1?  Bool inputs need not be, and AND and
+   OR are printed as & and |, so x & 1 is only x if x is */
+static int is_normal(node_ptr n)
+{
+    int d;
+    switch(n->type) {
+    case N_NUM:
+	return is_const(n, 0) || is_const(n, 1);
+    case N_NOT:
+    case N_COMP:
+	return 1;
+    case N_AND:
+    case N_OR:
+	return is_normal(n->arg1) && is_normal(n->arg2);
+    case N_CASE:
+	return is_normal(n->arg2) && is_normal(n->next);
+    case N_VAR:
+	d = find_def(n->sval);
+	return d >= 0 && def_tab[d].state == 2 && is_normal(def_tab[d].expr);
+    default:
+	return 0;
+    }
+}
+
+static long long fold_comp(char *op, long long a, long long b)
+{
+    if (strcmp(op, "==") == 0)
+	return a == b;
+    if (strcmp(op, "!=") == 0)
+	return a != b;
+    if (strcmp(op, "<") == 0)
+	return a < b;
+    if (strcmp(op, "<=") == 0)
+	return a <= b;
+    if (strcmp(op, ">") == 0)
+	return a > b;
+    return a >= b;
+}
+
+static node_ptr canon(node_ptr expr);
+
+/* The canonical form of the cases from ele on */
+static node_ptr canon_case(node_ptr ele)
+{
+    node_ptr guard, val, rest;
+    if (!ele)
+	return make_const(0);
+    guard = canon(ele->arg1);
+    if (guard->type == N_NUM)
+	return is_const(guard, 0) ? canon_case(ele->next) : canon(ele->arg2);
+    val = canon(ele->arg2);
+    rest = canon_case(ele->next);
+    if (val == rest)
+	return val;
+    return intern(N_CASE, ":", guard, val, rest);
+}
+
+/* The canonical form of expr, with constants folded.  The signals it
+   uses must be canonical already */
+static node_ptr canon(node_ptr expr)
+{
+    node_ptr a, b, ele;
+    int d;
+    switch(expr->type) {
+    case N_NUM:
+	return intern(N_NUM, expr->sval, NULL, NULL, NULL);
+    case N_VAR:
+	if (!find_symbol(expr->sval))
+	    yyserror("Invalid variable '%s'", expr->sval);
+	d = find_def(expr->sval);
+	if (d >= 0 && def_tab[d].state == 2 && def_tab[d].expr->type == N_NUM)
+	    return def_tab[d].expr;
+	return intern(N_VAR, expr->sval, NULL, NULL, NULL);
+    case N_NOT:
+	a = canon(expr->arg1);
+	if (a->type == N_NUM)
+	    return make_const(!atoll(a->sval));
+	return intern(N_NOT, "!", a, NULL, NULL);
+    case N_AND:
+	a = canon(expr->arg1);
+	b = canon(expr->arg2);
+	if (is_const(a, 0) || is_const(b, 0))
+	    return make_const(0);
+	if (a == b || (is_const(b, 1) && is_normal(a)))
+	    return a;
+	if (is_const(a, 1) && is_normal(b))
+	    return b;
+	return intern(N_AND, "&", a, b, NULL);
+    case N_OR:
+	a = canon(expr->arg1);
+	b = canon(expr->arg2);
+	if (a == b || is_const(b, 0))
+	    return a;
+	if (is_const(a, 0))
+	    return b;
+	if ((is_const(a, 1) && is_normal(b)) || (is_const(b, 1) && is_normal(a)))
+	    return make_const(1);
+	return intern(N_OR, "|", a, b, NULL);
+    case N_COMP:
+	a = canon(expr->arg1);
+	b = canon(expr->arg2);
+	if (a->type == N_NUM && b->type == N_NUM)
+	    return make_const(fold_comp(expr->sval, atoll(a->sval),
+					atoll(b->sval)));
+	if (a == b)
+	    return make_const(fold_comp(expr->sval, 0, 0));
+	return intern(N_COMP, expr->sval, a, b, NULL);
+    case N_ELE:
+	/* x in {a, b} is (x == a) | (x == b) */
+	b = make_const(0);
+	for (ele = expr->arg2; ele; ele = ele->next) {
+	    node_rec comp = { N_COMP, 1, "==", expr->arg1, ele, 0, NULL };
+	    a = canon(&comp);
+	    if (is_const(b, 0) || is_const(a, 1))
+		b = a;
+	    else if (!is_const(a, 0) && !is_const(b, 1) && a != b)
+		b = intern(N_OR, "|", b, a, NULL);
+	}
+	return b;
+    case N_CASE:
+	return canon_case(expr);
+    default:
+	yyerror("Unexpected node type");
+	return make_const(0);
+    }
+}
+
+/* The group of input name, 0 if it is not given with -s */
+static int input_stage(char *name)
+{
+    int i;
+    for (i = 0; i < stage_in_count; i++)
+	if (strcmp(name, stage_in[i].name) == 0)
+	    return stage_in[i].stage;
+    return 0;
+}
+
+/* The latest group of inputs canonical expr uses */
+static int expr_stage(node_ptr expr)
+{
+    int d, k, stage = 0;
+    if (expr->type == N_VAR) {
+	d = find_def(expr->sval);
+	return d >= 0 ? def_tab[d].stage : input_stage(expr->sval);
+    }
+    if (expr->arg1 && (k = expr_stage(expr->arg1)) > stage)
+	stage = k;
+    if (expr->arg2 && (k = expr_stage(expr->arg2)) > stage)
+	stage = k;
+    if (expr->type == N_CASE && (k = expr_stage(expr->next)) > stage)
+	stage = k;
+    return stage;
+}
+
+/* Put signal d, after the signals it uses, in def_order */
+static void order_def(int d);
+
+static void order_uses(node_ptr expr)
+{
+    int d;
+    for (; expr; expr = expr->next) {
+	if (expr->type == N_VAR && (d = find_def(expr->sval)) >= 0)
+	    order_def(d);
+	if (expr->arg1)
+	    order_uses(expr->arg1);
+	if (expr->arg2)
+	    order_uses(expr->arg2);
+    }
+}
+
+static void order_def(int d)
+{
+    if (def_tab[d].state == 2)
+	return;
+    if (def_tab[d].state == 1) {
+	/* Once is enough */
+	static int looped = 0;
+	if (!looped++)
+	    yyserror("Signal '%s' depends on itself", def_tab[d].var->sval);
+	return;
+    }
+    def_tab[d].state = 1;
+    order_uses(def_tab[d].expr);
+    def_tab[d].expr = canon(def_tab[d].expr);
+    def_tab[d].stage = expr_stage(def_tab[d].expr);
+    def_tab[d].state = 2;
+    def_order[order_count++] = d;
+}
+
+/* Count the uses of canonical expr and of what it uses */
+static void count_uses(node_ptr expr)
+{
+    if (cse_tab[expr->ref].uses++ > 0)
+	return;
+    if (expr->arg1)
+	count_uses(expr->arg1);
+    if (expr->arg2)
+	count_uses(expr->arg2);
+    if (expr->type == N_CASE)
+	count_uses(expr->next);
+}
+
+/* Print canonical expr; one with a local is just printed as it, unless
+   it is the one being computed */
+static void gen_canon(node_ptr expr, int top)
+{
+    int local = cse_tab[expr->ref].local;
+    if (local && !top) {
+	outgen_print("c%d", local);
+	return;
+    }
+    switch(expr->type) {
+    case N_NUM:
+	outgen_print("%s", expr->sval);
+	break;
+    case N_VAR:
+	if (find_def(expr->sval) >= 0)
+	    outgen_print("hcl_sig.%s", expr->sval);
+	else
+	    outgen_print("(%s)", find_symbol(expr->sval)->sval);
+	break;
+    case N_NOT:
+	outgen_print("!");
+	gen_canon(expr->arg1, 0);
+	break;
+    case N_AND:
+    case N_OR:
+    case N_COMP:
+	outgen_print("(");
+	outgen_upindent();
+	gen_canon(expr->arg1, 0);
+	outgen_print(" %s ", expr->sval);
+	gen_canon(expr->arg2, 0);
+	outgen_print(")");
+	outgen_downindent();
+	break;
+    case N_CASE:
+	outgen_print("(");
+	outgen_upindent();
+	gen_canon(expr->arg1, 0);
+	outgen_print(" ? ");
+	gen_canon(expr->arg2, 0);
+	outgen_print(" : ");
+	gen_canon(expr->next, 0);
+	outgen_print(")");
+	outgen_downindent();
+	break;
+    default:
+	yyerror("Unknown node type");
+	break;
+    }
+}
+
+/* Compute the locals expr uses, each before the ones that use it */
+static void gen_locals(node_ptr expr)
+{
+    int i = expr->ref;
+    if (cse_tab[i].done)
+	return;
+    cse_tab[i].done = 1;
+    if (expr->arg1)
+	gen_locals(expr->arg1);
+    if (expr->arg2)
+	gen_locals(expr->arg2);
+    if (expr->type == N_CASE)
+	gen_locals(expr->next);
+    if (cse_tab[i].local) {
+	outgen_print("    long long c%d = ", cse_tab[i].local);
+	gen_canon(expr, 1);
+	outgen_print(";");
+	outgen_terminate();
+    }
+}
+
+/* Print hcl_sig, eval_cycle(), the eval_ function of each group of
+   inputs and the gen_ functions (see above) */
+static void gen_cycle()
+{
+    int i, d, k;
+
+    for (i = 0; i < stage_in_count; i++)
+	if (find_def(stage_in[i].name) >= 0)
+	    yyserror("'%s' is not an input", stage_in[i].name);
+	else
+	    find_symbol(stage_in[i].name);
+    for (i = 0; i < def_count; i++)
+	order_def(i);
+    for (i = 0; i < order_count; i++)
+	count_uses(def_tab[def_order[i]].expr);
+    for (i = 0; i < cse_count; i++) {
+	node_type_t t = cse_tab[i].node->type;
+	if (cse_tab[i].uses > 1 && t != N_NUM && t != N_VAR)
+	    cse_tab[i].local = ++local_count;
+    }
+
+    outgen_print("static struct {");
+    outgen_terminate();
+    for (i = 0; i < def_count; i++) {
+	outgen_print("    long long %s;", def_tab[i].var->sval);
+	outgen_terminate();
+    }
+    outgen_print("} hcl_sig;");
+    outgen_terminate();
+    outgen_terminate();
+
+    for (k = 0; k <= stage_count; k++) {
+	if (k == 0)
+	    outgen_print("void eval_cycle()");
+	else
+	    outgen_print("void eval_%s()", stage_name[k]);
+	outgen_terminate();
+	outgen_print("{");
+	outgen_terminate();
+	/* A local is only in scope in the function computing it */
+	for (i = 0; i < cse_count; i++)
+	    cse_tab[i].done = 0;
+	for (i = 0; i < order_count; i++) {
+	    d = def_order[i];
+	    if (def_tab[d].stage != k)
+		continue;
+	    gen_locals(def_tab[d].expr);
+	    outgen_print("    hcl_sig.%s = ", def_tab[d].var->sval);
+	    gen_canon(def_tab[d].expr, 0);
+	    outgen_print(";");
+	    outgen_terminate();
+	}
+	outgen_print("}");
+	outgen_terminate();
+	outgen_terminate();
+    }
+
+    for (i = 0; i < def_count; i++) {
+	outgen_print("long long gen_%s()", def_tab[i].var->sval);
+	outgen_terminate();
+	outgen_print("{");
+	outgen_terminate();
+	outgen_print("    return hcl_sig.%s;", def_tab[i].var->sval);
+	outgen_terminate();
+	outgen_print("}");
+	outgen_terminate();
+	outgen_terminate();
+    }
+}
+#endif /* !VLOG && !UCLID */
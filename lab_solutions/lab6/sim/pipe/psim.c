@@ -27,6 +27,17 @@
 #define MAXBUF 1024
 #define TKARGS 3
 
+/* Built from hcl2c -m (HCL_MEMO), the HCL signals are computed once a
+   cycle: EVAL(x) calls eval_x(), computing those that use the inputs
+   just set (see the -s groups in the Makefile) */
+#ifdef HCL_MEMO
+void eval_cycle(), eval_imem_icode(), eval_f_valC();
+void eval_dmem_error(), eval_e_Cnd(), eval_d_rvalA();
+#define EVAL(x) eval_##x()
+#else
+#define EVAL(x)
+#endif /* HCL_MEMO */
+
 
 /***************
  * Begin Globals
@@ -713,6 +724,7 @@ static byte_t sim_step_pipe(word_t max_instr, word_t ccount)
     /* Need to do decode after execute & memory stages,
        and memory stage before execute, in order to propagate
        forwarding values properly */
+    EVAL(cycle);
     do_if_stage();
     do_mem_stage();
     do_ex_stage();
@@ -1402,6 +1414,7 @@ void do_if_stage()
       /* Make sure can read maximum length instruction */
       imem_error = !get_byte_val(mem, valp+5, &junk);
     }
+    EVAL(imem_icode);
     if_id_next->icode = gen_f_icode();
     if_id_next->ifun  = gen_f_ifun();
     if (!imem_error) {
@@ -1428,6 +1441,7 @@ void do_if_stage()
     }
     if_id_next->valp = valp;
     if_id_next->valc = valc;
+    EVAL(f_valC);
 
     pc_next->pc = gen_f_predPC();
 
@@ -1468,6 +1482,7 @@ void do_id_wb_stages()
     /* Read the registers */
     d_regvala = get_reg_val(reg, id_ex_next->srca);
     d_regvalb = get_reg_val(reg, id_ex_next->srcb);
+    EVAL(d_rvalA);
 
     /* Do forwarding and valA selection */
     id_ex_next->vala = gen_d_valA();
@@ -1510,6 +1525,7 @@ void do_ex_stage()
     /* Perform the ALU operation */
     word_t aluout = compute_alu(alufun, alua, alub);
     ex_mem_next->vale = aluout;
+    EVAL(e_Cnd);
     sim_log("\tExecute: ALU: %c 0x%llx 0x%llx --> 0x%llx\n",
 	    op_name(alufun), alua, alub, aluout);
 
@@ -1565,6 +1581,7 @@ void do_mem_stage()
     mem_wb_next->valm = valm;
     mem_wb_next->deste = ex_mem_curr->deste;
     mem_wb_next->destm = ex_mem_curr->destm;
+    EVAL(dmem_error);
     mem_wb_next->status = gen_m_stat();
     mem_wb_next->stage_pc = ex_mem_curr->stage_pc;
 }
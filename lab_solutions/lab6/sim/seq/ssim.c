@@ -24,6 +24,17 @@
 #define MAXBUF 1024
 #define TKARGS 3
 
+/* Built from hcl2c -m (HCL_MEMO), the HCL signals are computed once a
+   cycle: EVAL(x) calls eval_x(), computing those that use the inputs
+   just set (see the -s groups in the Makefile) */
+#ifdef HCL_MEMO
+void eval_cycle(), eval_imem_icode(), eval_rA();
+void eval_valA(), eval_valE(), eval_valM();
+#define EVAL(x) eval_##x()
+#else
+#define EVAL(x)
+#endif /* HCL_MEMO */
+
 /***************
  * Begin Globals
  ***************/
@@ -667,6 +678,7 @@ static byte_t sim_step()
     imem_error = dmem_error = FALSE;
 
     update_state(); /* Update state from last cycle */
+    EVAL(cycle);
 
     if (plusmode) {
 	pc = gen_pc();
@@ -679,6 +691,7 @@ static byte_t sim_step()
     }
     imem_icode = HI4(instr);
     imem_ifun = LO4(instr);
+    EVAL(imem_icode);
     icode = gen_icode();
     ifun  = gen_ifun();
     instr_valid = gen_instr_valid();
@@ -711,6 +724,7 @@ static byte_t sim_step()
     } else {
 	valc = 0;
     }
+    EVAL(rA);
     sim_log("IF: Fetched %s at 0x%llx.  ra=%s, rb=%s, valC = 0x%llx\n",
 	    iname(HPACK(icode,ifun)), pc, reg_name(ra), reg_name(rb), valc);
 
@@ -733,6 +747,7 @@ static byte_t sim_step()
     }
 
     cond = cond_holds(cc, ifun);
+    EVAL(valA);
 
     destE = gen_dstE();
     destM = gen_dstM();
@@ -741,6 +756,7 @@ static byte_t sim_step()
     aluB = gen_aluB();
     alufun = gen_alufun();
     vale = compute_alu(alufun, aluA, aluB);
+    EVAL(valE);
     cc_in = cc;
     if (gen_set_cc())
 	cc_in = compute_cc(alufun, aluA, aluB);
@@ -765,6 +781,7 @@ static byte_t sim_step()
       word_t junk;
       dmem_error = dmem_error || !get_word_val(mem, mem_addr, &junk);
     }
+    EVAL(valM);
 
     status = gen_Stat();
 